@@ -0,0 +1,57 @@
+#ifndef ANGULAGRAMPREVIEW_H
+#define ANGULAGRAMPREVIEW_H
+
+#include <QChart>
+#include <QChartView>
+#include <QFutureWatcher>
+#include <QLineSeries>
+#include <QTimer>
+#include <QValueAxis>
+
+#include "include/topinodata.h"
+
+/* Small chart showing a low-resolution angulagram that follows the main inlet while the user drags
+ * it around. The preview is calculated in the background; requests are throttled to the display rate
+ * and only the latest one is calculated, so that the dragging itself never has to wait. */
+class AngulagramPreview : public QtCharts::QChartView {
+    Q_OBJECT
+
+  public:
+    explicit AngulagramPreview(QWidget *parent = nullptr);
+    ~AngulagramPreview();
+
+    /* Requests a new preview for the image and geometry of the main inlet; can be called as often
+     * as needed (e.g. for every mouse move) */
+    void requestPreview(const QImage& image, const TopinoData::PolarGeometry& geometry);
+
+    /* Removes the current preview (e.g. if there is no main inlet) */
+    void clearPreview();
+
+  private slots:
+    void onThrottleTimeout();
+    void onPreviewCalculated();
+
+  private:
+    /* Chart items */
+    QtCharts::QChart *chart = nullptr;
+    QtCharts::QLineSeries *series = nullptr;
+    QtCharts::QValueAxis *xaxis = nullptr;
+    QtCharts::QValueAxis *yaxis = nullptr;
+
+    /* Throttling: the timer fires at most once per frame; the latest request is kept until the
+     * previous calculation is finished */
+    QTimer throttleTimer;
+    QFutureWatcher<TopinoTools::SampledSignal> previewWatcher;
+    QImage requestedImage;
+    TopinoData::PolarGeometry requestedGeometry;
+    bool requestPending = false;
+    bool resultDiscarded = false;
+
+    /* Geometry of the preview currently calculated (needed for the axes) */
+    TopinoData::PolarGeometry calculatedGeometry;
+
+    /* Adapts the angular axis to the geometry */
+    void updateAxes(const TopinoData::PolarGeometry& geometry);
+};
+
+#endif // ANGULAGRAMPREVIEW_H
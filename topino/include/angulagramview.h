@@ -21,7 +21,7 @@ class AngulagramView : public TopinoAbstractView {
     AngulagramView(QWidget *parent, TopinoDocument &doc);
     ~AngulagramView();
 
-    void modelHasChanged() override;
+    void modelHasChanged(int changes) override;
     bool isToolSupported(const TopinoAbstractView::tools& value) const override;
 
     /* Show this view */
@@ -32,17 +32,36 @@ class EvalAngulagramDialog : public QDialog {
     bool getOrientationRTL() const;
     void setOrientationRTL(bool value);
 
-    void setDataPoints(const QVector<QPointF>& value);
+    void setDataPoints(const TopinoTools::SampledSignal& value);
 
     qreal getScalingFactor() const;
     void setScalingFactor(const qreal& value);
 
     QVector<TopinoTools::Lorentzian> getLorentzians() const;
+    void setInitialLorentzians(const QVector<TopinoTools::Lorentzian>& value);
+
+    /* Data the current fits were calculated on (e.g. for the confidence intervals, see
+     * TopinoTools::calculateBootstrap) */
+    QVector<QPointF> getCorrectedDataPoints() const;
+    QVector<TopinoTools::Section> getSections() const;
+
+    TopinoTools::Baseline getBaseline() const;
+    void setBaselineParameters(const TopinoTools::Baseline& value);
+
+    TopinoTools::peakModels getPeakModel() const;
+    void setPeakModel(TopinoTools::peakModels model);
 
   private slots:
     void on_spinSmoothSize_valueChanged(int value);
     void on_spinSmoothSigma_valueChanged(double value);
     void on_spinThreshold_valueChanged(double value);
+    void on_comboFilter_currentIndexChanged(int index);
+    void on_comboModel_currentIndexChanged(int index);
+    void on_checkBaseline_toggled(bool checked);
+    void on_spinBaselineLambda_valueChanged(double value);
+    void on_spinBaselineAsymmetry_valueChanged(double value);
+    void on_buttonAutoTune_clicked();
+    void on_comboAutoTune_activated(int index);
 
   private:
     /* Interface definitions */
@@ -70,11 +89,32 @@ class EvalAngulagramDialog : public QDialog {
     void createDataSeries();
 
     /* Data points and functions */
-    QVector<QPointF> dataPoints;
+    TopinoTools::SampledSignal dataPoints;
     QVector<QPointF> smoothenedDataPoints;
+    QVector<QPointF> correctedDataPoints;
+    TopinoTools::Baseline baseline;
     QVector<TopinoTools::Extrema> extrema;
+
+    /* Peak hierarchy of the smoothened (and baseline corrected) data; it is only recalculated if the
+     * smoothing or baseline parameters change, so that changing the threshold or filter is just a lookup. */
+    TopinoTools::PeakHierarchy peakHierarchy;
+    QVector<TopinoTools::WaveletPeak> waveletPeaks;
+    int hierarchySmoothSize = -1;
+    qreal hierarchySmoothSigma = 0.0;
+    QVector<TopinoTools::Section> sections;
     QVector<TopinoTools::Lorentzian> lorentzians;
 
+    /* Previous (or stored) fits used as starting values for the next fits and a cache for
+     * the fits of sections that did not change. */
+    QVector<TopinoTools::Lorentzian> previousLorentzians;
+    TopinoTools::LorentzianCache fitCache;
+
+    /* Best parameter sets found by the auto-tune engine */
+    QVector<TopinoTools::AutoTuneCandidate> autoTuneCandidates;
+
+    /* Sets the parameters (without triggering an update for each single value) */
+    void setEvaluationParameters(const TopinoTools::EvaluationParameters& parameters);
+
     /* Processed the data */
     void processData();
 };
@@ -7,7 +7,9 @@
 #include <QGraphicsView>
 #include <QMimeData>
 #include <QScrollBar>
+#include <QSet>
 #include <QSvgGenerator>
+#include <QTimer>
 #include <QWheelEvent>
 
 #include "include/topinoabstractview.h"
@@ -30,11 +32,12 @@ class ImageAnalysisView : public TopinoAbstractView {
     ImageAnalysisView(QWidget *parent, TopinoDocument &doc);
     ~ImageAnalysisView();
 
-    void modelHasChanged();
+    void modelHasChanged(int changes) override;
 
     void resetView();
 
-    void setImage(const QImage &image);
+    /* Shows the image; if a size is given, the image is a preview and shown with this size */
+    void setImage(const QImage &image, const QSize &size = QSize());
 
     void setImageBasedSceneRect();
 
@@ -74,6 +77,7 @@ class ImageAnalysisView : public TopinoAbstractView {
     bool isEditFunctionSupported(const TopinoAbstractView::editfunc& value) const override;
 
     void createToolsFromDocument();
+    void recreateInletTools();
     TopinoGraphicsItem* getToolbyTypeAndId(TopinoGraphicsItem::itemtype type, int id);
     PolarCircleToolItem* getMainInletTool();
     void getPointsOfRulerIntersections(QList<QPointF> &list, bool currentSelection = false) const;
@@ -110,6 +114,12 @@ class ImageAnalysisView : public TopinoAbstractView {
     /* Tool data and functions */
     InputImageToolItem* inputImage = nullptr;
 
+    /* Position changes of items while dragging are collected and propagated at most once per frame;
+     * data changes (i.e. mouse release) are propagated immediately */
+    QTimer itemChangeTimer;
+    QSet<int> pendingItemChanges;
+    void onItemChangeTimeout();
+
     InputImageToolItem* createInputImageToolItem(const QPixmap& pixmap);
     RulerToolItem* createRulerToolItem(QPointF srcPoint, QPointF destPoint);
     PolarCircleToolItem* createInletToolItem(QPointF srcPoint, int radius, bool addToDocument = false);
@@ -23,8 +23,11 @@ class InputImageToolItem : public TopinoGraphicsItem {
     itemtype getItemType() const override;
     void updateScale() override;
 
+    /* The pixmap is drawn with the size of the image, which can be larger than the pixmap itself
+     * (e.g. for a scaled preview while the image is still loading) */
     QPixmap getPixmap() const;
-    void setPixmap(const QPixmap value);
+    QSize getImageSize() const;
+    void setPixmap(const QPixmap value, const QSize& size = QSize());
 
     void mousePressEvent(QGraphicsSceneMouseEvent *event) override;
     void mouseMoveEvent(QGraphicsSceneMouseEvent *event) override;
@@ -45,8 +48,9 @@ class InputImageToolItem : public TopinoGraphicsItem {
     };
     parts partClicked = parts::none;
 
-    /* Image data as pixmap */
+    /* Image data as pixmap and the size of the image */
     QPixmap pixmap;
+    QSize imageSize;
 
     /* Rectangle for the whole tool including the border around the image */
     QRectF rect;
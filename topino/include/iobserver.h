@@ -7,7 +7,21 @@ class IObserver {
     IObserver();
     ~IObserver();
 
-    virtual void modelHasChanged() = 0;
+    /* Parts of the model that changed; observers get a combination of these flags and only need
+     * to refresh what depends on them. */
+    enum changeFlags {
+        changeNone = 0x00,
+        changeImage = 0x01,       /* source image */
+        changeProcessing = 0x02,  /* processing parameters and processed image */
+        changeGeometry = 0x04,    /* main inlet and polar coordinate system */
+        changeInlets = 0x08,      /* any inlet */
+        changeAngulagram = 0x10,  /* polar image, angulagram, and radialgram */
+        changeStreams = 0x20,     /* stream parameters and baseline */
+        changeFile = 0x40,        /* file name and saved state */
+        changeAll = 0x7F
+    };
+
+    virtual void modelHasChanged(int changes) = 0;
 };
 
 #endif // IOBSERVER_H
@@ -1,16 +1,26 @@
 #ifndef MAINWINDOW_H
 #define MAINWINDOW_H
 
+#include <QAtomicInt>
+#include <QDockWidget>
+#include <QFutureWatcher>
 #include <QLabel>
+#include <QLockFile>
 #include <QMainWindow>
 #include <QImage>
 #include <QPainter>
+#include <QPair>
+#include <QProgressBar>
+#include <QPushButton>
+#include <QSharedPointer>
 #include <QStackedWidget>
 #include <QSvgGenerator>
+#include <QTimer>
 
 #include "include/iobserver.h"
 #include "include/topinodocument.h"
 
+#include "include/angulagrampreview.h"
 #include "include/angulagramview.h"
 #include "include/evalangulagramdialog.h"
 #include "include/imageanalysisview.h"
@@ -18,6 +28,11 @@
 #include "include/inletpropdialog.h"
 #include "include/polarimagedialog.h"
 #include "include/radialgramdialog.h"
+#include "include/rawimagedialog.h"
+#ifdef TOPINO_RESULT_STORE
+#include "include/resultstore.h"
+#include "include/resultstoredialog.h"
+#endif
 
 
 namespace Ui {
@@ -34,7 +49,7 @@ class MainWindow : public QMainWindow, public IObserver {
     void closeEvent(QCloseEvent *event) override;
     bool eventFilter(QObject *watched, QEvent *event) override;    
 
-    void modelHasChanged() final;
+    void modelHasChanged(int changes) final;
 
   private slots:
     void onNew();
@@ -44,6 +59,16 @@ class MainWindow : public QMainWindow, public IObserver {
     void onImportImage();
     void onQuit();
 
+    void onStoreResults(bool checked);
+    void onReferenceImage(bool checked);
+    void onImageStore(bool checked);
+    void onCropImage(bool checked);
+    void onResultStore(bool checked);
+    void onQueryResults();
+
+    void onUndo();
+    void onRedo();
+
     void onCut();
     void onCopy();
     void onPaste();
@@ -103,6 +128,26 @@ class MainWindow : public QMainWindow, public IObserver {
     void onToolSelectOnlyInlets();
     void onToolInletAtIntersection();
 
+    /* Background calculation of the angulagram */
+    void onAngulagramCalculated();
+    void onCancelAngulagramCalculation();
+    void onAngulagramPreviewVisibilityChanged(bool visible);
+
+    /* Background calculation of the confidence intervals of the streams */
+    void onBootstrapCalculated();
+
+    /* Background saving */
+    void onDocumentSaved();
+
+    /* Autosave journal */
+    void onJournalTimer();
+    void onJournalWritten();
+    void onRecoverJournals();
+
+    /* Background loading of images */
+    void onImagePreviewLoaded(const QImage& preview, const QSize& size, int loadID);
+    void onImageLoaded();
+
     /* Event slots */
     void onViewHasChanged();
     void onSelectionHasChanged();
@@ -139,6 +184,97 @@ class MainWindow : public QMainWindow, public IObserver {
 
     QGraphicsScene *angulascene = nullptr;
 
+    /* Background calculation of the angulagram: the calculation runs on a copy of the data, which
+     * is published to the document when finished. Each calculation has its own cancel flag; the
+     * key of the polar stage detects if the document changed during the calculation. */
+    QFutureWatcher<TopinoData> angulagramWatcher;
+    QSharedPointer<QAtomicInt> angulagramCanceled;
+    uint angulagramJobKey = 0;
+    bool angulagramCheckPending = false;
+    QProgressBar *angulagramProgress = nullptr;
+    QPushButton *angulagramCancelButton = nullptr;
+
+    void startAngulagramCalculation();
+    void cancelAngulagramCalculation();
+
+    /* Background loading of images: the document (inlets, etc.) is shown first, while the image is
+     * decoded and processed on a copy of the data. If the format supports it, a scaled preview is
+     * shown until the full image is available. Each load has its own ID to drop outdated previews. */
+    QFutureWatcher<TopinoData> imageWatcher;
+    int imageLoadID = 0;
+    bool imageLoadPending = false;
+    bool imageImporting = false;
+
+    /* Layout of the last raw frame imported */
+    MappedImageReader::RawFormat rawFormat;
+
+    void startImageLoading(const QByteArray& encodedImage, const QString& imageFilename, bool importing,
+                           const MappedImageReader::RawFormat& rawFormat = MappedImageReader::RawFormat());
+    void cancelImageLoading();
+    void importImage(const QImage& img, const QString& file, const QByteArray& hash);
+
+    /* Background calculation of the confidence intervals of the streams: the bootstrap runs on copies of
+     * the fits and their data, which are published to the document if the streams did not change. */
+    QFutureWatcher<QVector<TopinoTools::Lorentzian>> bootstrapWatcher;
+
+    void startBootstrapCalculation(const QVector<QPointF>& points, const QVector<TopinoTools::Section>& sections,
+                                   const QVector<TopinoTools::Lorentzian>& fits);
+
+    /* Background saving: a snapshot of the document is saved, so that editing can continue during
+     * saving. The revision of the snapshot tells if the document changed in the meantime. Saves are
+     * not run in parallel; a save requested during saving follows when the running one is finished.
+     * The result is the error and the saved snapshot. */
+    QFutureWatcher<QPair<TopinoDocument::FileError, TopinoDocument>> saveWatcher;
+    quint64 savedRevision = 0;
+    bool saveRunning = false;
+    bool savePending = false;
+    QProgressBar *saveProgress = nullptr;
+
+    void startSaving();
+
+    /* Waits until all saves are finished (e.g. before the document is replaced) */
+    void finishSaving();
+
+    /* Autosave: the changes are recorded in a journal (see TopinoDocument::startJournal) a few seconds
+     * after they were made, in the background. The journals are listed in an index in the application
+     * data, so that they can be recovered after a crash; a lock file tells if a journal is in use. The
+     * journal is removed when the document is saved or discarded. */
+    QTimer journalTimer;
+    QFutureWatcher<TopinoDocument::FileError> journalWatcher;
+    QSharedPointer<QLockFile> journalLock;
+    QString journalFile;
+    bool journalStarted = false;
+    bool journalDirty = false;
+
+    QString getJournalFilename() const;
+    void closeJournal(bool remove);
+
+    QString getJournalIndexFilename() const;
+    QStringList readJournalIndex() const;
+    void writeJournalIndex(const QStringList& journals) const;
+
+    /* Checks if the angulagram contains a lot of background and warns the user */
+    void checkAngulagramBackground();
+
+    /* Docked live preview of the angulagram; it follows the main inlet tool while it is dragged */
+    QDockWidget *dockAngulagramPreview = nullptr;
+    AngulagramPreview *angulagramPreview = nullptr;
+
+    void updateAngulagramPreview(const TopinoData::PolarGeometry& geometry);
+
+    /* Options of the file menu for saving documents (and where referenced images are looked up) */
+    QString getImageStorePath() const;
+    void applyFileOptions(TopinoDocument& doc) const;
+
+    /* Local database of the stream parameters of saved documents; opened when needed. Only available
+     * if Topino is built with the SQL module (the menu entries are hidden otherwise). */
+#ifdef TOPINO_RESULT_STORE
+    ResultStore resultStore;
+
+    QString getResultStorePath() const;
+    bool openResultStore();
+#endif
+
     void changeTool(TopinoAbstractView::tools tool);
     void changeToView(const viewPages value);
     TopinoAbstractView *getCurrentView();
@@ -0,0 +1,60 @@
+#ifndef MAPPEDIMAGEREADER_H
+#define MAPPEDIMAGEREADER_H
+
+#include <QFile>
+#include <QImage>
+#include <QSharedPointer>
+#include <QString>
+
+/* Reader for uncompressed scientific frames (raw frames without header, binary PGM/PPM, and PFM) that
+ * maps the file into memory instead of decoding it. Whenever the pixels can be used as they are stored
+ * (8 bit, or 16 bit in the byte order of the machine), the image uses the mapping directly and holds a
+ * reference to the file; importing such a frame costs nothing but the page faults of reading it. Other
+ * layouts are converted into an image of their own. The mapped file must not change while it is used. */
+class MappedImageReader {
+  public:
+    /* Layout of a raw frame (gray values, one line after the other) */
+    struct RawFormat {
+        int width = 0;
+        int height = 0;
+
+        /* Up to 8 bits are stored in one byte, up to 16 bits in two bytes per pixel */
+        int bitDepth = 16;
+        bool bigEndian = false;
+
+        /* Bytes per line (0 if the lines are packed) and bytes before the first line */
+        int stride = 0;
+        qint64 offset = 0;
+
+        bool isValid() const;
+        int getBytesPerPixel() const;
+        int getBytesPerLine() const;
+        qint64 getFrameSize() const;
+    };
+
+    /* Files with a header (PGM/PPM/PFM) and raw frames, detected by the suffix */
+    static bool canRead(const QString& filename);
+    static bool isRawFrame(const QString& filename);
+
+    /* Reads a PGM/PPM/PFM file; the hash of the file content is calculated from the mapping if asked
+     * for. Returns a null image if the file is not supported (e.g. ASCII PGM), so that the caller can
+     * decode it in another way. */
+    static QImage read(const QString& filename, QByteArray *hash = nullptr);
+
+    /* Reads a raw frame with the given layout */
+    static QImage readRaw(const QString& filename, const RawFormat& format);
+
+    /* Image using the mapped pixels; it holds a reference to the file (also used for the uncompressed
+     * images of binary documents) */
+    static QImage wrapMapping(const QSharedPointer<QFile>& file, const uchar *pixels, int width, int height,
+                              int bytesPerLine, QImage::Format format);
+
+  private:
+    /* Maps the whole file; the file is closed when the last image using it is gone */
+    static QSharedPointer<QFile> mapFile(const QString& filename, const uchar *&data, qint64& size);
+
+    static QImage readPNM(const QSharedPointer<QFile>& file, const uchar *data, qint64 size);
+    static QImage readPFM(const uchar *data, qint64 size);
+};
+
+#endif // MAPPEDIMAGEREADER_H
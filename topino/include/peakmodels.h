@@ -0,0 +1,392 @@
+#ifndef PEAKMODELS_H
+#define PEAKMODELS_H
+
+#include <QPointF>
+#include <QVector>
+#include <QtMath>
+
+#include <algorithm>
+#include <cmath>
+
+/* Important: do not include LevenbergMarquardt directly, but by NLO header! */
+#include <Eigen/Eigen>
+#include <unsupported/Eigen/NonLinearOptimization>
+
+namespace TopinoTools {
+
+/* Peak models available for fitting streams */
+enum peakModels {
+    modelLorentzian = 0,
+    modelGaussian = 1,
+    modelPseudoVoigt = 2,
+    modelEMG = 3,
+    modelCOUNT = 4
+};
+
+/* All peak models share the same order of parameters: pos (index=0), height (index=1), width
+ * (index=2), offset (index=3), and an optional shape parameter (index=4). The width is always
+ * the full width at half maximum (FWHM) of the symmetric part of the peak. Each model defines
+ * the number of parameters at compile time and provides the value as well as the analytic
+ * gradient (i.e. the partial derivatives for all parameters) at x. */
+
+/* Lorentzian: y = height * (width/2)^2 / ((width/2)^2 + (pos - x)^2) + offset */
+struct LorentzianModel {
+    static constexpr int Parameters = 4;
+
+    static inline qreal value(qreal x, const qreal *p) {
+        qreal gamma2 = p[2] * p[2] / 4.0;
+        qreal denominator = gamma2 + (x - p[0]) * (x - p[0]);
+
+        if (denominator == 0.0) {
+            return p[3];
+        }
+
+        return p[1] * gamma2 / denominator + p[3];
+    }
+
+    static inline void gradient(qreal x, const qreal *p, qreal *grad) {
+        qreal dx = x - p[0];
+        qreal gamma2 = p[2] * p[2] / 4.0;
+        qreal denominator = gamma2 + dx * dx;
+
+        if (denominator == 0.0) {
+            grad[0] = grad[1] = grad[2] = 0.0;
+            grad[3] = 1.0;
+            return;
+        }
+
+        qreal denominator2 = denominator * denominator;
+        grad[0] = 2.0 * p[1] * gamma2 * dx / denominator2;
+        grad[1] = gamma2 / denominator;
+        grad[2] = p[1] * (p[2] / 2.0) * dx * dx / denominator2;
+        grad[3] = 1.0;
+    }
+};
+
+/* Gaussian: y = height * exp(-4 ln2 (x - pos)^2 / width^2) + offset */
+struct GaussianModel {
+    static constexpr int Parameters = 4;
+
+    static inline qreal value(qreal x, const qreal *p) {
+        if (p[2] == 0.0) {
+            return p[3];
+        }
+
+        qreal dx = x - p[0];
+        return p[1] * qExp(-4.0 * M_LN2 * dx * dx / (p[2] * p[2])) + p[3];
+    }
+
+    static inline void gradient(qreal x, const qreal *p, qreal *grad) {
+        if (p[2] == 0.0) {
+            grad[0] = grad[1] = grad[2] = 0.0;
+            grad[3] = 1.0;
+            return;
+        }
+
+        qreal dx = x - p[0];
+        qreal w2 = p[2] * p[2];
+        qreal e = qExp(-4.0 * M_LN2 * dx * dx / w2);
+
+        grad[0] = p[1] * e * 8.0 * M_LN2 * dx / w2;
+        grad[1] = e;
+        grad[2] = p[1] * e * 8.0 * M_LN2 * dx * dx / (w2 * p[2]);
+        grad[3] = 1.0;
+    }
+};
+
+/* Pseudo-Voigt: linear combination of a Lorentzian and a Gaussian with the same position, height,
+ * and width; y = height * (eta * L(x) + (1 - eta) * G(x)) + offset with the shape parameter eta.
+ * The solver is unconstrained, so eta is clamped to [0, 1] (the gradient vanishes outside). */
+struct PseudoVoigtModel {
+    static constexpr int Parameters = 5;
+
+    static inline qreal value(qreal x, const qreal *p) {
+        const qreal unit[4] = { p[0], 1.0, p[2], 0.0 };
+        qreal eta = qBound(0.0, p[4], 1.0);
+
+        return p[1] * (eta * LorentzianModel::value(x, unit) + (1.0 - eta) * GaussianModel::value(x, unit)) + p[3];
+    }
+
+    static inline void gradient(qreal x, const qreal *p, qreal *grad) {
+        const qreal unit[4] = { p[0], 1.0, p[2], 0.0 };
+        qreal eta = qBound(0.0, p[4], 1.0);
+
+        qreal l = LorentzianModel::value(x, unit);
+        qreal g = GaussianModel::value(x, unit);
+
+        qreal gradL[4];
+        qreal gradG[4];
+        LorentzianModel::gradient(x, unit, gradL);
+        GaussianModel::gradient(x, unit, gradG);
+
+        grad[0] = p[1] * (eta * gradL[0] + (1.0 - eta) * gradG[0]);
+        grad[1] = eta * l + (1.0 - eta) * g;
+        grad[2] = p[1] * (eta * gradL[2] + (1.0 - eta) * gradG[2]);
+        grad[3] = 1.0;
+        grad[4] = ((p[4] >= 0.0) && (p[4] <= 1.0)) ? p[1] * (l - g) : 0.0;
+    }
+};
+
+/* Exponentially modified Gaussian (EMG), i.e. a Gaussian convoluted with an exponential decay for
+ * tailing streams. The position and width are the ones of the Gaussian part, the height is the
+ * height of the Gaussian part before the convolution. The shape parameter tau is the time constant
+ * of the decay; its sign gives the direction of the tail (positive: tailing towards larger x). */
+struct EMGModel {
+    static constexpr int Parameters = 5;
+
+    /* Scaled complementary error function erfcx(z) = exp(z^2) erfc(z) for z >= 0; uses the
+     * asymptotic expansion for large z to avoid an overflow of exp(z^2) (and an underflow of
+     * erfc(z)). At z = 25, the error of the expansion is below 1e-10. */
+    static inline qreal scaledErfc(qreal z) {
+        if (z < 25.0) {
+            return qExp(z * z) * std::erfc(z);
+        }
+
+        qreal z2 = z * z;
+        return 1.0 / (z * std::sqrt(M_PI)) * (1.0 - 1.0 / (2.0 * z2) + 3.0 / (4.0 * z2 * z2) - 15.0 / (8.0 * z2 * z2 * z2));
+    }
+
+    /* Calculates the value without offset (f0) and the Gaussian term hG needed for the gradient */
+    static inline void terms(qreal x, const qreal *p, qreal &f0, qreal &hG, qreal &u, qreal &sigma, qreal &t, qreal &s) {
+        sigma = qAbs(p[2]) / (2.0 * std::sqrt(2.0 * M_LN2));
+        s = (p[4] < 0.0) ? -1.0 : 1.0;
+        t = qAbs(p[4]);
+        u = s * (x - p[0]);
+
+        qreal g = qExp(-u * u / (2.0 * sigma * sigma));
+        hG = p[1] * g;
+
+        qreal r = sigma / t;
+        qreal z = (r - u / sigma) / M_SQRT2;
+
+        /* exp(r^2/2 - u/t) * erfc(z) = exp(-u^2/(2 sigma^2)) * erfcx(z); the first form is stable
+         * for negative z, the second one for positive z. */
+        qreal product = (z < 0.0) ? qExp(r * r / 2.0 - u / t) * std::erfc(z) : g * scaledErfc(z);
+
+        f0 = p[1] * r * std::sqrt(M_PI / 2.0) * product;
+    }
+
+    static inline qreal value(qreal x, const qreal *p) {
+        /* Without tailing or width, this is simply a Gaussian */
+        if ((p[4] == 0.0) || (p[2] == 0.0)) {
+            return GaussianModel::value(x, p);
+        }
+
+        qreal f0, hG, u, sigma, t, s;
+        terms(x, p, f0, hG, u, sigma, t, s);
+
+        return f0 + p[3];
+    }
+
+    static inline void gradient(qreal x, const qreal *p, qreal *grad) {
+        if ((p[4] == 0.0) || (p[2] == 0.0)) {
+            GaussianModel::gradient(x, p, grad);
+            grad[4] = 0.0;
+            return;
+        }
+
+        qreal f0, hG, u, sigma, t, s;
+        terms(x, p, f0, hG, u, sigma, t, s);
+
+        qreal r = sigma / t;
+        qreal dSigma = f0 * (1.0 / sigma + sigma / (t * t)) - hG * (sigma / (t * t) + u / (sigma * t));
+        qreal dT = f0 * (u / t - r * r - 1.0) / t + hG * r * r / t;
+
+        grad[0] = (s / t) * (f0 - hG);
+        grad[1] = (p[1] != 0.0) ? f0 / p[1] : 0.0;
+        grad[2] = dSigma / (2.0 * std::sqrt(2.0 * M_LN2)) * ((p[2] < 0.0) ? -1.0 : 1.0);
+        grad[3] = 1.0;
+        grad[4] = s * dT;
+    }
+};
+
+/* Compares the analytic gradient of a model with central finite differences at x; used to check
+ * the gradients in debug builds. Parameters too close to a point where the model switches its form
+ * (i.e. zero) are not checked. */
+template<typename Model>
+bool isGradientConsistent(qreal x, const qreal *p, qreal tolerance = 1e-4) {
+    qreal grad[Model::Parameters];
+    Model::gradient(x, p, grad);
+
+    for(int j = 0; j < Model::Parameters; ++j) {
+        qreal h = 1e-6 * qMax(1.0, qAbs(p[j]));
+        if (qAbs(p[j]) <= 2.0 * h) {
+            continue;
+        }
+
+        qreal plus[Model::Parameters];
+        qreal minus[Model::Parameters];
+        std::copy(p, p + Model::Parameters, plus);
+        std::copy(p, p + Model::Parameters, minus);
+        plus[j] += h;
+        minus[j] -= h;
+
+        qreal difference = (Model::value(x, plus) - Model::value(x, minus)) / (2.0 * h);
+        qreal scale = qMax(1.0, qMax(qAbs(grad[j]), qAbs(difference)));
+
+        if (qAbs(grad[j] - difference) > tolerance * scale) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Solver for any of the peak models above: Levenberg-Marquardt on the normal equations, which have
+ * the (fixed) size of the parameters, so that nothing is allocated while solving and all loops over
+ * the parameters are unrolled. Each iteration accumulates J^T J and J^T r over the data points and
+ * solves (J^T J + lambda diag(J^T J)) step = J^T r by LDLT; the damping lambda is decreased after a
+ * successful step and increased until a step decreases the sum of squared errors. The data values
+ * are kept, so that a solver can be reused (e.g. for the bootstrap, with new y-values). */
+template<typename Model>
+struct PeakSolver {
+    typedef Eigen::Matrix<double, Model::Parameters, 1> ParameterVector;
+    typedef Eigen::Matrix<double, Model::Parameters, Model::Parameters> NormalMatrix;
+
+    /* Data values to fit to; x- and y-values are stored in separate contiguous arrays */
+    QVector<double> xValues;
+    QVector<double> yValues;
+
+    int maxIterations = 200;
+    double tolerance = 1e-10;
+
+    /* Iterations of the last minimization */
+    int iterations = 0;
+
+    /* Sets the data values from a list of points */
+    void setDataValues(const QVector<QPointF> &points) {
+        xValues.resize(points.size());
+        yValues.resize(points.size());
+
+        for(int i = 0; i < points.size(); ++i) {
+            xValues[i] = points[i].x();
+            yValues[i] = points[i].y();
+        }
+    }
+
+    /* Sum of squared errors between the data and the model */
+    double squaredError(const ParameterVector &p) const {
+        double sum = 0.0;
+
+        for(int i = 0; i < xValues.size(); ++i) {
+            double error = yValues[i] - Model::value(xValues[i], p.data());
+            sum += error * error;
+        }
+
+        return sum;
+    }
+
+    /* Minimizes the squared error starting from p; returns false if the solver did not converge
+     * within the maximum number of iterations */
+    bool minimize(ParameterVector &p) {
+        double lambda = 1e-3;
+        double error = squaredError(p);
+
+        for(iterations = 1; iterations <= maxIterations; ++iterations) {
+            NormalMatrix jtj = NormalMatrix::Zero();
+            ParameterVector jtr = ParameterVector::Zero();
+            ParameterVector gradient;
+
+            for(int i = 0; i < xValues.size(); ++i) {
+                Model::gradient(xValues[i], p.data(), gradient.data());
+                jtj.noalias() += gradient * gradient.transpose();
+                jtr += (yValues[i] - Model::value(xValues[i], p.data())) * gradient;
+            }
+
+            /* Increase the damping until the step decreases the error; if no step does, p is a minimum */
+            for(;;) {
+                if (lambda > 1e12) {
+                    return true;
+                }
+
+                NormalMatrix damped = jtj;
+                damped.diagonal() += lambda * jtj.diagonal().cwiseMax(1e-12);
+
+                ParameterVector step = damped.ldlt().solve(jtr);
+                ParameterVector candidate = p + step;
+                double candidateError = squaredError(candidate);
+
+                if (std::isfinite(candidateError) && (candidateError < error)) {
+                    bool converged = ((error - candidateError) <= tolerance * error) ||
+                                     (step.norm() <= tolerance * (p.norm() + tolerance));
+
+                    p = candidate;
+                    error = candidateError;
+                    lambda = qMax(lambda / 10.0, 1e-12);
+
+                    if (converged) {
+                        return true;
+                    }
+
+                    break;
+                }
+
+                lambda *= 10.0;
+            }
+        }
+
+        return false;
+    }
+};
+
+/* Functor for the Eigen-Solver for any of the peak models above; only used as fallback if
+ * PeakSolver does not converge. The Eigen solver works on dynamic vectors, but the model and its
+ * analytic jacobian are evaluated with fixed-size vectors. */
+template<typename Model>
+struct PeakFunctor {
+    typedef Eigen::Matrix<double, Model::Parameters, 1> ParameterVector;
+
+    /* Data values to fit to; x- and y-values are stored in separate contiguous arrays */
+    Eigen::VectorXd xValues;
+    Eigen::VectorXd yValues;
+
+    /* Sets the data values from a list of points */
+    void setDataValues(const QVector<QPointF> &points) {
+        xValues.resize(points.size());
+        yValues.resize(points.size());
+
+        for(int i = 0; i < points.size(); ++i) {
+            xValues(i) = points[i].x();
+            yValues(i) = points[i].y();
+        }
+    }
+
+    /* This is what calculates a value at x and respective errors */
+    int operator()(const Eigen::VectorXd &p, Eigen::VectorXd &fvec) const {
+        const ParameterVector parameters = p;
+
+        /* For all values calculate the error between the data value and the predicted value. */
+        for(int i = 0; i < values(); ++i) {
+            fvec(i) = yValues(i) - Model::value(xValues(i), parameters.data());
+        }
+
+        return 0;
+    }
+
+    /* Compute the jacobian of the errors analytically (errors are data - model, hence the sign) */
+    int df(const Eigen::VectorXd &p, Eigen::MatrixXd &fjac) const {
+        const ParameterVector parameters = p;
+        ParameterVector gradient;
+
+        for(int i = 0; i < values(); ++i) {
+            Model::gradient(xValues(i), parameters.data(), gradient.data());
+            fjac.row(i) = -gradient.transpose();
+        }
+
+        return 0;
+    }
+
+    /* Number of data points/values */
+    int values() const {
+        return int(xValues.size());
+    }
+
+    /* Number of parameters (also called "inputs") as defined by the model. */
+    int inputs() const {
+        return Model::Parameters;
+    }
+};
+
+}
+
+#endif // PEAKMODELS_H
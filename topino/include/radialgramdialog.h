@@ -8,6 +8,7 @@
 #include <QSvgGenerator>
 #include <QValueAxis>
 
+#include "include/topinotool.h"
 
 namespace Ui {
 class RadialgramDialog;
@@ -23,7 +24,7 @@ class RadialgramDialog : public QDialog {
     void resizeEvent(QResizeEvent* event) override;
     void showEvent(QShowEvent *event) override;
 
-    void setDataPoints(const QVector<QPointF>& value);
+    void setDataPoints(const TopinoTools::SampledSignal& value);
 
     qreal getScalingFactor() const;
     void setScalingFactor(const qreal& value);
@@ -42,7 +43,7 @@ class RadialgramDialog : public QDialog {
     QtCharts::QChart *chart = nullptr;
 
     /* Data points and functions */
-    QVector<QPointF> dataPoints;
+    TopinoTools::SampledSignal dataPoints;
 
     /* This is the scaling factor for the data on the y-axis. All data in the document/data
      * object is scaled by this factor before it is added to the chart. */
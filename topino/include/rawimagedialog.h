@@ -0,0 +1,35 @@
+#ifndef RAWIMAGEDIALOG_H
+#define RAWIMAGEDIALOG_H
+
+#include <QDialog>
+
+#include "include/mappedimagereader.h"
+
+namespace Ui {
+class RawImageDialog;
+}
+
+/* Asks for the layout of a raw frame (which has no header); the size of the frame is checked
+ * against the size of the file */
+class RawImageDialog : public QDialog {
+    Q_OBJECT
+
+  public:
+    explicit RawImageDialog(qint64 fileSize, QWidget *parent = 0);
+    ~RawImageDialog();
+
+    /* An invalid format is replaced by a guess from the file size (square frames) */
+    MappedImageReader::RawFormat getFormat() const;
+    void setFormat(const MappedImageReader::RawFormat& value);
+
+  private slots:
+    void updateFrameSize();
+
+  private:
+    /* Interface definitions */
+    Ui::RawImageDialog *ui;
+
+    qint64 fileSize = 0;
+};
+
+#endif // RAWIMAGEDIALOG_H
@@ -0,0 +1,69 @@
+#ifndef RESULTSTORE_H
+#define RESULTSTORE_H
+
+#include <QDateTime>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QString>
+
+#include "include/topinodocument.h"
+
+/* Local SQLite database (via Qt SQL) that indexes the metadata and the stream parameters of saved
+ * analyses, so that many analyses can be compared without opening the documents (and decoding
+ * their images). Each document file has one entry, which is replaced when the file is saved again. */
+class ResultStore {
+  public:
+    ResultStore();
+    ~ResultStore();
+
+    bool open(const QString& databaseFile);
+    void close();
+    bool isOpen() const;
+
+    /* Adds or replaces the entry of a saved document */
+    bool indexDocument(const TopinoDocument& document);
+
+    /* Filter for the streams; the file is a pattern with * as wildcard, stream 0 means all streams */
+    struct Filter {
+        QString file;
+        int stream = 0;
+        qreal minPos = -360.0;
+        qreal maxPos = 360.0;
+        qreal minRSquare = 0.0;
+        int limit = 100000;
+    };
+
+    /* Columns of the query results */
+    enum queryColumns {
+        columnFile = 0,
+        columnSaved = 1,
+        columnStream = 2,
+        columnPos = 3,
+        columnPosLower = 4,
+        columnPosUpper = 5,
+        columnWidth = 6,
+        columnWidthLower = 7,
+        columnWidthUpper = 8,
+        columnRSquare = 9,
+        columnModel = 10,
+        columnResolution = 11,
+        columnCOUNT = 12
+    };
+
+    static QString getColumnName(queryColumns column);
+
+    /* Returns one row per stream matching the filter (ordered by the time of saving); the resolution
+     * is the one to the next stream */
+    QSqlQuery queryStreams(const Filter& filter) const;
+
+    /* Number of analyses in the store */
+    int countAnalyses() const;
+
+  private:
+    /* Name of the database connection; each store has its own */
+    QString connectionName;
+
+    bool createTables();
+};
+
+#endif // RESULTSTORE_H
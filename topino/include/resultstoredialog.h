@@ -0,0 +1,41 @@
+#ifndef RESULTSTOREDIALOG_H
+#define RESULTSTOREDIALOG_H
+
+#include <QChart>
+#include <QDialog>
+#include <QSqlQueryModel>
+
+#include "include/resultstore.h"
+
+namespace Ui {
+class ResultStoreDialog;
+}
+
+/* Query panel for the result store: filters the streams of all indexed analyses and shows the
+ * matching streams as table and the trend of their positions over time */
+class ResultStoreDialog : public QDialog {
+    Q_OBJECT
+
+  public:
+    explicit ResultStoreDialog(ResultStore& store, QWidget *parent = 0);
+    ~ResultStoreDialog();
+
+  private slots:
+    void on_buttonQuery_clicked();
+
+  private:
+    /* Interface definitions */
+    Ui::ResultStoreDialog *ui;
+
+    /* Store to query and model holding the results */
+    ResultStore& store;
+    QSqlQueryModel *model = nullptr;
+
+    /* Chart items */
+    QtCharts::QChart *chart = nullptr;
+
+    /* Re-creates the trend chart from the results (one series per stream number) */
+    void updateTrend();
+};
+
+#endif // RESULTSTOREDIALOG_H
@@ -1,10 +1,16 @@
 #ifndef TOPINODATA_H
 #define TOPINODATA_H
 
+#include <functional>
+
 #include <QtMath>
 #include <QVector>
 #include <QBuffer>
+#include <QCache>
+#include <QCryptographicHash>
+#include <QDataStream>
 #include <QImage>
+#include <QtEndian>
 #include <QXmlStreamReader>
 #include <QXmlStreamWriter>
 
@@ -27,6 +33,17 @@ class TopinoData {
         int radius = 0;
     };
 
+    /* Geometry of the main inlet (i.e. of the polar coordinate system) */
+    struct PolarGeometry {
+        QPointF origin;
+        int innerRadius = 0;
+        int outerRadius = 0;
+        int neutralAngle = 90;
+        int minAngle = -30;
+        int maxAngle = 30;
+        bool counterClockwise = true;
+    };
+
     struct AngulagramBackground {
         qreal value = 0.0;
         int indexLeft = -1;
@@ -50,10 +67,56 @@ class TopinoData {
         extremaType type = extremaMinimum;
     };
 
+    /* Stages of the processing pipeline: source image → processed image → polar image → angulagram
+     * and radialgram. Each stage stores a key of its parameters and its input (the key chains through
+     * the stages), so that a stage is only recalculated if something it depends on changed. */
+    enum pipelineStages {
+        stageProcessed = 0,
+        stagePolar = 1,
+        stageAngulagram = 2,
+        stageRadialgram = 3,
+        stageCOUNT = 4
+    };
+
     /* Setter and getter for data objects */
     QImage getImage() const;
     void setImage(const QImage& value);
 
+    /* File the source image was loaded from (if known) and the SHA-256 hash (hex) of its content;
+     * documents can reference this file instead of embedding the image. The reference is the path
+     * as read from a document, which is resolved by the document. */
+    QString getSourceFile() const;
+    QByteArray getSourceHash() const;
+    void setSourceFile(const QString& file, const QByteArray& hash);
+    QString getSourceReference() const;
+
+    static QByteArray calculateContentHash(const QByteArray& content);
+    static QByteArray calculateContentHash(const uchar *content, qint64 size);
+
+    /* Decoded images by content hash, shared by all documents of the session, so that an image used
+     * by several documents is decoded only once (thread-safe). The image of a closed document is
+     * removed from the cache. */
+    static QImage findCachedImage(const QByteArray& hash);
+    static void cacheImage(const QByteArray& hash, const QImage& image);
+    static void uncacheImage(const QByteArray& hash);
+
+    /* Region of the image used by the analysis: the sector of the main inlet and all inlet circles (plus
+     * a small margin), clipped to the image; null if there are no inlets */
+    QRect calculateRegionOfInterest() const;
+
+    /* Cropped images: documents can store just the region of interest in full resolution together with
+     * a small, downsampled context image of the whole frame. The cropped data keeps the region as its
+     * image and all coordinates relative to it; the offset of the region in the full frame is stored. */
+    static QImage createContextImage(const QImage& image);
+    TopinoData createCroppedData(const QRect& crop) const;
+
+    bool isCropped() const;
+    QPoint getCropOffset() const;
+    QSize getFullSize() const;
+
+    QImage getContextImage() const;
+    void setContextImage(const QImage& value);
+
     QPointF getCoordOrigin() const;
     void setCoordOrigin(const QPointF& value);
 
@@ -79,11 +142,12 @@ class TopinoData {
     void removeInlet(int ID);
     TopinoData::InletData getInletData(int ID) const;
 
-    /* XML functions for loading and saving */
-    ParsingError loadObject(QXmlStreamReader& xml);
+    /* XML functions for loading and saving; if encodedImage is given, the image data is not decoded
+     * but returned as encoded PNG */
+    ParsingError loadObject(QXmlStreamReader& xml, QByteArray *encodedImage = nullptr);
 
-    ParsingError loadImageObject(QXmlStreamReader& xml);
-    void saveImageObject(QXmlStreamWriter& xml);
+    ParsingError loadImageObject(QXmlStreamReader& xml, QByteArray *encodedImage = nullptr);
+    void saveImageObject(QXmlStreamWriter& xml, bool includeImageData = true, const QString& reference = QString());
 
     ParsingError loadCoordinateObject(QXmlStreamReader& xml);
     void saveCoordinateObject(QXmlStreamWriter& xml);
@@ -97,6 +161,21 @@ class TopinoData {
     ParsingError loadStreamParameters(QXmlStreamReader& xml);
     void saveStreamParameters(QXmlStreamWriter& xml);
 
+    /* Baseline of the streams: its samples are stored as little endian doubles */
+    ParsingError loadStreamBaseline(QXmlStreamReader& xml);
+    void saveStreamBaseline(QXmlStreamWriter& xml);
+
+    /* Results stored in documents: the processed image as gray plane and the angulagram samples as little
+     * endian doubles, each with the parameter hash it was calculated with. Stored results are used instead
+     * of calculating the stage again as long as the parameter hash fits. */
+    ParsingError loadDerivedObject(QXmlStreamReader& xml);
+    void saveDerivedObject(QXmlStreamWriter& xml, bool includeImageData = true);
+
+    /* Gray plane of the processed image (null if not processed) and the stored gray plane of binary files */
+    QImage getProcessedGrayPlane() const;
+    void setStoredProcessedImage(const QImage& grayPlane);
+    void setStoredProcessedData(const QByteArray& encodedGrayPlane);
+
     bool getInversion() const;
     void setInversion(bool value);
 
@@ -112,22 +191,61 @@ class TopinoData {
     QImage getProcessedImage() const;
     void setProcessedImage(const QImage& value);
 
+    /* Callback for long calculations: receives the progress (in percent) and returns false if the
+     * calculation should be canceled. */
+    typedef std::function<bool(int)> ProgressCallback;
+
+    /* Is the stage (and all stages before) up to date? */
+    bool isStageUpToDate(pipelineStages stage) const;
+
+    /* Key of the current parameters (and input) of a stage */
+    uint calculateStageKey(pipelineStages stage) const;
+
+    /* Hash of the parameters of a stage and all stages before; unlike the key it does not depend on the
+     * images in memory, so it is stored with results in files */
+    uint calculateParameterHash(pipelineStages stage) const;
+
+    /* Recalculates all stale stages up to (and including) the given stage; returns false if the
+     * calculation was canceled by the progress callback. */
+    bool updateStage(pipelineStages stage, const ProgressCallback& progress = nullptr);
+
+    /* Takes over the results of all stages of another data object (e.g. calculated on a copy in the
+     * background) that are valid for the parameters of this object. Returns false if any stage of
+     * the other object does not fit (i.e. the parameters changed in the meantime). */
+    bool takeStageResults(const TopinoData& other);
+
     /* Process the source image and apply inversion, desaturation, and color levels. */
     void processImage();
 
     /* Resets the processing of the image and sets all values to default */
     void resetProcessing();
 
-    /* Calculates the polar image from the inlet points */
-    void calculatePolarImage();
+    /* Copies images using memory they do not own (e.g. a mapped file) into memory of their own, so that
+     * the memory can be released; the results of all stages stay valid */
+    void detachImages();
+
+    /* Was the processing applied to the image (or is the processed image the source image)? */
+    bool isImageProcessed() const;
+
+    /* Calculates the polar image from the inlet points; returns false if the calculation was canceled
+     * by the progress callback. */
+    bool calculatePolarImage(const ProgressCallback& progress = nullptr);
 
     /* Calculates the points of the angulagram from the polar image */
     void calculateAngulagramPoints();
-    QVector<QPointF> getAngulagramPoints() const;
+    TopinoTools::SampledSignal getAngulagram() const;
+
+    /* Geometry of the main inlet as stored in this object */
+    PolarGeometry getPolarGeometry() const;
+
+    /* Calculates a low-resolution angulagram directly from the (processed) image without creating a
+     * polar image; used for live previews. The resolution is given in degrees and pixels. */
+    static TopinoTools::SampledSignal calculateAngulagramPreview(const QImage& image, const PolarGeometry& geometry,
+                                                                 qreal angleStep = 1.0, int radiusStep = 2);
 
     /* Calculates the points of the radialgram from the polar image */
     void calculateRadialgramPoints();
-    QVector<QPointF> getRadialgramPoints() const;
+    TopinoTools::SampledSignal getRadialgram() const;
 
     int getCoordOuterRadius() const;
     void setCoordOuterRadius(int value);
@@ -138,6 +256,9 @@ class TopinoData {
     QVector<TopinoTools::Lorentzian> getStreamParameters() const;
     void setStreamParameters(const QVector<TopinoTools::Lorentzian>& value);
 
+    TopinoTools::Baseline getStreamBaseline() const;
+    void setStreamBaseline(const TopinoTools::Baseline& value);
+
     QImage getPolarImage() const;
 
     int getCoordDiffAngle() const;
@@ -152,6 +273,18 @@ class TopinoData {
     QImage processedImage;
     QImage polarImage;
 
+    QString sourceFile;
+    QByteArray sourceHash;
+    QString sourceReference;
+
+    /* Position of a cropped image in the full frame (empty full size if not cropped) and the context */
+    QPoint cropOffset;
+    QSize fullSize;
+    QImage contextImage;
+
+    /* Drops the crop information if the image does not fit into the full frame at its offset */
+    void validateCrop();
+
     bool inversion;
     TopinoTools::desaturationModes desatMode;
     int levelMin;
@@ -172,12 +305,29 @@ class TopinoData {
     QList<InletData> inlets;
     int nextInletID;
 
+    /* Keys of the pipeline stages as they were calculated (0 = not calculated) */
+    uint stageKeys[stageCOUNT] = { 0, 0, 0, 0 };
+
     /* Calculated points for the angulagram and radialgram */
-    QVector<QPointF> angulagramPoints;
-    QVector<QPointF> radialgramPoints;
+    TopinoTools::SampledSignal angulagram;
+    TopinoTools::SampledSignal radialgram;
+
+    /* Results loaded from a document (see loadDerivedObject); the processed image is either given as
+     * image (binary files) or as encoded PNG that is only decoded if used. The stored angulagram is the
+     * angulagram itself, which has no polar image; it is valid as long as its hash fits. */
+    QImage storedProcessedImage;
+    QByteArray storedProcessedData;
+    uint storedProcessedHash = 0;
+    uint storedAngulagramHash = 0;
+
+    /* Uses the stored processed image if it fits the parameters and the source image */
+    bool restoreProcessedImage();
 
     /* Lorentzian fits as stream parameters if available */
     QVector<TopinoTools::Lorentzian> streamParameters;
+
+    /* Baseline of the angulagram the streams were fitted on (if baseline correction was used) */
+    TopinoTools::Baseline streamBaseline;
 };
 
 #endif // TOPINODATA_H
@@ -6,7 +6,11 @@
 
 #include <QDateTime>
 #include <QImage>
+#include <QIODevice>
+#include <QFile>
+#include <QList>
 #include <QString>
+#include <QWeakPointer>
 #include <QXmlStreamReader>
 #include <QXmlStreamWriter>
 #include <vector>
@@ -18,24 +22,99 @@ class TopinoDocument {
 
     void addObserver(IObserver *observer);
     void removeObserver(IObserver *observer);
-    void notifyAllObserver() const;
+    void notifyAllObserver(int changes = IObserver::changeAll) const;
 
     bool hasChanged() const;
-    void modify();
+    void modify(int changes = IObserver::changeAll);
     void saveChanges();
 
+    /* The revision is increased with every modification; it tells if the document was changed since
+     * a snapshot was taken */
+    quint64 getRevision() const;
+
+    /* Copy of the document for saving in the background; it has no observers (they must not be notified
+     * from other threads) and no undo history */
+    TopinoDocument createSnapshot() const;
+
     enum class FileError {
         NoFailure = 0,
         UnknownError = 1,
         FileNotFound = 2,
         FileNameOrPathNotSet = 3,
         CouldNotOpen = 4,
-        ParsingError = 5
+        ParsingError = 5,
+        ImageNotFound = 6,
+        FileInUse = 7
     };
 
-    FileError loadFromXML(const QString &xmlfilename );
+    /* For all loading functions: if encodedImage is given, an encoded (PNG) image is not decoded but
+     * returned and the image is not processed, so that both can be done in the background */
+    FileError loadFromXML(const QString &xmlfilename, QByteArray *encodedImage = nullptr);
     FileError saveToXML( const QString &xmlfilename = "");
 
+    /* Codecs for the image in binary Topino files */
+    enum imageCodecs {
+        codecRaw = 0,
+        codecCompressed = 1,
+        codecPNG = 2,
+        codecCOUNT = 3
+    };
+
+    static const char* getImageCodecName(imageCodecs codec);
+
+    imageCodecs getImageCodec() const;
+    void setImageCodec(imageCodecs value);
+
+    /* Should calculated results (processed image, angulagram) be saved with the document? */
+    bool getStoreResults() const;
+    void setStoreResults(bool value);
+
+    /* Uncompressed images of binary files use the mapped file, which cannot be replaced while it is
+     * mapped on some systems (e.g. Windows). Before saving to this file, the images are copied into
+     * memory of their own; if the file is still mapped afterwards, saving fails with FileInUse. */
+    void releaseMappedFile(const QString& filename);
+
+    /* Instead of embedding the image, documents can reference the image file by a relative path and the
+     * SHA-256 hash of its content. With an image store (a directory), the referenced images are kept in
+     * the store under their hash, so that documents sharing an image share one file; images without
+     * a file are saved to the store as PNG. Referenced images are looked up in the store, too. */
+    bool getReferenceImage() const;
+    void setReferenceImage(bool value);
+
+    QString getImageStore() const;
+    void setImageStore(const QString& value);
+
+    /* Saving runs on a snapshot, which stores the image and calculates its hash; the file and hash are
+     * taken over from the saved snapshot (if the image is still the same), so that the next save
+     * references the stored file instead of encoding the image again. If the saved file does not hold the
+     * image of the document (see setCropImage), a journal embeds the image. */
+    void takeImageReference(const TopinoDocument& saved);
+
+    /* Embedded images can be cropped to the region used by the analysis (see TopinoData::calculateRegionOfInterest);
+     * the file then holds the region with coordinates relative to it, its offset in the full frame, and a small
+     * context image of the whole frame (see TopinoData::createCroppedData) */
+    bool getCropImage() const;
+    void setCropImage(bool value);
+
+    /* Binary Topino files (*.topino) consist of chunks: the metadata as XML (same as TopinoXML, but
+     * without the image) and the image as raw, compressed, or PNG encoded pixel data. Raw images are
+     * used directly from the memory mapped file without copying. */
+    FileError loadFromBinary(const QString &binfilename, QByteArray *encodedImage = nullptr);
+    FileError saveToBinary(const QString &binfilename = "");
+
+    /* Loads or saves the document as binary or TopinoXML file depending on the file name */
+    static bool isBinaryFileName(const QString &filename);
+    FileError load(const QString &filename, QByteArray *encodedImage = nullptr);
+    FileError save(const QString &filename = "");
+
+    /* Autosave journal: an append-only file that starts with the image (written only once; if the image
+     * of the saved document did not change, just the document file is referred to) followed by small
+     * records of the metadata (parameters, geometry, inlets, streams). The last complete record is the
+     * latest state; an incomplete record at the end (e.g. after a crash while writing) is ignored. */
+    FileError startJournal(const QString &journalfilename);
+    FileError appendJournal(const QString &journalfilename);
+    FileError loadFromJournal(const QString &journalfilename);
+
     QString getFilename() const;
     void setFilename(const QString& value);
 
@@ -49,6 +128,45 @@ class TopinoDocument {
     void getData(TopinoData &value) const;
     void setData(const TopinoData& value);
 
+    /* Edits the data in place: the edit function receives a reference to the data object, so that
+     * nothing has to be copied. Since the changes cannot be detected without a copy, the caller
+     * names them (see IObserver::changeFlags); only these are sent to the observers. */
+    template<typename F> void edit(F editFunction, int changes) {
+        UndoStep before = captureUndoStep(changes);
+        editFunction(data);
+        recordUndoStep(before, changes);
+
+        modify(changes);
+    }
+
+    /* Publishes results calculated in the background (see TopinoData::takeStageResults). Derived results
+     * are no edits: the saved state, the revision, and the undo history stay the same. Returns false if
+     * the results do not fit the parameters anymore. */
+    bool takeStageResults(const TopinoData& results, int changes);
+
+    /* Publishes the confidence intervals of the streams calculated in the background (see
+     * TopinoTools::calculateBootstrap). They complete the edit of the fits, so there is no undo step
+     * of their own, but they are saved. Returns false if the streams changed in the meantime. */
+    bool takeConfidenceIntervals(const QVector<TopinoTools::Lorentzian>& fits);
+
+    /* Publishes the image of an opened document that was decoded in the background, with its processed
+     * image if it still fits the parameters. The image belongs to the document already, so this is no
+     * edit either: edits made before the image arrived keep their undo steps. */
+    void takeLoadedImage(const TopinoData& loaded);
+
+    /* Undo and redo of edits. Each step only stores the parameters of the parts of the data that
+     * changed (processing, geometry, inlets, streams) and never any images; the derived images
+     * are recalculated through the pipeline. The steps return the changes they applied. */
+    bool canUndo() const;
+    bool canRedo() const;
+    int undo();
+    int redo();
+    void clearUndoHistory();
+
+    /* Maximum memory used by the undo and redo steps in bytes; the oldest steps are dropped first */
+    int getUndoMemoryLimit() const;
+    void setUndoMemoryLimit(int value);
+
     /* Creates the textual representation of the data header (over view of
      * raw data and fitting parameters) */
     void createDataHeader(QStringList &textData) const;
@@ -56,17 +174,83 @@ class TopinoDocument {
     /* Creates the textual representation of the raw data + fitted plots */
     void createDataTable(QStringList &textData) const;
 
-    /* Export data to a text file */
+    /* Export data to a text file; the table is written row by row */
     void exportDataToText(const QString &filename) const;
 
+    /* Data sets for the binary export */
+    enum exportDataSets {
+        exportAngulagram = 0,
+        exportFittedCurves = 1,
+        exportRadialgram = 2,
+        exportPolarImage = 3,
+        exportCOUNT = 4
+    };
+
+    static const char* getExportDataSetName(exportDataSets set);
+
+    /* Exports a data set as little endian float32 array, either as NumPy file (*.npy, includes the shape)
+     * or as raw data. Signals are arrays of (x, y) rows; the fitted curves have the same columns as the
+     * data table; the polar image is a (height, width) array of gray values. */
+    bool exportDataToBinary(const QString &filename, exportDataSets set, bool numpy) const;
+
   private:
     std::vector<IObserver*> observers;
 
+    /* Parameters of the data needed to undo an edit; only the parts named in changes are set */
+    struct UndoStep {
+        int changes = IObserver::changeNone;
+
+        bool processed = false;
+        bool inversion = false;
+        TopinoTools::desaturationModes desatMode = TopinoTools::desaturationModes::desatLightness;
+        int levelMin = 0;
+        int levelMax = 255;
+
+        int mainInletID = 0;
+        int neutralAngle = 0;
+        int minAngle = 0;
+        int maxAngle = 0;
+        int diffAngle = 0;
+        int outerRadius = 0;
+        bool counterClockwise = true;
+        int sectors = 0;
+
+        QList<TopinoData::InletData> inlets;
+
+        QVector<TopinoTools::Lorentzian> streamParameters;
+        TopinoTools::Baseline streamBaseline;
+    };
+
+    QList<UndoStep> undoSteps;
+    QList<UndoStep> redoSteps;
+    int undoMemory = 0;
+    int undoMemoryLimit = 4 * 1024 * 1024;
+
+    UndoStep captureUndoStep(int changes) const;
+    void restoreUndoStep(const UndoStep& step);
+    void recordUndoStep(const UndoStep& before, int changes);
+    void limitUndoMemory();
+
+    static bool isSameUndoStep(const UndoStep& a, const UndoStep& b);
+    static int estimateUndoStepSize(const UndoStep& step);
+
+    /* Helper for comparing parts of the data */
+    static bool isSameInlets(const QList<TopinoData::InletData>& a, const QList<TopinoData::InletData>& b);
+    static bool isSameStreams(const QVector<TopinoTools::Lorentzian>& a, const TopinoTools::Baseline& baselineA,
+                              const QVector<TopinoTools::Lorentzian>& b, const TopinoTools::Baseline& baselineB);
+
     /* This is the version string saved in the document file; currently not checked */
     QString version = "1.0";
 
     /* True if file has been changed since the last save/open/create */
     bool changed = false;
+    quint64 revision = 0;
+
+    /* True if the image is the one of the document file (since the last save/open) */
+    bool imageSaved = false;
+
+    /* Binary file whose mapped memory is used by images of the document (null if none uses it anymore) */
+    QWeakPointer<QFile> mappedFile;
 
     /* File name and path of the current document */
     QString filename;
@@ -75,11 +259,52 @@ class TopinoDocument {
     /* Data object that includes the data methods */
     TopinoData data;
 
+    /* Codec for the image when saving binary files */
+    imageCodecs imageCodec = codecCompressed;
+    bool storeResults = true;
+
+    /* Referencing of the image instead of embedding it */
+    bool referenceImage = false;
+    QString imageStore;
+
+    /* Cropping of the embedded image */
+    bool cropImage = false;
+
+    /* Returns the region of the image to save (null if the whole image is saved) */
+    QRect prepareCropRegion() const;
+
+    /* Returns the reference to the image file for saving (empty if the image is embedded); copies the
+     * image to the image store if needed */
+    QString prepareImageReference();
+
+    /* Finds the referenced image file (relative to the document or in the store) and checks its hash;
+     * the image is decoded unless the encoded data is returned (see loadFromXML) */
+    FileError resolveImageReference(QByteArray *encodedImage);
+
+    /* Hash of the content of a file (empty if the file cannot be read), e.g. of the document a journal
+     * belongs to */
+    static QByteArray calculateFileHash(const QString& filename);
+
+    /* Compares two data objects and returns which parts changed (see IObserver::changeFlags) */
+    static int compareData(const TopinoData& oldData, const TopinoData& newData);
+
+    /* Writes the data table (see createDataTable) to a device in blocks */
+    void writeDataTable(QIODevice &device) const;
+
+    /* Calculates the columns of the fitted curves (baseline first, if there is one) for the angulagram */
+    QVector<QVector<double>> calculateFittedCurves(const TopinoTools::SampledSignal &angulagram) const;
+
+    /* Formats a confidence interval for the data header (or a dash if there is none) */
+    QString formatConfidenceInterval(const TopinoTools::ConfidenceInterval& interval, const char* format) const;
+
+    /* Creates a journal record: the <topino> object without image and calculated results */
+    QByteArray createJournalRecord();
+
     /* Reads the <topino> object from an XML file */
-    FileError readTopinoXML(QXmlStreamReader &xml);
+    FileError readTopinoXML(QXmlStreamReader &xml, QByteArray *encodedImage = nullptr);
 
     /* Saves all information as <topino> object to a XML */
-    FileError saveTopinoXML(QXmlStreamWriter &xml);
+    FileError saveTopinoXML(QXmlStreamWriter &xml, bool includeImageData = true, const QString &imageReference = QString());
 };
 
 #endif // TOPINODOCUMENT_H
@@ -3,6 +3,7 @@
 
 #include <algorithm>
 #include <QColor>
+#include <QHash>
 #include <QImage>
 #include <QRgb>
 #include <QString>
@@ -12,6 +13,8 @@
 #include <Eigen/Eigen>
 #include <unsupported/Eigen/NonLinearOptimization>
 
+#include "include/peakmodels.h"
+
 namespace TopinoTools {
 
 /* Tableau10 colors by Chris Gerrard; more information at:
@@ -102,6 +105,11 @@ inline Q_DECL_CONSTEXPR int qMaximum(QRgb rgb) {
  * given value. */
 QString getUnitPrefix(qreal &value);
 
+/* Appends a number with a fixed number of decimals (at most 9) to a buffer; much faster than
+ * QString::number or sprintf when exporting large tables. Values that do not fit (or are not
+ * finite) fall back to the standard formatting. */
+void appendFixedNumber(QByteArray &buffer, double value, int decimals);
+
 /* Function to calculate the moment (M_pq) of a gray image (8bit). See the following
  * Wikipedia article for more details: https://en.wikipedia.org/wiki/Image_moment. */
 qreal imageMoment(const QImage &grayImage, int p, int q);
@@ -160,9 +168,28 @@ bool isPointInCircle(const QPointF &point, const QPointF &center, const qreal ra
 /* Calculates the cross product (p1.x * p2.y - p2.x * p2.y) of two points */
 qreal crossProduct(const QPointF &p, const QPointF &q);
 
-/* Smoothes a data set of points by Gaussian Kernel smoothing. See the following Wiki page
- * for more details: https://en.wikipedia.org/wiki/Kernel_smoother */
-void smoothByGaussianKernel(QVector<QPointF>& points, int size = 5, qreal sigma = 1.0);
+/* Data set sampled on an implicit, linear grid (e.g. angulagrams and radialgrams): the x-value of
+ * index i is start + i * step, so only the intensities are stored in one contiguous array. */
+struct SampledSignal {
+    qreal start = 0.0;
+    qreal step = 1.0;
+    QVector<double> values;
+
+    int length() const { return values.length(); }
+    bool isEmpty() const { return values.isEmpty(); }
+
+    qreal x(int index) const { return start + index * step; }
+    qreal y(int index) const { return values[index]; }
+    QPointF point(int index) const { return QPointF(x(index), values[index]); }
+
+    /* Converts the signal to a list of points (for charts and the point-based functions below) */
+    QVector<QPointF> toPoints() const;
+};
+
+/* Smoothes a signal by Gaussian Kernel smoothing. See the following Wiki page for more details:
+ * https://en.wikipedia.org/wiki/Kernel_smoother. The signal gets shorter by size/2 points on
+ * each side; its start is moved accordingly. */
+void smoothByGaussianKernel(SampledSignal& signal, int size = 5, qreal sigma = 1.0);
 
 /* Helper function: Gaussian kernel function */
 qreal gaussianKernel(qreal value, qreal sigma);
@@ -185,9 +212,9 @@ struct Extrema {
     extremaType type = extremaMinimum;
 };
 
-/* Finds extrema in a set of points using the y-values. Data should be smoothed
+/* Finds extrema in a signal using the y-values. Data should be smoothed
  * before using this. */
-void getExtrema(const QVector<QPointF> &points, QVector<Extrema>& extrema);
+void getExtrema(const SampledSignal &signal, QVector<Extrema>& extrema);
 
 /* Filters extrema and removes the ones which are below the given threshold. */
 void filterExtrema(QVector<Extrema>& extrema, qreal threshold);
@@ -198,6 +225,101 @@ int countExtrema(const QVector<Extrema>& extrema, extremaType type);
 /* Splits the extrema and just returns either maxima or minima */
 QVector<Extrema> splitExtrema(const QVector<Extrema>& extrema, extremaType type);
 
+/* Baseline of a data set as estimated by asymmetric least squares (see calculateBaselineALS). The
+ * baseline is sampled on the grid of the data; f interpolates linearly between the samples and
+ * keeps the value of the first/last sample outside. */
+struct Baseline {
+    qreal lambda = 1e5;
+    qreal asymmetry = 0.01;
+    SampledSignal signal;
+
+    bool isNull() const {
+        return signal.isEmpty();
+    }
+
+    qreal f(qreal x) const;
+};
+
+/* Estimates the baseline of a data set by asymmetric least squares (Eilers and Boelens, 2005): the
+ * baseline z minimizes sum w_i (y_i - z_i)^2 + lambda * sum (second difference of z)^2, where the
+ * weights are asymmetry for points above and 1 - asymmetry for points below the baseline. Each
+ * iteration solves a sparse pentadiagonal system in O(n). The points have to be equally spaced. */
+Baseline calculateBaselineALS(const QVector<QPointF> &points, qreal lambda = 1e5, qreal asymmetry = 0.01, int iterations = 10);
+
+/* Subtracts the baseline from the data points (both need to have the same points) */
+QVector<QPointF> subtractBaseline(const QVector<QPointF> &points, const Baseline &baseline);
+
+/* Criteria for filtering peaks: by the height of the maximum (above the threshold) or by its
+ * (topographic) prominence, i.e. the height of the maximum above the highest saddle connecting it
+ * to a higher peak. The latter also works for peaks on a sloped baseline. The wavelet criterion
+ * does not use the hierarchy, but the signal-to-noise ratio of the wavelet peaks (see below). */
+enum peakFilterCriteria {
+    filterHeight = 0,
+    filterProminence = 1,
+    filterWavelet = 2,
+    filterCOUNT = 3
+};
+
+/* Names for the peak filter criteria */
+QString getPeakFilterCriterionName(peakFilterCriteria criterion);
+
+/* Peak in the persistence hierarchy: index of the maximum, index of the saddle (minimum) where
+ * the peak merges with a higher peak (-1 for the highest peak), its height and prominence. */
+struct PersistencePeak {
+    int index = -1;
+    int saddleIndex = -1;
+    qreal height = 0.0;
+    qreal prominence = 0.0;
+};
+
+/* Persistence hierarchy of all peaks in a set of points. The peaks are sorted by prominence
+ * (highest first). The sparse table allows to find the minimum between two maxima in O(1). */
+struct PeakHierarchy {
+    QVector<QPointF> points;
+    QVector<PersistencePeak> peaks;
+    QVector<QVector<int>> minimumTable;
+
+    /* Index of the minimum in the range [left, right] */
+    int indexOfMinimum(int left, int right) const;
+};
+
+/* Calculates the persistence hierarchy of the peaks in O(n log n) by sweeping the points from the
+ * highest to the lowest value and merging neighbouring peaks by a union-find structure. Data should
+ * be smoothed before using this. */
+PeakHierarchy calculatePeakHierarchy(const QVector<QPointF> &points);
+
+/* Returns the maxima whose height (or prominence) is above the cutoff and the (deepest) minima between
+ * them from the hierarchy. The result is sorted by index and can be used like the result of getExtrema
+ * and filterExtrema; as there, minima not above the cutoff are dropped when filtering by height, so that
+ * there might be fewer minima than maxima minus one. */
+QVector<Extrema> getExtremaFromHierarchy(const PeakHierarchy &hierarchy, qreal cutoff, peakFilterCriteria criterion = filterHeight);
+
+/* Peak found by the continuous wavelet transform: index of the peak (position of the ridge line at
+ * the scale with the largest coefficient), this scale (in points), the coefficient, the signal-to-noise
+ * ratio, and the number of scales the ridge line spans. */
+struct WaveletPeak {
+    int index = -1;
+    qreal scale = 0.0;
+    qreal coefficient = 0.0;
+    qreal snr = 0.0;
+    int ridgeLength = 0;
+};
+
+/* Finds peaks by a continuous wavelet transform with the Ricker ("Mexican hat") wavelet, following
+ * Du et al., Bioinformatics 22 (2006) 2059-2065. The transform is calculated for scaleCount scales
+ * (logarithmically spaced between minScale and maxScale points; maxScale = 0 selects length/8) by FFT,
+ * i.e. in O(n log n) per scale. Maxima of the coefficients are linked to ridge lines from the largest to
+ * the smallest scale; ridge lines spanning at least a quarter of the scales are returned as peaks
+ * (sorted by index). The noise is estimated from the coefficients at the smallest scale, so the signal
+ * should not be smoothed before. */
+QVector<WaveletPeak> calculateWaveletPeaks(const SampledSignal &signal, int scaleCount = 32, qreal minScale = 1.0,
+        qreal maxScale = 0.0);
+
+/* Returns the wavelet peaks with a signal-to-noise ratio of at least minSNR as maxima and the (deepest)
+ * minima between them in the points. Same as for getExtremaFromHierarchy, the result is sorted by index
+ * and there is always exactly one minimum less than maxima. */
+QVector<Extrema> getExtremaFromWaveletPeaks(const QVector<QPointF> &points, const QVector<WaveletPeak> &peaks, qreal minSNR);
+
 /* Helper structure for finding and working with sections */
 struct Section {
     int indexLeft = -1;
@@ -215,101 +337,98 @@ struct Section {
  * on the right side. */
 QVector<Section> getSections(const QVector<QPointF> &points, const QVector<Extrema>& extrema, qreal threshold);
 
-/* Helper structure for a Lorentzian: y = height * (width/2)^2 / ((width/2)^2 + (pos - x)^2) + offset*/
+/* Names for the peak models */
+QString getPeakModelName(peakModels model);
+
+/* Confidence interval given by its lower and upper bound */
+struct ConfidenceInterval {
+    qreal lower = 0.0;
+    qreal upper = 0.0;
+
+    bool isNull() const {
+        return (lower == 0.0) && (upper == 0.0);
+    }
+};
+
+/* Helper structure for a fitted stream/peak. Originally, this was only a Lorentzian: y = height *
+ * (width/2)^2 / ((width/2)^2 + (pos - x)^2) + offset. It now holds the parameters of any of the
+ * peak models (see peakmodels.h); shape is the additional parameter of the model (if any). */
 struct Lorentzian {
     qreal pos = 0.0;
     qreal height = 0.0;
     qreal width = 0.0;
     qreal offset = 0.0;
     qreal rsquare = 0.0;
+    peakModels model = modelLorentzian;
+    qreal shape = 0.0;
 
-    qreal f(qreal x) const {
-        qreal denominator = qPow(width/2.0, 2.0) + qPow(pos - x, 2.0);
+    /* Confidence intervals of position and width as well as of the resolution to each of the
+     * following streams (the first one is the resolution to the next stream). */
+    ConfidenceInterval posCI;
+    ConfidenceInterval widthCI;
+    QVector<ConfidenceInterval> resolutionCIs;
 
-        if (denominator == 0.0) {
-            return 0.0;
+    qreal f(qreal x) const {
+        const qreal p[5] = { pos, height, width, offset, shape };
+
+        switch (model) {
+        case modelGaussian:
+            return GaussianModel::value(x, p);
+        case modelPseudoVoigt:
+            return PseudoVoigtModel::value(x, p);
+        case modelEMG:
+            return EMGModel::value(x, p);
+        default:
+            return LorentzianModel::value(x, p);
         }
-
-        return height * qPow(width/2.0, 2.0) / denominator + offset;
     }
 };
 
-/* Functor for Eigen-Solver. Based on a tutorial of Sarvagya, which can be found at
- * https://medium.com/@sarvagya.vaish/levenberg-marquardt-optimization-part-2-5a71f7db27a0 */
-struct LorentzianFunctor {
-    /* Data values to fit to */
-    QVector<QPointF> dataValues;
-
-    /* This is what calculates a value at x and respective errors */
-    int operator()(const Eigen::VectorXd &p, Eigen::VectorXd &fvec) const {
-        /* p is a vector with n parameter values and fvec is a vector with m error values
-         * for m data points. */
-        Lorentzian parameters;
-        parameters.pos      = p(0);
-        parameters.height   = p(1);
-        parameters.width    = p(2);
-        parameters.offset   = p(3);
-
-        /* For all values calculate the error between the data value and the predicted value. */
-        for(int i = 0; i < values(); ++i) {
-            fvec(i) = dataValues[i].y() - parameters.f(dataValues[i].x());
-        }
+/* Functor for Eigen-Solver for Lorentzians; kept for compatibility (see PeakFunctor). */
+typedef PeakFunctor<LorentzianModel> LorentzianFunctor;
 
-        return 0;
-    }
+/* Key of the fit cache: the data points of a section (including its borders), the position of its
+ * maximum, the threshold, the peak model, and the initial guess used (if any). Keys are compared bit
+ * by bit, so that a hash collision never returns the fit of another section. */
+struct SectionKey {
+    QVector<QPointF> points;
+    int maxOffset = 0;
+    qreal threshold = 0.0;
+    peakModels model = modelLorentzian;
 
-    // Compute the jacobian of the errors
-    int df(const Eigen::VectorXd &p, Eigen::MatrixXd &fjac) const {
-        /* p is a vector with n parameter values containing the current estimates while
-         * fjac has dimensions m x n containing the jacobian matrix of errors. */
-
-        /* Vary each parameter a little bit by a very small epsilon in plus and minus
-         * direction and see what the difference is -> that is numerically good
-         * approximation of the differential (no derivates needed). */
-        double epsilon = 1e-5;
-
-        for (int i = 0; i < p.size(); ++i) {
-            /* Only vary the current parameter and just copy the rest from p */
-            Eigen::VectorXd paraPlus(p);
-            Eigen::VectorXd paraMinus(p);
-            paraPlus(i) += epsilon;
-            paraMinus(i) -= epsilon;
-
-            /* Calculate the errors */
-            Eigen::VectorXd fvecPlus(values());
-            operator()(paraPlus, fvecPlus);
-            Eigen::VectorXd fvecMinus(values());
-            operator()(paraMinus, fvecMinus);
-
-            /* Calculate the difference (and divide it by the full range, i.e. 2 * epsilon)
-             * to get the slope = differential. */
-            Eigen::VectorXd fvecDiff(values());
-            fvecDiff = (fvecPlus - fvecMinus) / (2.0 * epsilon);
-
-            /* Put it differential vector into the fjac matrix at the respective
-             * position. */
-            fjac.block(0, i, values(), 1) = fvecDiff;
-        }
+    /* Parameters of the guess (pos, height, width, offset, shape); all zero without a guess */
+    bool hasGuess = false;
+    qreal guess[5] = { 0.0, 0.0, 0.0, 0.0, 0.0 };
 
-        return 0;
-    }
+    bool operator==(const SectionKey &other) const;
+};
 
-    /* Number of data points/values */
-    int values() const {
-        return dataValues.size();
-    }
+uint qHash(const SectionKey &key, uint seed = 0);
 
-    /* Number of parameters (also called "inputs"); here there are exactly four parameters. */
-    int inputs() const {
-        return 4;
-    }
-};
+/* Cache for fitted Lorentzians by the data of their sections (see createSectionKey), so that unchanged
+ * sections do not have to be fitted again. */
+typedef QHash<SectionKey, Lorentzian> LorentzianCache;
+
+/* Fits Lorentzians into the data set and the sections provided. If initial guesses are given (e.g.
+ * stored or previous fits) and there is one guess per section, the guesses are used as starting
+ * values for the solver if they are compatible with the section. If a cache is given, sections
+ * with unchanged data are taken from the cache instead of being fitted again. */
+QVector<Lorentzian> calculateLorentzians(const QVector<QPointF> &points, const QVector<Section> &sections, qreal threshold,
+        peakModels model = modelLorentzian, const QVector<Lorentzian> &initialGuesses = QVector<Lorentzian>(),
+        LorentzianCache *cache = nullptr);
 
-/* Fits Lorentzians into the data set and the sections provided. */
-QVector<Lorentzian> calculateLorentzians(const QVector<QPointF> &points, const QVector<Section> &sections, qreal threshold);
+/* Calculates one Lorentzian (or other peak model) for one section provided; the solver starts from
+ * the initial guess if given, otherwise from a guess based on the maximum and width of the section. */
+Lorentzian calculateSingleLorentzian(const QVector<QPointF> &points, const Section &section, qreal threshold,
+                                     peakModels model = modelLorentzian, const Lorentzian *initialGuess = nullptr);
 
-/* Calculates one Lorentzian for one section provided */
-Lorentzian calculateSingleLorentzian(const QVector<QPointF> &points, const Section &section, qreal threshold);
+/* Checks if a (stored or previous) fit is a reasonable starting point for the given section, i.e.
+ * the peak position lies within the section and height and width are positive. */
+bool isLorentzianCompatible(const QVector<QPointF> &points, const Section &section, const Lorentzian &guess);
+
+/* Creates the key of a section for the fit cache */
+SectionKey createSectionKey(const QVector<QPointF> &points, const Section &section, qreal threshold, peakModels model = modelLorentzian,
+                            const Lorentzian *guess = nullptr);
 
 /* Calculates the R-square value for a given Lorentzian parameter set and real points */
 qreal calculateLorentzianR2(const QVector<QPointF> &points, const Lorentzian &parameters);
@@ -317,6 +436,55 @@ qreal calculateLorentzianR2(const QVector<QPointF> &points, const Lorentzian &pa
 /* Calculates the resolution for the given streams/peaks */
 qreal calculateResolution(qreal pos1, qreal width1, qreal pos2, qreal width2);
 
+/* Estimates the confidence intervals of position and width of each fit by bootstrapping: the residuals
+ * of each fit are resampled (with replacement) and added to the fit, which is then fitted again. The
+ * sections are processed in parallel (in chunks of iterations). The resolutions between the fits are
+ * calculated from the samples of the same iteration. */
+void calculateBootstrap(const QVector<QPointF> &points, const QVector<Section> &sections, QVector<Lorentzian> &fits,
+                        int iterations = 200, qreal level = 0.95);
+
+/* Returns the confidence interval of the resolution between two streams (see calculateBootstrap);
+ * returns a null interval if it was not calculated. */
+ConfidenceInterval getResolutionCI(const QVector<Lorentzian> &streams, int stream1, int stream2);
+
+/* Calculates the confidence interval of a set of values by their percentiles */
+ConfidenceInterval calculatePercentileInterval(QVector<qreal> values, qreal level = 0.95);
+
+/* Parameter set for evaluating an angulagram: size and sigma of the Gaussian kernel used for
+ * smoothing and the threshold given in percent of the maximum of the smoothed data. */
+struct EvaluationParameters {
+    int smoothSize = 5;
+    qreal smoothSigma = 1.0;
+    qreal threshold = 2.0;
+};
+
+/* Result of evaluating a single parameter set by the auto-tune engine. A candidate is valid
+ * if there is exactly one maximum more than minima (and not more than seven peaks). The score
+ * combines the mean R² of the fits and the stability of the peak count, i.e. the fraction of
+ * the neighbouring parameter sets (in the search grid) that result in the same peak count. */
+struct AutoTuneCandidate {
+    EvaluationParameters parameters;
+    bool valid = false;
+    int peaks = 0;
+    qreal meanRSquare = 0.0;
+    qreal stability = 0.0;
+    qreal score = 0.0;
+};
+
+/* Evaluates a grid of smoothing and threshold parameters in parallel and returns the best
+ * (valid) candidates sorted by their score. The smoothing size is limited by maxSmoothSize. If a
+ * baseline lambda is given, the baseline (see calculateBaselineALS) is removed from the smoothed
+ * data before the peaks are searched, like in the manual evaluation. */
+QVector<AutoTuneCandidate> autoTuneParameters(const SampledSignal &signal, int maxSmoothSize,
+        peakFilterCriteria criterion = filterHeight, peakModels model = modelLorentzian, int count = 5,
+        qreal baselineLambda = 0.0, qreal baselineAsymmetry = 0.01);
+
+/* Helper function for the auto-tune engine: evaluates all thresholds for one smoothing size and
+ * sigma. The candidates are returned in the same order as the thresholds given. */
+QVector<AutoTuneCandidate> evaluateSmoothingParameters(const SampledSignal &signal, int smoothSize, qreal smoothSigma,
+        const QVector<qreal> &thresholds, peakFilterCriteria criterion = filterHeight, peakModels model = modelLorentzian,
+        qreal baselineLambda = 0.0, qreal baselineAsymmetry = 0.01);
+
 }
 
 #endif // TOPINOTOOL_H
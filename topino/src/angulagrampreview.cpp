@@ -0,0 +1,120 @@
+#include "include/angulagrampreview.h"
+
+#include <QtConcurrent/QtConcurrentRun>
+
+AngulagramPreview::AngulagramPreview(QWidget* parent) : QtCharts::QChartView(parent) {
+    /* Same look as the angulagram view, but without legend and smaller fonts */
+    chart = new QtCharts::QChart();
+    chart->setTheme(QtCharts::QChart::ChartThemeDark);
+    chart->legend()->hide();
+    chart->setMargins(QMargins(0, 0, 0, 0));
+
+    series = new QtCharts::QLineSeries(chart);
+    series->setPen(QPen(QColor(255, 255, 255), 1));
+    chart->addSeries(series);
+
+    /* The axes are created once; new previews just replace the points of the series */
+    xaxis = new QtCharts::QValueAxis(chart);
+    xaxis->setLabelFormat("%+.0f");
+    yaxis = new QtCharts::QValueAxis(chart);
+    yaxis->setLabelFormat("%.1f");
+    yaxis->setRange(0.0, 1.2);
+    yaxis->setTickCount(4);
+
+    QFont font;
+    font.setPixelSize(10);
+    xaxis->setLabelsFont(font);
+    yaxis->setLabelsFont(font);
+
+    chart->addAxis(xaxis, Qt::AlignBottom);
+    chart->addAxis(yaxis, Qt::AlignLeft);
+    series->attachAxis(xaxis);
+    series->attachAxis(yaxis);
+
+    setChart(chart);
+    setRenderHint(QPainter::Antialiasing);
+    setMinimumHeight(150);
+
+    /* Refresh with (about) display rate */
+    throttleTimer.setSingleShot(true);
+    throttleTimer.setInterval(16);
+
+    connect(&throttleTimer, &QTimer::timeout, this, &AngulagramPreview::onThrottleTimeout);
+    connect(&previewWatcher, &QFutureWatcher<TopinoTools::SampledSignal>::finished,
+            this, &AngulagramPreview::onPreviewCalculated);
+}
+
+AngulagramPreview::~AngulagramPreview() {
+    /* The calculation only works on copies, but the watcher should not outlive it */
+    previewWatcher.waitForFinished();
+}
+
+void AngulagramPreview::requestPreview(const QImage& image, const TopinoData::PolarGeometry& geometry) {
+    /* Just remember the latest request; the image is implicitly shared, so this is cheap */
+    requestedImage = image;
+    requestedGeometry = geometry;
+    requestPending = true;
+
+    /* If a calculation is running, the request is picked up when it is finished */
+    if (!throttleTimer.isActive() && !previewWatcher.isRunning()) {
+        throttleTimer.start();
+    }
+}
+
+void AngulagramPreview::clearPreview() {
+    requestPending = false;
+    resultDiscarded = true;
+    throttleTimer.stop();
+    series->clear();
+}
+
+void AngulagramPreview::onThrottleTimeout() {
+    if (!requestPending || previewWatcher.isRunning()) {
+        return;
+    }
+
+    requestPending = false;
+    resultDiscarded = false;
+    calculatedGeometry = requestedGeometry;
+
+    QImage image = requestedImage;
+    TopinoData::PolarGeometry geometry = requestedGeometry;
+
+    previewWatcher.setFuture(QtConcurrent::run([image, geometry]() {
+        return TopinoData::calculateAngulagramPreview(image, geometry);
+    }));
+}
+
+void AngulagramPreview::onPreviewCalculated() {
+    /* The preview might have been cleared in the meantime */
+    TopinoTools::SampledSignal preview = previewWatcher.result();
+
+    if (!resultDiscarded && !preview.isEmpty()) {
+        /* Scale to relative intensities like the angulagram view */
+        qreal maximum = *std::max_element(preview.values.constBegin(), preview.values.constEnd());
+        if (maximum == 0.0) {
+            maximum = 1.0;
+        }
+
+        QVector<QPointF> points = preview.toPoints();
+        for (auto it = points.begin(); it != points.end(); ++it) {
+            it->setY(it->y() / maximum);
+        }
+
+        updateAxes(calculatedGeometry);
+        series->replace(points);
+    }
+
+    /* Continue with the latest request */
+    if (requestPending && !throttleTimer.isActive()) {
+        throttleTimer.start();
+    }
+}
+
+void AngulagramPreview::updateAxes(const TopinoData::PolarGeometry& geometry) {
+    /* Same orientation as in the angulagram view: counterclockwise is from right to left */
+    qreal factor = geometry.counterClockwise ? -1.0 : 1.0;
+
+    xaxis->setRange(factor * qAbs(geometry.minAngle), -1.0 * factor * qAbs(geometry.maxAngle));
+    xaxis->setReverse(geometry.counterClockwise);
+}
@@ -44,7 +44,12 @@ AngulagramView::AngulagramView(QWidget* parent, TopinoDocument& doc) : TopinoAbs
 AngulagramView::~AngulagramView() {
 }
 
-void AngulagramView::modelHasChanged() {
+void AngulagramView::modelHasChanged(int changes) {
+    /* The chart only shows the angulagram and the streams (in the coordinate system of the main inlet) */
+    if (!(changes & (IObserver::changeGeometry | IObserver::changeAngulagram | IObserver::changeStreams))) {
+        return;
+    }
+
     /* Remove the old series and get the new one from the data */
     chart->removeAllSeries();
     legendItems.clear();
@@ -235,19 +240,15 @@ void AngulagramView::createAxes() {
 void AngulagramView::createDataSeries() {
     /* Get the raw data points from the document. If there is nothing, just leave
      * here immediately. */
-    QVector<QPointF> dataPoints = document.getData().getAngulagramPoints();
+    TopinoTools::SampledSignal angulagram = document.getData().getAngulagram();
 
-    if (dataPoints.length() == 0) {
+    if (angulagram.length() == 0) {
         return;
     }
 
     /* First, let's calculate a scaling factor from this data to scale it to relative
      * intensities (makes the y-axis way more clear!). */
-    QPointF maxPoint = *std::max_element(dataPoints.constBegin(), dataPoints.constEnd(),
-    [](const QPointF& a,const QPointF& b) {
-        return a.y() < b.y();
-    });
-    setScalingFactor(maxPoint.y());
+    setScalingFactor(*std::max_element(angulagram.values.constBegin(), angulagram.values.constEnd()));
 
     /* Second, let's create a line series first with all the data points. We multiply
      * the x-values with either -1.0 or 1.0 depending on the orientation (CCW or CW)
@@ -256,8 +257,8 @@ void AngulagramView::createDataSeries() {
     QtCharts::QLineSeries *series = new QtCharts::QLineSeries(chart);
 
     //qreal xFactor = document.getData().getCoordCounterClockwise() ? 1.0 : -1.0;
-    for (auto iter = dataPoints.begin(); iter != dataPoints.end(); ++iter) {
-        series->append(iter->x(), iter->y() / scalingFactor);
+    for (int i = 0; i < angulagram.length(); ++i) {
+        series->append(angulagram.x(i), angulagram.y(i) / scalingFactor);
     }
 
     /* Third, let's create an area series based on this line series to fill the area
@@ -275,6 +276,7 @@ void AngulagramView::createDataSeries() {
 
     /* Get stream parameters */
     QVector<TopinoTools::Lorentzian> lorentzians = document.getData().getStreamParameters();
+    TopinoTools::Baseline baseline = document.getData().getStreamBaseline();
 
     /* Finally, let's add Lorentzian curves for each Lorentzian fit */
     legendItems.clear();
@@ -287,16 +289,23 @@ void AngulagramView::createDataSeries() {
         lorentzLine->setPen(TopinoTools::colorsTableau10[i % 7]);
 
         /* Calculate data based on the x-values of the smoothened data */
-        for(int j = 0; j < dataPoints.length(); ++j) {
-            qreal x = dataPoints[j].x();
-            qreal y = lorentzians[i].f(x) / scalingFactor;
+        for(int j = 0; j < angulagram.length(); ++j) {
+            qreal x = angulagram.x(j);
+            qreal y = (baseline.f(x) + lorentzians[i].f(x)) / scalingFactor;
             lorentzLine->append(x, y);
         }
 
         /* Name the series for the legend */
         QString label;
-        label.sprintf("<i>𝜑</i> = %+.1f°, <i>𝜔</i> = %.1f°, <i>L</i>² = %.2f",
-                      lorentzians[i].pos, lorentzians[i].width, lorentzians[i].rsquare);
+        if (lorentzians[i].posCI.isNull() || lorentzians[i].widthCI.isNull()) {
+            label.sprintf("<i>𝜑</i> = %+.1f°, <i>𝜔</i> = %.1f°, <i>L</i>² = %.2f",
+                          lorentzians[i].pos, lorentzians[i].width, lorentzians[i].rsquare);
+        } else {
+            label.sprintf("<i>𝜑</i> = %+.1f° [%+.1f, %+.1f], <i>𝜔</i> = %.1f° [%.1f, %.1f], <i>L</i>² = %.2f",
+                          lorentzians[i].pos, lorentzians[i].posCI.lower, lorentzians[i].posCI.upper,
+                          lorentzians[i].width, lorentzians[i].widthCI.lower, lorentzians[i].widthCI.upper,
+                          lorentzians[i].rsquare);
+        }
         lorentzLine->setName(label);
 
         chart->addSeries(lorentzLine);
@@ -1,6 +1,8 @@
 #include "include/evalangulagramdialog.h"
 #include "ui_evalangulagramdialog.h"
 
+#include <QApplication>
+
 EvalAngulagramDialog::EvalAngulagramDialog(QWidget *parent) :
     QDialog(parent),
     ui(new Ui::EvalAngulagramDialog) {
@@ -13,6 +15,20 @@ EvalAngulagramDialog::EvalAngulagramDialog(QWidget *parent) :
     /* Default values */
     scalingFactor = 1.0;
 
+    /* Add the peak filter criteria; block signals, as there is no data yet */
+    ui->comboFilter->blockSignals(true);
+    for(int i = 0; i < TopinoTools::peakFilterCriteria::filterCOUNT; ++i) {
+        ui->comboFilter->addItem(TopinoTools::getPeakFilterCriterionName(TopinoTools::peakFilterCriteria(i)));
+    }
+    ui->comboFilter->blockSignals(false);
+
+    /* Add the peak models */
+    ui->comboModel->blockSignals(true);
+    for(int i = 0; i < TopinoTools::peakModels::modelCOUNT; ++i) {
+        ui->comboModel->addItem(TopinoTools::getPeakModelName(TopinoTools::peakModels(i)));
+    }
+    ui->comboModel->blockSignals(false);
+
     /* Set some visual standard for this chart; in particular, scrollbars off! */
     ui->previewView->setBackgroundRole(QPalette::Window);
     ui->previewView->setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
@@ -184,22 +200,29 @@ void EvalAngulagramDialog::createDataSeries() {
         return;
     }
 
-    /* Let's create a mini-series for the "threshold" bar */
+    /* Let's create a mini-series for the "threshold" bar; with a baseline, the threshold is
+     * relative to the baseline and follows it. The wavelet detector uses no threshold (but the
+     * signal-to-noise ratio), so the bar stays at the bottom. */
+    qreal thresholdValue = ui->spinThreshold->value() / 100.0;
+    if (ui->comboFilter->currentIndex() == TopinoTools::filterWavelet) {
+        thresholdValue = 0.0;
+    }
+
     QtCharts::QLineSeries *threshSeries = new QtCharts::QLineSeries(chart);
-    qreal factor = orientationRTL ? -1.0 : 1.0;
-    threshSeries->append(factor * qAbs(angularRange.first), ui->spinThreshold->value() / 100.0);
-    threshSeries->append(-1.0 * factor * qAbs(angularRange.second), ui->spinThreshold->value() / 100.0);
+    if (baseline.isNull()) {
+        qreal factor = orientationRTL ? -1.0 : 1.0;
+        threshSeries->append(factor * qAbs(angularRange.first), thresholdValue);
+        threshSeries->append(-1.0 * factor * qAbs(angularRange.second), thresholdValue);
+    } else {
+        for (int i = 0; i < baseline.signal.length(); ++i) {
+            threshSeries->append(baseline.signal.x(i), baseline.signal.y(i) / scalingFactor + thresholdValue);
+        }
+    }
     threshSeries->setPen(TopinoTools::colorsTableau10[4]);
     chart->addSeries(threshSeries);
 
-    /* Let's calculate a scaling factor from this data to scale it to relative
-     * intensities (makes the y-axis way more clear!). */
-    QPointF maxPoint = *std::max_element(smoothenedDataPoints.constBegin(), smoothenedDataPoints.constEnd(),
-    [](const QPointF& a,const QPointF& b) {
-        return a.y() < b.y();
-    });
-    setScalingFactor(maxPoint.y());
-
+    /* The data is scaled to relative intensities (makes the y-axis way more clear!); the scaling
+     * factor is the maximum of the smoothed data (see processData) */
     /* Let's create a line series first with all the data points. We multiply
      * the x-values with either -1.0 or 1.0 depending on the orientation (CCW or CW)
      * of the coordinate system on the image. We devide the y-values by the scaling
@@ -222,6 +245,20 @@ void EvalAngulagramDialog::createDataSeries() {
 
     chart->addSeries(areaseries);
 
+    /* Show the baseline (if any) as dashed line */
+    if (!baseline.isNull()) {
+        QtCharts::QLineSeries *baselineSeries = new QtCharts::QLineSeries(chart);
+        QPen pen(TopinoTools::colorsTableau10[8]);
+        pen.setStyle(Qt::DashLine);
+        baselineSeries->setPen(pen);
+
+        for (int i = 0; i < baseline.signal.length(); ++i) {
+            baselineSeries->append(baseline.signal.x(i), baseline.signal.y(i) / scalingFactor);
+        }
+
+        chart->addSeries(baselineSeries);
+    }
+
     /* Next, let's add a series each for the minima and maxima, respectively. There are points
      * each. For the minima, we also add dashed lines from the point to the x-axis. */
     if (extrema.length() > 0) {
@@ -233,18 +270,21 @@ void EvalAngulagramDialog::createDataSeries() {
         maxima->setBrush(QBrush(TopinoTools::colorsTableau10[9]));
 
         for(auto it = extrema.begin(); it != extrema.end(); ++it) {
+            /* The extrema are found on the baseline corrected data */
+            qreal y = (it->pos.y() + baseline.f(it->pos.x())) / scalingFactor;
+
             if (it->type == TopinoTools::extremaMinimum) {
-                minima->append(it->pos.x(), it->pos.y() / scalingFactor);
+                minima->append(it->pos.x(), y);
 
                 QtCharts::QLineSeries *minimaLine = new QtCharts::QLineSeries(chart);
                 minimaLine->setPen(QPen(Qt::DashLine));
                 minimaLine->setColor(QColor(255, 255, 255));
                 minimaLine->append(it->pos.x(), 0.0);
-                minimaLine->append(it->pos.x(), it->pos.y() / scalingFactor);
+                minimaLine->append(it->pos.x(), y);
                 chart->addSeries(minimaLine);
 
             } else if (it->type == TopinoTools::extremaMaximum) {
-                maxima->append(it->pos.x(), it->pos.y() / scalingFactor);
+                maxima->append(it->pos.x(), y);
             }
         }
 
@@ -264,7 +304,7 @@ void EvalAngulagramDialog::createDataSeries() {
         /* Calculate data based on the x-values of the smoothened data */
         for(int j = 0; j < smoothenedDataPoints.length(); ++j) {
             qreal x = smoothenedDataPoints[j].x();
-            qreal y = lorentzians[i].f(x) / scalingFactor;
+            qreal y = (baseline.f(x) + lorentzians[i].f(x)) / scalingFactor;
             lorentzLine->append(x, y);
         }
 
@@ -276,28 +316,136 @@ QVector<TopinoTools::Lorentzian> EvalAngulagramDialog::getLorentzians() const {
     return lorentzians;
 }
 
+void EvalAngulagramDialog::setInitialLorentzians(const QVector<TopinoTools::Lorentzian>& value) {
+    previousLorentzians = value;
+}
+
+QVector<QPointF> EvalAngulagramDialog::getCorrectedDataPoints() const {
+    return correctedDataPoints;
+}
+
+QVector<TopinoTools::Section> EvalAngulagramDialog::getSections() const {
+    return sections;
+}
+
+TopinoTools::Baseline EvalAngulagramDialog::getBaseline() const {
+    return baseline;
+}
+
+void EvalAngulagramDialog::setBaselineParameters(const TopinoTools::Baseline& value) {
+    /* No update here; this is set before the data points */
+    const QSignalBlocker blockCheck(ui->checkBaseline);
+    const QSignalBlocker blockLambda(ui->spinBaselineLambda);
+    const QSignalBlocker blockAsymmetry(ui->spinBaselineAsymmetry);
+
+    ui->checkBaseline->setChecked(!value.isNull());
+    ui->spinBaselineLambda->setEnabled(!value.isNull());
+    ui->spinBaselineAsymmetry->setEnabled(!value.isNull());
+
+    if (value.lambda > 0.0) {
+        ui->spinBaselineLambda->setValue(log10(value.lambda));
+    }
+    ui->spinBaselineAsymmetry->setValue(value.asymmetry);
+
+    hierarchySmoothSize = -1;
+}
+
+TopinoTools::peakModels EvalAngulagramDialog::getPeakModel() const {
+    return TopinoTools::peakModels(ui->comboModel->currentIndex());
+}
+
+void EvalAngulagramDialog::setPeakModel(TopinoTools::peakModels model) {
+    /* No update here; this is set before the data points */
+    const QSignalBlocker blockModel(ui->comboModel);
+    ui->comboModel->setCurrentIndex(model);
+}
+
 void EvalAngulagramDialog::processData() {
-    /* First step: copy raw data points into smoothened data points vector and empty all other
-     * data. */
-    smoothenedDataPoints = dataPoints;
+    /* First step: empty all data from the last run. */
     extrema.clear();
+    sections.clear();
+
+    if (!lorentzians.isEmpty()) {
+        previousLorentzians = lorentzians;
+    }
     lorentzians.clear();
 
-    /* Second step: smoothen the data with the provided parameters */
-    TopinoTools::smoothByGaussianKernel(smoothenedDataPoints, ui->spinSmoothSize->value(), ui->spinSmoothSigma->value());
+    /* Second step: smoothen the data with the provided parameters, remove the baseline (if selected),
+     * and calculate the peak hierarchy; all of this only depends on the smoothing and baseline
+     * parameters, so do it only if these changed. */
+    if ((hierarchySmoothSize != ui->spinSmoothSize->value()) || (hierarchySmoothSigma != ui->spinSmoothSigma->value())) {
+        TopinoTools::SampledSignal smoothenedSignal = dataPoints;
+        TopinoTools::smoothByGaussianKernel(smoothenedSignal, ui->spinSmoothSize->value(), ui->spinSmoothSigma->value());
+        smoothenedDataPoints = smoothenedSignal.toPoints();
+
+        /* The threshold is relative to the maximum of the smoothed data, so the scaling factor has to
+         * be known before the extrema are filtered */
+        if (!smoothenedDataPoints.isEmpty()) {
+            setScalingFactor(std::max_element(smoothenedDataPoints.constBegin(), smoothenedDataPoints.constEnd(),
+            [](const QPointF& a, const QPointF& b) {
+                return a.y() < b.y();
+            })->y());
+        }
+
+        if (ui->checkBaseline->isChecked()) {
+            baseline = TopinoTools::calculateBaselineALS(smoothenedDataPoints, qPow(10.0, ui->spinBaselineLambda->value()),
+                       ui->spinBaselineAsymmetry->value());
+            correctedDataPoints = TopinoTools::subtractBaseline(smoothenedDataPoints, baseline);
+        } else {
+            baseline = TopinoTools::Baseline();
+            correctedDataPoints = smoothenedDataPoints;
+        }
+
+        peakHierarchy = TopinoTools::calculatePeakHierarchy(correctedDataPoints);
 
-    /* Third step: find extrema points */
-    TopinoTools::getExtrema(smoothenedDataPoints, extrema);
+        /* The wavelet transform needs the unsmoothed data for estimating the noise; the peaks
+         * are moved to the indices of the (shorter) smoothened data afterwards. */
+        waveletPeaks.clear();
+        if (ui->comboFilter->currentIndex() == TopinoTools::filterWavelet) {
+            TopinoTools::SampledSignal correctedSignal = dataPoints;
+            for(int i = 0; i < correctedSignal.length(); ++i) {
+                correctedSignal.values[i] -= baseline.f(correctedSignal.x(i));
+            }
+
+            waveletPeaks = TopinoTools::calculateWaveletPeaks(correctedSignal);
+
+            for(auto it = waveletPeaks.begin(); it != waveletPeaks.end(); ++it) {
+                it->index -= ui->spinSmoothSize->value() / 2;
+            }
+        }
+
+        hierarchySmoothSize = ui->spinSmoothSize->value();
+        hierarchySmoothSigma = ui->spinSmoothSigma->value();
+
+        qDebug("Found %d peaks in hierarchy", peakHierarchy.peaks.length());
+    }
 
-    qDebug("Found %d extrema:", extrema.length());
+    /* Third step: get the extrema above the threshold (either height or prominence) from the hierarchy
+     * or the wavelet peaks above the minimum signal-to-noise ratio (given by the threshold) */
+    TopinoTools::peakFilterCriteria criterion = TopinoTools::peakFilterCriteria(ui->comboFilter->currentIndex());
     qreal threshold = (ui->spinThreshold->value() / 100.0) * scalingFactor;
-    TopinoTools::filterExtrema(extrema, threshold);
+
+    if (criterion == TopinoTools::filterWavelet) {
+        extrema = TopinoTools::getExtremaFromWaveletPeaks(correctedDataPoints, waveletPeaks, ui->spinThreshold->value());
+    } else {
+        extrema = TopinoTools::getExtremaFromHierarchy(peakHierarchy, threshold, criterion);
+    }
 
     qDebug("Filtered to %d extrema:", extrema.length());
 
     for(int i = 0; i < extrema.length(); ++i) {
         qDebug("%3d: at index %d (%1.f, %.1f) type %d", i+1, extrema[i].index, extrema[i].pos.x(), extrema[i].pos.y(), extrema[i].type);
     }
+
+    /* When filtering by prominence or wavelet, the threshold is no baseline; hence, the sections are
+     * extended down to the lowest point of the data. */
+    if ((criterion != TopinoTools::filterHeight) && !correctedDataPoints.isEmpty()) {
+        threshold = std::min_element(correctedDataPoints.constBegin(), correctedDataPoints.constEnd(),
+        [](const QPointF& a, const QPointF& b) {
+            return a.y() < b.y();
+        })->y();
+    }
+
     int minima = TopinoTools::countExtrema(extrema, TopinoTools::extremaMinimum);
     int maxima = TopinoTools::countExtrema(extrema, TopinoTools::extremaMaximum);
 
@@ -309,15 +457,21 @@ void EvalAngulagramDialog::processData() {
     }
 
     /* Forth step: get sections and fit every section to a Lorentzian curve */
-    QVector<TopinoTools::Section> sections = TopinoTools::getSections(smoothenedDataPoints, extrema, threshold);
+    sections = TopinoTools::getSections(correctedDataPoints, extrema, threshold);
     for(int i = 0; i < sections.length(); ++i) {
         qDebug("Section %2d: from %d (%.1f, %.1f) to %d (%.1f, %.1f) with maximum at %d (%.1f, %.1f)", i+1,
-               sections[i].indexLeft, smoothenedDataPoints[sections[i].indexLeft].x(), smoothenedDataPoints[sections[i].indexLeft].y(),
-               sections[i].indexRight, smoothenedDataPoints[sections[i].indexRight].x(), smoothenedDataPoints[sections[i].indexRight].y(),
-               sections[i].indexMax, smoothenedDataPoints[sections[i].indexMax].x(), smoothenedDataPoints[sections[i].indexMax].y());
+               sections[i].indexLeft, correctedDataPoints[sections[i].indexLeft].x(), correctedDataPoints[sections[i].indexLeft].y(),
+               sections[i].indexRight, correctedDataPoints[sections[i].indexRight].x(), correctedDataPoints[sections[i].indexRight].y(),
+               sections[i].indexMax, correctedDataPoints[sections[i].indexMax].x(), correctedDataPoints[sections[i].indexMax].y());
     }
 
-    lorentzians = TopinoTools::calculateLorentzians(smoothenedDataPoints, sections, threshold);
+    /* The cache is just needed while the parameters are changed; do not let it grow endlessly */
+    if (fitCache.size() > 512) {
+        fitCache.clear();
+    }
+
+    lorentzians = TopinoTools::calculateLorentzians(correctedDataPoints, sections, threshold, getPeakModel(),
+                  previousLorentzians, &fitCache);
     for(int i = 0; i < lorentzians.length(); ++i) {
         qDebug("Lorentzian %2d: pos %.1f, width %.1f, height %.1f, offset %.1f, r-square %.2f", i+1,
                lorentzians[i].pos, lorentzians[i].width, lorentzians[i].height, lorentzians[i].offset, lorentzians[i].rsquare);
@@ -332,10 +486,12 @@ void EvalAngulagramDialog::processData() {
     }
 }
 
-void EvalAngulagramDialog::setDataPoints(const QVector<QPointF>& value) {
+void EvalAngulagramDialog::setDataPoints(const TopinoTools::SampledSignal& value) {
     /* Save data points */
     dataPoints = value;
-    smoothenedDataPoints = value;
+    smoothenedDataPoints = value.toPoints();
+    correctedDataPoints = smoothenedDataPoints;
+    hierarchySmoothSize = -1;
 
     /* The maximum of smoothing is to take half the points on the left and half
      * the points on the right side. */
@@ -353,3 +509,115 @@ void EvalAngulagramDialog::on_spinThreshold_valueChanged(double value) {
     updateData();
     updateView();
 }
+
+void EvalAngulagramDialog::on_buttonAutoTune_clicked() {
+    /* The search might take a moment (even though it runs in parallel) */
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    /* The candidates are evaluated on the same (corrected) data as the manual evaluation */
+    qreal lambda = ui->checkBaseline->isChecked() ? qPow(10.0, ui->spinBaselineLambda->value()) : 0.0;
+    autoTuneCandidates = TopinoTools::autoTuneParameters(dataPoints, ui->spinSmoothSize->maximum(),
+                         TopinoTools::peakFilterCriteria(ui->comboFilter->currentIndex()), getPeakModel(), 5,
+                         lambda, ui->spinBaselineAsymmetry->value());
+    QApplication::restoreOverrideCursor();
+
+    /* Fill the combo box with the best candidates */
+    ui->comboAutoTune->clear();
+
+    for(auto it = autoTuneCandidates.begin(); it != autoTuneCandidates.end(); ++it) {
+        QString label;
+        label.sprintf("%d / %.1f / %.1f%% (%d peaks, R² %.3f)", it->parameters.smoothSize, it->parameters.smoothSigma,
+                      it->parameters.threshold, it->peaks, it->meanRSquare);
+        ui->comboAutoTune->addItem(label);
+    }
+
+    ui->comboAutoTune->setEnabled(!autoTuneCandidates.isEmpty());
+
+    if (autoTuneCandidates.isEmpty()) {
+        ui->labelError->setText(QString(tr("Auto-tune could not find any parameters resulting in a valid fit.")));
+        return;
+    }
+
+    /* Apply the best candidate directly */
+    ui->comboAutoTune->setCurrentIndex(0);
+    on_comboAutoTune_activated(0);
+}
+
+void EvalAngulagramDialog::on_comboAutoTune_activated(int index) {
+    if ((index < 0) || (index >= autoTuneCandidates.length())) {
+        return;
+    }
+
+    setEvaluationParameters(autoTuneCandidates[index].parameters);
+}
+
+void EvalAngulagramDialog::setEvaluationParameters(const TopinoTools::EvaluationParameters& parameters) {
+    /* Block the signals of the spin boxes; otherwise each value would trigger a full update */
+    const QSignalBlocker blockSize(ui->spinSmoothSize);
+    const QSignalBlocker blockSigma(ui->spinSmoothSigma);
+    const QSignalBlocker blockThreshold(ui->spinThreshold);
+
+    ui->spinSmoothSize->setValue(parameters.smoothSize);
+    ui->spinSmoothSigma->setValue(parameters.smoothSigma);
+    ui->spinThreshold->setValue(parameters.threshold);
+
+    updateData();
+    updateView();
+}
+
+void EvalAngulagramDialog::on_comboFilter_currentIndexChanged(int index) {
+    /* For the wavelet detector, the threshold is the minimum signal-to-noise ratio and there is
+     * nothing to tune */
+    bool wavelet = (index == TopinoTools::filterWavelet);
+    if (wavelet != (ui->spinThreshold->suffix().isEmpty())) {
+        const QSignalBlocker blockThreshold(ui->spinThreshold);
+
+        ui->label_4->setText(wavelet ? tr("Minimum SNR:") : tr("Threshold:"));
+        ui->spinThreshold->setSuffix(wavelet ? "" : "%");
+        ui->spinThreshold->setValue(wavelet ? 6.0 : 2.0);
+    }
+
+    ui->buttonAutoTune->setEnabled(!wavelet);
+    ui->comboAutoTune->setEnabled(!wavelet && !autoTuneCandidates.isEmpty());
+
+    /* The wavelet peaks are calculated together with the hierarchy */
+    hierarchySmoothSize = -1;
+
+    updateData();
+    updateView();
+}
+
+void EvalAngulagramDialog::on_comboModel_currentIndexChanged(int index) {
+    Q_UNUSED(index);
+
+    updateData();
+    updateView();
+}
+
+void EvalAngulagramDialog::on_checkBaseline_toggled(bool checked) {
+    ui->spinBaselineLambda->setEnabled(checked);
+    ui->spinBaselineAsymmetry->setEnabled(checked);
+
+    /* The baseline changes the data for the peak hierarchy */
+    hierarchySmoothSize = -1;
+
+    updateData();
+    updateView();
+}
+
+void EvalAngulagramDialog::on_spinBaselineLambda_valueChanged(double value) {
+    Q_UNUSED(value);
+
+    hierarchySmoothSize = -1;
+
+    updateData();
+    updateView();
+}
+
+void EvalAngulagramDialog::on_spinBaselineAsymmetry_valueChanged(double value) {
+    Q_UNUSED(value);
+
+    hierarchySmoothSize = -1;
+
+    updateData();
+    updateView();
+}
@@ -14,15 +14,21 @@ ImageAnalysisView::ImageAnalysisView(QWidget *parent, TopinoDocument &doc) :
 
     /* Check if selection changed and eventually propagate */
     connect(imagescene, &QGraphicsScene::selectionChanged, this, &ImageAnalysisView::onSelectionChange);
+
+    /* Coalesce item position changes to (about) the display rate */
+    itemChangeTimer.setSingleShot(true);
+    itemChangeTimer.setInterval(16);
+    connect(&itemChangeTimer, &QTimer::timeout, this, &ImageAnalysisView::onItemChangeTimeout);
 }
 
 ImageAnalysisView::~ImageAnalysisView() {
 }
 
-void ImageAnalysisView::modelHasChanged() {
-    if (sourceImageShown) {
+void ImageAnalysisView::modelHasChanged(int changes) {
+    /* Only upload the image again if the one shown changed; inlet edits, etc. do not need this */
+    if (sourceImageShown && (changes & IObserver::changeImage)) {
         setImage(document.getData().getImage());
-    } else {
+    } else if (!sourceImageShown && (changes & (IObserver::changeImage | IObserver::changeProcessing))) {
         setImage(document.getData().getProcessedImage());
     }
 }
@@ -39,7 +45,7 @@ void ImageAnalysisView::resetView() {
     emit viewHasChanged();
 }
 
-void ImageAnalysisView::setImage(const QImage& image) {
+void ImageAnalysisView::setImage(const QImage& image, const QSize& size) {
     /* If the image is empty, the zoom factor is set to 100% */
     if (image.isNull()) {
         inputImage->setPixmap(QPixmap());
@@ -49,14 +55,15 @@ void ImageAnalysisView::setImage(const QImage& image) {
     }
 
     /* Save the dimensions of the old image for comparison later */
-    int oldWidth = inputImage->getPixmap().width();
-    int oldHeight = inputImage->getPixmap().height();
+    int oldWidth = inputImage->getImageSize().width();
+    int oldHeight = inputImage->getImageSize().height();
 
-    /* Extract Pixmap from image */
-    inputImage->setPixmap(QPixmap::fromImage(image));
+    /* Extract Pixmap from image; a preview is stretched to the size of the full image, so that the
+     * tools keep their positions when the full image arrives */
+    inputImage->setPixmap(QPixmap::fromImage(image), size);
 
     /* Should the image dimensions have changed, then update scene rect, zoom, etc. */
-    if ((inputImage->getPixmap().width() != oldWidth) || (inputImage->getPixmap().height() != oldHeight)) {
+    if ((inputImage->getImageSize().width() != oldWidth) || (inputImage->getImageSize().height() != oldHeight)) {
         /* Fit the image into the view, but make sure that the minimum and maximum zoom level is not violated */
         setImageBasedSceneRect();
         fitInView(imagescene->itemsBoundingRect(), Qt::KeepAspectRatio);
@@ -384,9 +391,23 @@ void ImageAnalysisView::onItemPosChanged(const TopinoGraphicsItem* item) {
     if (item == nullptr)
         return;
 
-    qDebug("View: Item pos %d of type %d changed", item->getItemid(), item->getItemType());
+    /* Just remember the item; the change is propagated with the next frame */
+    pendingItemChanges.insert(item->getItemid());
 
-    emit itemHasChanged(item->getItemid());
+    if (!itemChangeTimer.isActive()) {
+        itemChangeTimer.start();
+    }
+}
+
+void ImageAnalysisView::onItemChangeTimeout() {
+    /* Take the pending changes first since the receivers might trigger new ones */
+    QSet<int> changes = pendingItemChanges;
+    pendingItemChanges.clear();
+
+    for (auto it = changes.constBegin(); it != changes.constEnd(); ++it) {
+        qDebug("View: Item pos %d changed", *it);
+        emit itemHasChanged(*it);
+    }
 }
 
 void ImageAnalysisView::onItemDataChanged(const TopinoGraphicsItem* item) {
@@ -395,6 +416,12 @@ void ImageAnalysisView::onItemDataChanged(const TopinoGraphicsItem* item) {
 
     qDebug("View: Item data %d of type %d changed", item->getItemid(), item->getItemType());
 
+    /* This change is final (e.g. mouse release), so pending position changes of the item are covered */
+    pendingItemChanges.remove(item->getItemid());
+    if (pendingItemChanges.isEmpty()) {
+        itemChangeTimer.stop();
+    }
+
     /* Check what the item is */
     switch (item->getItemType()) {
     /* Update the inlet item of the document */
@@ -640,6 +667,23 @@ void ImageAnalysisView::createToolsFromDocument() {
     emit viewHasChanged();
 }
 
+void ImageAnalysisView::recreateInletTools() {
+    /* The inlet tools are not updated by the document (they are the source of the changes usually);
+     * if the inlets changed otherwise (e.g. undo), simply create them again */
+    QList<QGraphicsItem *> items = this->items();
+    for(auto iter = items.begin(); iter != items.end(); ++iter) {
+        TopinoGraphicsItem *item = dynamic_cast<TopinoGraphicsItem *>(*iter);
+
+        if ((item != nullptr) && (item->getItemType() == TopinoGraphicsItem::itemtype::inlet)) {
+            pendingItemChanges.remove(item->getItemid());
+            scene()->removeItem(item);
+            item->deleteLater();
+        }
+    }
+
+    createToolsFromDocument();
+}
+
 TopinoGraphicsItem*ImageAnalysisView::getToolbyTypeAndId(TopinoGraphicsItem::itemtype type, int id = 0) {
     /* Check every item for type */
     QList<QGraphicsItem *> items = this->items();
@@ -795,9 +839,16 @@ void ImageAnalysisView::removeItem(TopinoGraphicsItem* item) {
     switch(item->getItemType()) {
     /* Inlet: remove inlet with ID from document. */
     case TopinoGraphicsItem::inlet: {
-        TopinoData data = document.getData();
-        data.removeInlet(item->getItemid());
-        document.setData(data);
+        /* Removing the main inlet also removes the angulagram and streams */
+        int ID = item->getItemid();
+        int changes = IObserver::changeInlets;
+        if (ID == document.getData().getMainInletID()) {
+            changes |= IObserver::changeGeometry | IObserver::changeAngulagram | IObserver::changeStreams;
+        }
+
+        document.edit([ID](TopinoData& data) {
+            data.removeInlet(ID);
+        }, changes);
     }
     break;
     /* Default: nothing to do for all other types. */
@@ -898,8 +949,8 @@ void ImageAnalysisView::createInletAtPos(const QPointF& pt, int radius) {
 
     /* If no radius is given, use the image dimensions to get a good one */
     if (radius == 0) {
-        int width = inputImage->getPixmap().width();
-        int height = inputImage->getPixmap().height();
+        int width = inputImage->getImageSize().width();
+        int height = inputImage->getImageSize().height();
         radius = qMax((int)(qMin(width, height) * 0.01), 10);
     }
 
@@ -927,7 +978,7 @@ InputImageToolItem* ImageAnalysisView::createInputImageToolItem(const QPixmap& p
 RulerToolItem* ImageAnalysisView::createRulerToolItem(QPointF srcPoint, QPointF destPoint) {
     /* Create a new tool, scale it to 0.2% of the image width, and connect it to the event chain */
     RulerToolItem *tool = new RulerToolItem(0);
-    tool->setScaling(inputImage->getPixmap().width() * 0.002);
+    tool->setScaling(inputImage->getImageSize().width() * 0.002);
     tool->setLine(QLineF(srcPoint, destPoint));
     imagescene->addItem(tool);
     connect(tool, &TopinoGraphicsItem::itemPosChanged, this, &ImageAnalysisView::onItemPosChanged);
@@ -939,11 +990,11 @@ RulerToolItem* ImageAnalysisView::createRulerToolItem(QPointF srcPoint, QPointF
 PolarCircleToolItem* ImageAnalysisView::createInletToolItem(QPointF srcPoint, int radius, bool addToDocument) {
     /* Create a new tool, scale it to 0.2% of the image width, and connect it to the event chain */
     PolarCircleToolItem *tool = new PolarCircleToolItem(0);
-    tool->setScaling(inputImage->getPixmap().width() * 0.002);
+    tool->setScaling(inputImage->getImageSize().width() * 0.002);
 
     tool->setOrigin(srcPoint);
     tool->setInnerRadius(radius);
-    tool->setOuterRadius(inputImage->getPixmap().width() / 2);
+    tool->setOuterRadius(inputImage->getImageSize().width() / 2);
     tool->setSegments(3);
 
     /* If there are already other inlets out there, then new ones will not show any segments but
@@ -986,29 +1037,27 @@ PolarCircleToolItem* ImageAnalysisView::createInletToolItem(QPointF srcPoint, in
         indata.coord = srcPoint;
         indata.radius = radius;
 
-        /* Create a document inlet object, receive ID, and connect to the tool */
-        TopinoData data = document.getData();
-        int ID = data.updateInlet(indata, true);
-        qDebug("Created new inlet with ID %d", ID);
-        tool->setItemid(ID);
-
-        /* If no other inlet has been created yet, this will be the main inlet */
-        if (count == 0) {
-            qDebug("This is a main inlet ID");
-            data.setMainInletID(ID);
-
-            data.setCoordOrigin(tool->getOrigin());
-            data.setCoordMinAngle(tool->getMinAngle());
-            data.setCoordMaxAngle(tool->getMaxAngle());
-            data.setCoordNeutralAngle(tool->getZeroAngle());
-            data.setCoordDiffAngle(tool->getDiffAngle());
-            data.setCoordSectors(tool->getSegments());
-            data.setCoordCounterClockwise(tool->getCounterClockwise());
-            data.setCoordOuterRadius(tool->getOuterRadius());
-        }
-
-        /* Add the new inlet data to the document */
-        document.setData(data);
+        /* Create a document inlet object, receive ID, and connect to the tool. If no other inlet has been
+         * created yet, this will be the main inlet. */
+        document.edit([&indata, tool, count](TopinoData& data) {
+            int ID = data.updateInlet(indata, true);
+            qDebug("Created new inlet with ID %d", ID);
+            tool->setItemid(ID);
+
+            if (count == 0) {
+                qDebug("This is a main inlet ID");
+                data.setMainInletID(ID);
+
+                data.setCoordOrigin(tool->getOrigin());
+                data.setCoordMinAngle(tool->getMinAngle());
+                data.setCoordMaxAngle(tool->getMaxAngle());
+                data.setCoordNeutralAngle(tool->getZeroAngle());
+                data.setCoordDiffAngle(tool->getDiffAngle());
+                data.setCoordSectors(tool->getSegments());
+                data.setCoordCounterClockwise(tool->getCounterClockwise());
+                data.setCoordOuterRadius(tool->getOuterRadius());
+            }
+        }, (count == 0) ? (IObserver::changeInlets | IObserver::changeGeometry) : IObserver::changeInlets);
     }
 
     /* Add the tool itself to the scene and connect it to the event chain */
@@ -1025,8 +1074,6 @@ void ImageAnalysisView::synchronizeInletToolItem(const PolarCircleToolItem* item
 
     qDebug("Synchronize data for ID %d", item->getItemid());
 
-    TopinoData data = document.getData();
-
     /* Update data for every inlet type */
     TopinoData::InletData indata;
     indata.ID = item->getItemid();
@@ -1035,20 +1082,22 @@ void ImageAnalysisView::synchronizeInletToolItem(const PolarCircleToolItem* item
 
     qDebug("Coordinates: %.0f x %.0f", indata.coord.x(), indata.coord.y());
 
-    /* Only for main inlets */
-    if (indata.ID == data.getMainInletID()) {
-        data.setCoordNeutralAngle(item->getZeroAngle());
-        data.setCoordMinAngle(item->getMinAngle());
-        data.setCoordMaxAngle(item->getMaxAngle());
-        data.setCoordDiffAngle(item->getDiffAngle());
-        data.setCoordOuterRadius(item->getOuterRadius());
-        data.setCoordCounterClockwise(item->getCounterClockwise());
-        data.setCoordSectors(item->getSegments());
-    }
+    bool isMainInlet = (indata.ID == document.getData().getMainInletID());
+
+    /* Update in place; the coordinate system only for main inlets */
+    document.edit([&indata, item, isMainInlet](TopinoData& data) {
+        if (isMainInlet) {
+            data.setCoordNeutralAngle(item->getZeroAngle());
+            data.setCoordMinAngle(item->getMinAngle());
+            data.setCoordMaxAngle(item->getMaxAngle());
+            data.setCoordDiffAngle(item->getDiffAngle());
+            data.setCoordOuterRadius(item->getOuterRadius());
+            data.setCoordCounterClockwise(item->getCounterClockwise());
+            data.setCoordSectors(item->getSegments());
+        }
 
-    /* Update */
-    data.updateInlet(indata);
-    document.setData(data);
+        data.updateInlet(indata);
+    }, isMainInlet ? (IObserver::changeInlets | IObserver::changeGeometry) : IObserver::changeInlets);
 }
 
 int ImageAnalysisView::countToolItemByType(TopinoGraphicsItem::itemtype type) {
@@ -316,7 +316,8 @@ void ImageEditDialog::showPreviewImage() {
 }
 
 void ImageEditDialog::setImage(const QImage& value) {
-    sourceImage = value;
+    /* The preview works on 8 bits per channel (e.g. for 16 bit frames) */
+    sourceImage = (value.depth() == 32) ? value : value.convertToFormat(QImage::Format_RGB32);
 }
 
 void ImageEditDialog::previewModeChanged(int index) {
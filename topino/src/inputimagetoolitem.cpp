@@ -78,7 +78,7 @@ void InputImageToolItem::hoverMoveEvent(QGraphicsSceneHoverEvent* event) {
 }
 
 QString InputImageToolItem::toString() const {
-    return QString("Image: %1 × %2 Px²").arg(pixmap.width()).arg(pixmap.height());
+    return QString("Image: %1 × %2 Px²").arg(imageSize.width()).arg(imageSize.height());
 }
 
 void InputImageToolItem::calculateRect() {
@@ -88,7 +88,7 @@ void InputImageToolItem::calculateRect() {
     if (pixmap.isNull()) {
         rect = QRectF(0, 0, 480, 480);
     } else {
-        rect = pixmap.rect();
+        rect = QRectF(QPointF(0, 0), imageSize);
     }
 }
 
@@ -96,7 +96,12 @@ QPixmap InputImageToolItem::getPixmap() const {
     return pixmap;
 }
 
-void InputImageToolItem::setPixmap(const QPixmap value) {
+QSize InputImageToolItem::getImageSize() const {
+    return imageSize;
+}
+
+void InputImageToolItem::setPixmap(const QPixmap value, const QSize& size) {
     pixmap = value;
+    imageSize = size.isValid() ? size : pixmap.size();
     calculateRect();
 }
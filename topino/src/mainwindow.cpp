@@ -1,8 +1,17 @@
 #include "include/mainwindow.h"
 #include "ui_mainwindow.h"
 
+#include <QApplication>
+#include <QBuffer>
+#include <QDir>
 #include <QMessageBox>
+#include <QFile>
 #include <QFileDialog>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QtConcurrent/QtConcurrentRun>
 
 MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent), ui(new Ui::MainWindow),
     imageView(this, document), angulagramView(this, document) {
@@ -27,6 +36,12 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent), ui(new Ui::MainWi
     ui->action_select_none->setText(ui->action_select_none->text() + "\t" + tr("Escape"));
     ui->action_next_item->setText(ui->action_next_item->text() + "\t" + tr("Tab"));
 
+    /* The result store is not available without the SQL module */
+#ifndef TOPINO_RESULT_STORE
+    ui->action_result_store->setVisible(false);
+    ui->action_query_results->setVisible(false);
+#endif
+
     /* Add the zoom level to the Overview docking window */
     ui->dockViewTools->setWindowTitle(QString("%1 - %2: %3%").arg(tr("Overview")).arg(tr("Zoom")).arg(100));
 
@@ -49,21 +64,81 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent), ui(new Ui::MainWi
     document.addObserver(this);
     document.addObserver(&imageView);
     document.addObserver(&angulagramView);
-    document.notifyAllObserver();
+
+    /* Nothing is shown yet, so everything has to be refreshed */
+    document.notifyAllObserver(IObserver::changeAll);
 
     /* If the view has been updated (e.g. zoomed in or the like) we need to know this, too. Here we implemeted
      * a signal-slot pair for this case */
     connect(&imageView, &ImageAnalysisView::viewHasChanged, this, &MainWindow::onViewHasChanged);
     connect(&imageView, &ImageAnalysisView::selectionHasChanged, this, &MainWindow::onSelectionHasChanged);
     connect(&imageView, &ImageAnalysisView::itemHasChanged, this, &MainWindow::onItemHasChanged);
+
+    /* Progress and cancel button for the background calculation of the angulagram in the status bar;
+     * only visible while calculating */
+    angulagramProgress = new QProgressBar(this);
+    angulagramProgress->setRange(0, 100);
+    angulagramProgress->setMaximumWidth(200);
+    angulagramProgress->setVisible(false);
+    angulagramCancelButton = new QPushButton(tr("Cancel"), this);
+    angulagramCancelButton->setVisible(false);
+    ui->statusBar->addPermanentWidget(angulagramProgress);
+    ui->statusBar->addPermanentWidget(angulagramCancelButton);
+
+    /* Busy indicator while saving */
+    saveProgress = new QProgressBar(this);
+    saveProgress->setRange(0, 0);
+    saveProgress->setMaximumWidth(100);
+    saveProgress->setVisible(false);
+    ui->statusBar->addPermanentWidget(saveProgress);
+
+    connect(&angulagramWatcher, &QFutureWatcher<TopinoData>::finished, this, &MainWindow::onAngulagramCalculated);
+    connect(angulagramCancelButton, &QPushButton::clicked, this, &MainWindow::onCancelAngulagramCalculation);
+    connect(&imageWatcher, &QFutureWatcher<TopinoData>::finished, this, &MainWindow::onImageLoaded);
+    connect(&saveWatcher, &QFutureWatcher<TopinoDocument::FileError>::finished, this, &MainWindow::onDocumentSaved);
+    connect(&bootstrapWatcher, &QFutureWatcher<QVector<TopinoTools::Lorentzian>>::finished, this, &MainWindow::onBootstrapCalculated);
+
+    /* The journal is written a few seconds after a change, so that many small edits (e.g. dragging an inlet)
+     * result in a single record */
+    journalTimer.setSingleShot(true);
+    journalTimer.setInterval(5000);
+
+    connect(&journalTimer, &QTimer::timeout, this, &MainWindow::onJournalTimer);
+    connect(&journalWatcher, &QFutureWatcher<TopinoDocument::FileError>::finished, this, &MainWindow::onJournalWritten);
+
+    /* Docking window with the live preview of the angulagram below the object properties; it can be
+     * shown and hidden via the view menu */
+    angulagramPreview = new AngulagramPreview(this);
+    dockAngulagramPreview = new QDockWidget(tr("Angulagram preview"), this);
+    dockAngulagramPreview->setObjectName("dockAngulagramPreview");
+    dockAngulagramPreview->setFeatures(QDockWidget::DockWidgetMovable | QDockWidget::DockWidgetClosable);
+    dockAngulagramPreview->setAllowedAreas(Qt::LeftDockWidgetArea | Qt::RightDockWidgetArea);
+    dockAngulagramPreview->setWidget(angulagramPreview);
+    addDockWidget(Qt::RightDockWidgetArea, dockAngulagramPreview);
+    ui->menu_View->addAction(dockAngulagramPreview->toggleViewAction());
+
+    connect(dockAngulagramPreview, &QDockWidget::visibilityChanged, this, &MainWindow::onAngulagramPreviewVisibilityChanged);
+
+    /* Offer to recover documents of a crashed Topino once the window is shown */
+    QTimer::singleShot(0, this, &MainWindow::onRecoverJournals);
 }
 
 MainWindow::~MainWindow() {
+    /* Do not leave a calculation running on the data */
+    cancelAngulagramCalculation();
+    angulagramWatcher.waitForFinished();
+    imageWatcher.waitForFinished();
+    saveWatcher.waitForFinished();
+    journalWatcher.waitForFinished();
+    bootstrapWatcher.waitForFinished();
+
     delete ui;
 }
 
 void MainWindow::closeEvent(QCloseEvent *event) {
     /* If the document has changed the user needs to be asked if to proceed */
+    bool discard = false;
+
     if (document.hasChanged()) {
         QMessageBox::StandardButton ret;
         ret = QMessageBox::question(this, tr("The current document was not saved."),
@@ -78,8 +153,14 @@ void MainWindow::closeEvent(QCloseEvent *event) {
             event->ignore();
             return;
         }
+
+        discard = (ret == QMessageBox::No);
     }
 
+    /* Do not close the window before the file is written; if saving failed, the journal is kept */
+    finishSaving();
+    closeJournal(discard || !document.hasChanged());
+
     /* Accepting this event means that we continue with closing the window */
     event->accept();
 }
@@ -98,17 +179,66 @@ bool MainWindow::eventFilter(QObject* watched, QEvent* event) {
 }
 
 
-void MainWindow::modelHasChanged() {
+void MainWindow::modelHasChanged(int changes) {
+    /* If the parameters of the angulagram changed during a calculation, the result will not fit
+     * anymore; abort it and restart it if the angulagram is shown */
+    const int angulagramInputs = IObserver::changeImage | IObserver::changeProcessing |
+                                 IObserver::changeGeometry | IObserver::changeInlets;
+
+    if ((changes & angulagramInputs) && angulagramWatcher.isRunning() &&
+            (document.getData().calculateStageKey(TopinoData::stagePolar) != angulagramJobKey)) {
+        if (getCurrentViewIndex() == viewPages::angulagram) {
+            startAngulagramCalculation();
+        } else {
+            cancelAngulagramCalculation();
+        }
+    }
+
+    /* The preview follows the stored geometry of the main inlet */
+    if (changes & angulagramInputs) {
+        updateAngulagramPreview(document.getData().getPolarGeometry());
+    }
+
+    /* Changes are recorded in the autosave journal; a new image needs a new journal */
+    const int journalChanges = IObserver::changeImage | IObserver::changeProcessing | IObserver::changeGeometry |
+                               IObserver::changeInlets | IObserver::changeStreams;
+
+    if (changes & IObserver::changeImage) {
+        journalStarted = false;
+    }
+
+    if ((changes & journalChanges) && document.hasChanged()) {
+        journalDirty = true;
+
+        if (!journalTimer.isActive()) {
+            journalTimer.start();
+        }
+    }
+
+    /* Undo and redo are only possible if there are steps */
+    ui->action_undo->setEnabled(document.canUndo());
+    ui->action_redo->setEnabled(document.canRedo());
+
     /* Set title of the main window to include the filename and an asterisk */
     QString newtitle;
     newtitle = document.getFilename() + (document.hasChanged() ? tr("*") : tr("")) + tr(" - Topino");
     setWindowTitle(newtitle);
 
     /* Update the general pages of the object properties dock widget */
-    updateObjectPage(objectPages::imageProps);
-    updateObjectPage(objectPages::angulagramProps);
+    if (changes & (IObserver::changeImage | IObserver::changeProcessing | IObserver::changeFile)) {
+        updateObjectPage(objectPages::imageProps);
+    }
+    if (changes & (IObserver::changeGeometry | IObserver::changeAngulagram | IObserver::changeStreams)) {
+        updateObjectPage(objectPages::angulagramProps);
+    }
+
+    /* Set image for the mini and micro view; only if the image itself changed since converting it into
+     * a pixmap is expensive for large images */
+    if (!(changes & IObserver::changeImage)) {
+        update();
+        return;
+    }
 
-    /* Set image for the mini and micro view */
     miniImage->setPixmap(QPixmap());
     QImage image = document.getData().getImage();
     if (!image.isNull()) {
@@ -236,6 +366,25 @@ void MainWindow::onSelectionHasChanged() {
 void MainWindow::onItemHasChanged(int itemID) {
     qDebug("Main windows: item %d has changed", itemID);
 
+    /* While the main inlet is dragged, the document is not updated yet; so the preview takes the
+     * geometry directly from the tool */
+    if ((itemID != 0) && (itemID == document.getData().getMainInletID())) {
+        PolarCircleToolItem *tool = imageView.getMainInletTool();
+
+        if (tool != nullptr) {
+            TopinoData::PolarGeometry geometry;
+            geometry.origin = tool->getOrigin();
+            geometry.innerRadius = tool->getInnerRadius();
+            geometry.outerRadius = tool->getOuterRadius();
+            geometry.neutralAngle = tool->getZeroAngle();
+            geometry.minAngle = tool->getMinAngle();
+            geometry.maxAngle = tool->getMaxAngle();
+            geometry.counterClockwise = tool->getCounterClockwise();
+
+            updateAngulagramPreview(geometry);
+        }
+    }
+
     onSelectionHasChanged();
 }
 
@@ -280,15 +429,15 @@ void MainWindow::changeToView(const viewPages value) {
 
     /* Page related stuff, e.g. show specific property pages,
      * (re)calculate the angulagram, etc. */
-    TopinoData data = document.getData();
     switch(value) {
-    /* Angulagram page */
+    /* Angulagram page; the angulagram is only recalculated (in the background) if anything it depends on
+     * changed */
     case viewPages::angulagram:
+        if (!document.getData().isStageUpToDate(TopinoData::stageAngulagram)) {
+            startAngulagramCalculation();
+        }
         updateObjectPage(objectPages::angulagramProps);
         ui->propertiesPages->setCurrentIndex(objectPages::angulagramProps);
-        data.calculatePolarImage();
-        data.calculateAngulagramPoints();
-        document.setData(data);
         break;
     /* Default is the image page */
     case viewPages::image:
@@ -407,10 +556,11 @@ void MainWindow::updateObjectPage(MainWindow::objectPages page) {
 
         /* Visible? */
         if(viewManager.currentIndex() == viewPages::angulagram) {
-            ui->propAnguDataPoints->setText(QString::number(document.getData().getAngulagramPoints().length()));
+            ui->propAnguDataPoints->setText(QString::number(document.getData().getAngulagram().length()));
             ui->propAnguStreams->setText(QString::number(document.getData().getStreamParameters().length()));
 
             QVector<AngulagramView::LegendItem> legendItems = angulagramView.getLegendItems();
+            QVector<TopinoTools::Lorentzian> streams = document.getData().getStreamParameters();
 
             if (legendItems.length() == 0) {
                 break;
@@ -439,6 +589,16 @@ void MainWindow::updateObjectPage(MainWindow::objectPages page) {
                 QTableWidgetItem *lin = new QTableWidgetItem(linLabel);
                 lin->setTextAlignment(Qt::AlignHCenter | Qt::AlignVCenter);
 
+                /* Confidence intervals (if available) as tool tips */
+                if (i < streams.length()) {
+                    if (!streams[i].posCI.isNull()) {
+                        pos->setToolTip(QString("95% CI: [%1, %2]").arg(streams[i].posCI.lower, 0, 'f', 2).arg(streams[i].posCI.upper, 0, 'f', 2));
+                    }
+                    if (!streams[i].widthCI.isNull()) {
+                        width->setToolTip(QString("95% CI: [%1, %2]").arg(streams[i].widthCI.lower, 0, 'f', 2).arg(streams[i].widthCI.upper, 0, 'f', 2));
+                    }
+                }
+
                 ui->tableAnguStreams->setItem(i, 0, pos);
                 ui->tableAnguStreams->setItem(i, 1, width);
                 ui->tableAnguStreams->setItem(i, 2, lin);
@@ -474,6 +634,14 @@ void MainWindow::updateObjectPage(MainWindow::objectPages page) {
                     QTableWidgetItem *res = new QTableWidgetItem(resLabel);
                     res->setTextAlignment(Qt::AlignHCenter | Qt::AlignVCenter);
 
+                    if ((i < streams.length()) && (j < streams.length())) {
+                        TopinoTools::ConfidenceInterval resCI = TopinoTools::getResolutionCI(streams, i, j);
+
+                        if (!resCI.isNull()) {
+                            res->setToolTip(QString("95% CI: [%1, %2]").arg(resCI.lower, 0, 'f', 2).arg(resCI.upper, 0, 'f', 2));
+                        }
+                    }
+
                     ui->tableAnguResolution->setCellWidget(row, 0, stream1);
                     ui->tableAnguResolution->setCellWidget(row, 1, stream2);
                     ui->tableAnguResolution->setItem(row, 2, res);
@@ -535,6 +703,13 @@ bool MainWindow::isImageAvailable() const {
 }
 
 bool MainWindow::isAngulagramAvailable() const {
+    if (angulagramWatcher.isRunning()) {
+        QMessageBox::information(nullptr, tr("Angulagram is being calculated"),
+                                 tr("The angulagram is still being calculated. Please wait until the calculation "
+                                    "has finished."));
+        return false;
+    }
+
     if (!document.getData().isAngulagramAvailable()) {
         QMessageBox::information(nullptr, tr("No angulagram data available"),
                                  tr("You need to create a main inlet with polar coordinate system (in the image view) to "
@@ -547,6 +722,8 @@ bool MainWindow::isAngulagramAvailable() const {
 
 void MainWindow::onNew() {
     /* If the document has changed the user needs to be asked if to proceed */
+    bool discard = false;
+
     if (document.hasChanged()) {
         QMessageBox::StandardButton ret;
         ret = QMessageBox::question(this, tr("The current document was not saved."),
@@ -559,29 +736,40 @@ void MainWindow::onNew() {
         } else if (ret == QMessageBox::Abort) {
             return;
         }
+
+        discard = (ret == QMessageBox::No);
     }
 
     /* Create an empty document, override the old one, reset the view, notify everyone */
+    finishSaving();
+    closeJournal(discard || !document.hasChanged());
+    cancelImageLoading();
     imageView.resetView();    
     angulagramView.resetView();
     changeToView(viewPages::image);
 
+    TopinoData::uncacheImage(document.getData().getSourceHash());
     document = TopinoDocument();
+    applyFileOptions(document);
     document.addObserver(this);
     document.addObserver(&imageView);
     document.addObserver(&angulagramView);
-    document.notifyAllObserver();
+
+    /* A new document replaces everything shown */
+    document.notifyAllObserver(IObserver::changeAll);
 }
 
 void MainWindow::onOpen() {
-    /* Let the user select a filename and try to open this file as TopinoXML file */
+    /* Let the user select a filename and try to open this file as TopinoXML or binary Topino file */
     QString filename = QFileDialog::getOpenFileName(this, tr("Open file to analyze"), "",
-                       tr("Topino files (*.topxml);;All files (*.*)"));
+                       tr("Topino files (*.topxml *.topino);;All files (*.*)"));
 
     if (filename.length() == 0)
         return;
 
     /* If the document has changed the user needs to be asked if to proceed */
+    bool discard = false;
+
     if (document.hasChanged()) {
         QMessageBox::StandardButton ret;
         ret = QMessageBox::question(this, tr("The current document was not saved."),
@@ -594,34 +782,56 @@ void MainWindow::onOpen() {
         } else if (ret == QMessageBox::Abort) {
             return;
         }
+
+        discard = (ret == QMessageBox::No);
     }
 
+    /* The image is decoded later in the background; everything else is shown right away */
     TopinoDocument newdoc;
-    TopinoDocument::FileError err = newdoc.loadFromXML(filename);
+    applyFileOptions(newdoc);
+    QByteArray encodedImage;
+    TopinoDocument::FileError err = newdoc.load(filename, &encodedImage);
 
     if (err != TopinoDocument::FileError::NoFailure) {
         qDebug("Loading '%s' was not successful. Error = %d.", filename.toStdString().c_str(), int(err));
-        QMessageBox::warning(this, tr("File could not be loaded"),
-                             tr("The processing of the file as TopinoXML was not successful."));
+
+        if (err == TopinoDocument::FileError::ImageNotFound) {
+            QMessageBox::warning(this, tr("File could not be loaded"),
+                                 tr("The image referenced by the file was not found or its content has changed."));
+        } else {
+            QMessageBox::warning(this, tr("File could not be loaded"),
+                                 tr("The processing of the file as Topino file was not successful."));
+        }
 
         return;
     }
 
     /* Only override the open document if loading of the new document was successful; don't forget to reset
      * the view! */
+    finishSaving();
+    closeJournal(discard || !document.hasChanged());
+    cancelImageLoading();
     imageView.resetView();
     angulagramView.resetView();
     changeToView(viewPages::image);
 
+    TopinoData::uncacheImage(document.getData().getSourceHash());
     document = newdoc;
     document.addObserver(this);
     document.addObserver(&imageView);
     document.addObserver(&angulagramView);
-    document.notifyAllObserver();
+
+    /* The opened document replaces everything shown */
+    document.notifyAllObserver(IObserver::changeAll);
 
     /* Create objects from the document and set the document to saved state */
     imageView.createToolsFromDocument();
     document.saveChanges();
+
+    /* Decode and/or process the image */
+    if (!encodedImage.isEmpty() || !document.getData().getImage().isNull()) {
+        startImageLoading(encodedImage, QString(), false);
+    }
 }
 
 void MainWindow::onSave() {
@@ -631,41 +841,75 @@ void MainWindow::onSave() {
         return;
     }
 
-    /* Save and notify everyone */
-    document.saveToXML();
-    document.notifyAllObserver();
+    startSaving();
 }
 
 void MainWindow::onSaveAs() {
+    /* TopinoXML or binary files; for the latter, the filter selects the codec of the image */
+    QStringList filters;
+    filters.append(tr("Topino files (*.topxml)"));
+    for (int i = 0; i < TopinoDocument::imageCodecs::codecCOUNT; ++i) {
+        filters.append(tr("Binary Topino files, %1 (*.topino)").arg(
+                           tr(TopinoDocument::getImageCodecName(TopinoDocument::imageCodecs(i))).toLower()));
+    }
+    filters.append(tr("All files (*.*)"));
+
+    QString selectedFilter = TopinoDocument::isBinaryFileName(document.getFilename()) ?
+                             filters[1 + document.getImageCodec()] : filters[0];
     QString filename = QFileDialog::getSaveFileName(this, tr("Save file and analysis"), document.getFilename(),
-                       tr("Topino files (*.topxml);;All files (*.*)"));
+                       filters.join(";;"), &selectedFilter);
 
     if (filename.length() == 0)
         return;
 
-    /* Save and notify everyone */
+    int codec = filters.indexOf(selectedFilter) - 1;
+    if ((codec >= 0) && (codec < TopinoDocument::imageCodecs::codecCOUNT)) {
+        document.setImageCodec(TopinoDocument::imageCodecs(codec));
+    }
+
+    /* The dialog does not add the suffix of the filter, but the suffix decides the format */
+    QString suffix = QFileInfo(filename).suffix().toLower();
+
+    if ((codec >= 0) && (codec < TopinoDocument::imageCodecs::codecCOUNT) && (suffix != "topino")) {
+        filename += ".topino";
+    } else if ((codec < 0) && suffix.isEmpty()) {
+        filename += ".topxml";
+    }
+
     document.setFullFilename(filename);
-    document.saveToXML();
-    document.notifyAllObserver();
+    startSaving();
 }
 
 void MainWindow::onImportImage() {
     QString filename = QFileDialog::getOpenFileName(this, tr("Open file to analyze"), "",
                        tr("Image files/CFE image files (*.png *.jpg *.FFE.png *.CFE.png "
-                          "*.bmp *.gif *.jpeg *.tga *.tiff *.pbm *.pgm *.ppm *.xbm "
-                          "*.xpm);;All files (*.*)"));
+                          "*.bmp *.gif *.jpeg *.tga *.tiff *.pbm *.pgm *.ppm *.pnm *.pfm *.xbm "
+                          "*.xpm);;Raw frames (*.raw *.bin);;All files (*.*)"));
 
     if (filename.length() == 0)
         return;
 
-    /* Try to load it, if it does not success abort the whole process */
-    QImage img(filename);
+    /* Raw frames have no header, so the user has to give their layout */
+    MappedImageReader::RawFormat format;
 
-    if (img.isNull()) {
-        QMessageBox::critical(this, tr("Failed to load image file"), tr("The image file could not be loaded."));        
-        return;
+    if (MappedImageReader::isRawFrame(filename)) {
+        RawImageDialog dlg(QFileInfo(filename).size(), this);
+        dlg.setFormat(rawFormat);
+
+        if (dlg.exec() != QDialog::DialogCode::Accepted)
+            return;
+
+        rawFormat = dlg.getFormat();
+        format = rawFormat;
     }
 
+    /* The image is loaded in the background and imported when finished; the preview is shown in
+     * the image view */
+    changeToView(viewPages::image);
+    startImageLoading(QByteArray(), filename, true, format);
+}
+
+void MainWindow::importImage(const QImage& img, const QString& file, const QByteArray& hash) {
     /* Check if the new image dimensions are the same as the old ones (but only if another image is
      * loaded of course!) - if not, we have to reset the view (remove all inlets, etc.) to avoid
      * some glitches. */
@@ -678,12 +922,15 @@ void MainWindow::onImportImage() {
         changeToView(viewPages::image);
     }
 
-    /* Modify data */
-    TopinoData data;
-    document.getData(data);
-    data.setImage(img);
-    document.setData(data);
-    document.notifyAllObserver();
+    /* Modify data; a new image resets the processing, too. The old image is not needed anymore. */
+    if (document.getData().getSourceHash() != hash) {
+        TopinoData::uncacheImage(document.getData().getSourceHash());
+    }
+
+    document.edit([&img, &file, &hash](TopinoData& data) {
+        data.setImage(img);
+        data.setSourceFile(file, hash);
+    }, IObserver::changeImage | IObserver::changeProcessing);
 
     /* Change to default view */
     changeToView(viewPages::image);
@@ -694,6 +941,85 @@ void MainWindow::onQuit() {
     this->close();
 }
 
+void MainWindow::onStoreResults(bool checked) {
+    document.setStoreResults(checked);
+}
+
+void MainWindow::onReferenceImage(bool checked) {
+    document.setReferenceImage(checked);
+}
+
+void MainWindow::onImageStore(bool checked) {
+    document.setImageStore(checked ? getImageStorePath() : QString());
+}
+
+void MainWindow::onCropImage(bool checked) {
+    document.setCropImage(checked);
+}
+
+QString MainWindow::getImageStorePath() const {
+    return QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation) + "/images";
+}
+
+void MainWindow::onResultStore(bool checked) {
+#ifdef TOPINO_RESULT_STORE
+    /* Opening the store right away tells the user if it is not available */
+    if (checked && !openResultStore()) {
+        QMessageBox::warning(this, tr("Result store not available"),
+                             tr("The result store could not be opened. Saved documents are not indexed."));
+        ui->action_result_store->setChecked(false);
+    }
+#else
+    Q_UNUSED(checked);
+#endif
+}
+
+void MainWindow::onQueryResults() {
+#ifdef TOPINO_RESULT_STORE
+    if (!openResultStore()) {
+        QMessageBox::warning(this, tr("Result store not available"), tr("The result store could not be opened."));
+        return;
+    }
+
+    ResultStoreDialog dlg(resultStore, this);
+    dlg.exec();
+#endif
+}
+
+#ifdef TOPINO_RESULT_STORE
+QString MainWindow::getResultStorePath() const {
+    return QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation) + "/results.sqlite";
+}
+
+bool MainWindow::openResultStore() {
+    return resultStore.isOpen() || resultStore.open(getResultStorePath());
+}
+#endif
+
+void MainWindow::applyFileOptions(TopinoDocument& doc) const {
+    doc.setStoreResults(ui->action_store_results->isChecked());
+    doc.setReferenceImage(ui->action_reference_image->isChecked());
+    doc.setImageStore(ui->action_image_store->isChecked() ? getImageStorePath() : QString());
+    doc.setCropImage(ui->action_crop_image->isChecked());
+}
+
+void MainWindow::onUndo() {
+    int changes = document.undo();
+
+    /* The inlet tools are the source of inlet changes and do not follow the document by themselves */
+    if (changes & (IObserver::changeInlets | IObserver::changeGeometry)) {
+        imageView.recreateInletTools();
+    }
+}
+
+void MainWindow::onRedo() {
+    int changes = document.redo();
+
+    if (changes & (IObserver::changeInlets | IObserver::changeGeometry)) {
+        imageView.recreateInletTools();
+    }
+}
+
 void MainWindow::onCut() {
     getCurrentView()->cut(QGuiApplication::clipboard());
 }
@@ -763,22 +1089,628 @@ void MainWindow::onToolAngulagram() {
     qDebug("Angulagram");
     changeToView(viewPages::angulagram);
 
+    /* If the angulagram is calculated in the background, check it when it is finished */
+    if (angulagramWatcher.isRunning()) {
+        angulagramCheckPending = true;
+        return;
+    }
+
+    checkAngulagramBackground();
+}
+
+void MainWindow::startAngulagramCalculation() {
+    /* Abort a running calculation; its result would be outdated anyway */
+    cancelAngulagramCalculation();
+
+    /* Each calculation gets its own cancel flag, so that an aborted calculation still running in the
+     * background does not see the flag of the new one */
+    QSharedPointer<QAtomicInt> canceled(new QAtomicInt(0));
+    angulagramCanceled = canceled;
+    angulagramJobKey = document.getData().calculateStageKey(TopinoData::stagePolar);
+
+    angulagramProgress->setValue(0);
+    angulagramProgress->setVisible(true);
+    angulagramCancelButton->setVisible(true);
+    ui->statusBar->showMessage(tr("Calculating angulagram..."));
+
+    /* The calculation works on a copy of the data; the progress is sent to the progress bar via
+     * the event loop (only if it changed) */
+    TopinoData data = document.getData();
+    QProgressBar *progressBar = angulagramProgress;
+
+    angulagramWatcher.setFuture(QtConcurrent::run([data, canceled, progressBar]() mutable {
+        int lastPercent = -1;
+
+        data.updateStage(TopinoData::stageAngulagram, [canceled, progressBar, &lastPercent](int percent) {
+            if (percent != lastPercent) {
+                QMetaObject::invokeMethod(progressBar, "setValue", Qt::QueuedConnection, Q_ARG(int, percent));
+                lastPercent = percent;
+            }
+
+            return canceled->load() == 0;
+        });
+
+        return data;
+    }));
+}
+
+void MainWindow::cancelAngulagramCalculation() {
+    if (angulagramCanceled) {
+        angulagramCanceled->store(1);
+    }
+
+    angulagramProgress->setVisible(false);
+    angulagramCancelButton->setVisible(false);
+    ui->statusBar->clearMessage();
+}
+
+void MainWindow::onCancelAngulagramCalculation() {
+    cancelAngulagramCalculation();
+    angulagramCheckPending = false;
+    ui->statusBar->showMessage(tr("Calculation of angulagram canceled."), 3000);
+}
+
+void MainWindow::onAngulagramCalculated() {
+    /* Canceled calculations are simply dropped */
+    if (angulagramCanceled.isNull() || (angulagramCanceled->load() != 0)) {
+        return;
+    }
+
+    angulagramCanceled.clear();
+    angulagramProgress->setVisible(false);
+    angulagramCancelButton->setVisible(false);
+    ui->statusBar->clearMessage();
+
+    /* Publish the results to the document in one step; only stages that still fit the parameters are
+     * taken over. If the angulagram itself does not fit anymore, calculate again. */
+    TopinoData result = angulagramWatcher.result();
+
+    if (!document.takeStageResults(result, IObserver::changeProcessing | IObserver::changeAngulagram)) {
+        qDebug("Angulagram calculation is outdated.");
+
+        if (getCurrentViewIndex() == viewPages::angulagram) {
+            startAngulagramCalculation();
+        }
+
+        return;
+    }
+
+    if (angulagramCheckPending) {
+        angulagramCheckPending = false;
+        checkAngulagramBackground();
+    }
+}
+
+void MainWindow::startBootstrapCalculation(const QVector<QPointF>& points, const QVector<TopinoTools::Section>& sections,
+        const QVector<TopinoTools::Lorentzian>& fits) {
+    /* A running calculation is not waited for; its results do not fit the new streams anyway */
+    ui->statusBar->showMessage(tr("Estimating confidence intervals..."));
+
+    bootstrapWatcher.setFuture(QtConcurrent::run([points, sections, fits]() mutable {
+        TopinoTools::calculateBootstrap(points, sections, fits);
+        return fits;
+    }));
+}
+
+void MainWindow::onBootstrapCalculated() {
+    ui->statusBar->clearMessage();
+
+    QVector<TopinoTools::Lorentzian> fits = bootstrapWatcher.result();
+
+    for(int i = 0; i < fits.length(); ++i) {
+        qDebug("Lorentzian %2d: pos %.1f [%.1f, %.1f], width %.1f [%.1f, %.1f]", i+1,
+               fits[i].pos, fits[i].posCI.lower, fits[i].posCI.upper,
+               fits[i].width, fits[i].widthCI.lower, fits[i].widthCI.upper);
+    }
+
+    if (!document.takeConfidenceIntervals(fits)) {
+        qDebug("Confidence intervals are outdated.");
+    }
+}
+
+void MainWindow::startSaving() {
+    /* Only one save at a time; the image of an opened document has to be loaded before saving */
+    if (saveRunning || (imageLoadPending && !imageImporting)) {
+        savePending = true;
+        return;
+    }
+
+    saveRunning = true;
+    savePending = false;
+    savedRevision = document.getRevision();
+    saveProgress->setVisible(true);
+    ui->statusBar->showMessage(tr("Saving %1...").arg(document.getFilename()));
+
+    /* The file to replace might still be mapped by the images of the document */
+    document.releaseMappedFile(QDir(document.getPath()).absoluteFilePath(document.getFilename()));
+    TopinoDocument snapshot = document.createSnapshot();
+
+    saveWatcher.setFuture(QtConcurrent::run([snapshot]() mutable {
+        TopinoDocument::FileError err = snapshot.save();
+        return qMakePair(err, snapshot);
+    }));
+}
+
+void MainWindow::finishSaving() {
+    /* A save waiting for the image of the document has to wait for the image first */
+    if (savePending && imageLoadPending) {
+        imageWatcher.waitForFinished();
+        onImageLoaded();
+    }
+
+    while (saveRunning) {
+        saveWatcher.waitForFinished();
+        onDocumentSaved();
+    }
+}
+
+void MainWindow::onDocumentSaved() {
+    /* Might have been handled by finishSaving already */
+    if (!saveRunning) {
+        return;
+    }
+
+    saveRunning = false;
+    saveProgress->setVisible(false);
+    ui->statusBar->clearMessage();
+
+    TopinoDocument::FileError err = saveWatcher.result().first;
+
+    if (err == TopinoDocument::FileError::FileInUse) {
+        qDebug("Saving '%s' was not successful. File is still mapped.", document.getFilename().toStdString().c_str());
+        QMessageBox::warning(this, tr("File could not be saved"),
+                             tr("The file is still in use by the image read from it and could not be replaced. "
+                                "Please save the document under another name."));
+        savePending = false;
+
+        return;
+    }
+
+    if (err != TopinoDocument::FileError::NoFailure) {
+        qDebug("Saving '%s' was not successful. Error = %d.", document.getFilename().toStdString().c_str(), int(err));
+        QMessageBox::warning(this, tr("File could not be saved"),
+                             tr("The file could not be saved. The previous version of the file is unchanged."));
+        savePending = false;
+
+        return;
+    }
+
+    /* The image stored while saving is referenced by the next save, too */
+    TopinoDocument saved = saveWatcher.result().second;
+    document.takeImageReference(saved);
+
+    /* The saved snapshot is indexed, even if the document changed in the meantime; the parameters are
+     * small, so this is quick */
+#ifdef TOPINO_RESULT_STORE
+    if (ui->action_result_store->isChecked() && openResultStore()) {
+        resultStore.indexDocument(saved);
+    }
+#endif
+
+    /* Changes made during saving are not in the file */
+    if (document.getRevision() == savedRevision) {
+        document.saveChanges();
+        closeJournal(true);
+    } else if (journalStarted) {
+        /* The journal belongs to the replaced file; a new one is started for the saved file */
+        closeJournal(true);
+        journalDirty = true;
+        journalTimer.start();
+    }
+    document.notifyAllObserver(IObserver::changeFile);
+    ui->statusBar->showMessage(tr("File saved."), 3000);
+
+    if (savePending) {
+        startSaving();
+    }
+}
+
+void MainWindow::onJournalTimer() {
+    /* Records are written one after another; the image of an opened document has to be loaded first */
+    if (journalWatcher.isRunning() || (imageLoadPending && !imageImporting)) {
+        journalTimer.start();
+        return;
+    }
+
+    /* Nothing to record if the document was saved in the meantime */
+    if (!journalDirty || !document.hasChanged()) {
+        return;
+    }
+
+    /* The journal moves with the document (e.g. after "save as") */
+    QString file = getJournalFilename();
+    if (file != journalFile) {
+        closeJournal(true);
+        journalFile = file;
+    }
+
+    journalDirty = false;
+    bool start = !journalStarted;
+
+    if (start) {
+        QDir().mkpath(QFileInfo(file).absolutePath());
+
+        /* Another Topino journaling the same document keeps its journal; this one is not journaled
+         * until the journal is free again (with the next change) */
+        journalLock.reset(new QLockFile(file + ".lock"));
+
+        if (!journalLock->tryLock(0)) {
+            qDebug("Journal '%s' is in use by another instance. Journaling stopped.", file.toStdString().c_str());
+            journalLock.clear();
+            journalFile.clear();
+            return;
+        }
+
+        journalStarted = true;
+
+        QStringList journals = readJournalIndex();
+        if (!journals.contains(file)) {
+            journals.append(file);
+            writeJournalIndex(journals);
+        }
+    }
+
+    /* The snapshot shares the image, so this is cheap; a new journal writes the image once */
+    TopinoDocument snapshot = document.createSnapshot();
+
+    journalWatcher.setFuture(QtConcurrent::run([snapshot, file, start]() mutable {
+        return start ? snapshot.startJournal(file) : snapshot.appendJournal(file);
+    }));
+}
+
+void MainWindow::onJournalWritten() {
+    /* A failed journal is started again with the next change */
+    if (journalWatcher.result() != TopinoDocument::FileError::NoFailure) {
+        qDebug("Writing the journal '%s' was not successful.", journalFile.toStdString().c_str());
+        journalStarted = false;
+    }
+}
+
+void MainWindow::onRecoverJournals() {
+    QStringList journals = readJournalIndex();
+
+    for (auto it = journals.constBegin(); it != journals.constEnd(); ++it) {
+        /* Journals in use by another Topino are locked; the lock of a crashed Topino is stale */
+        QLockFile lock(*it + ".lock");
+
+        if (QFileInfo::exists(*it) && !lock.tryLock(0)) {
+            continue;
+        }
+
+        QStringList index = readJournalIndex();
+        index.removeAll(*it);
+        writeJournalIndex(index);
+
+        if (!QFileInfo::exists(*it)) {
+            continue;
+        }
+
+        QMessageBox::StandardButton ret;
+        ret = QMessageBox::question(this, tr("Topino was not closed properly."),
+                                    tr("Do you want to recover the unsaved changes from %1?").arg(QDir::toNativeSeparators(*it)),
+                                    QMessageBox::StandardButtons(QMessageBox::Yes | QMessageBox::No));
+
+        TopinoDocument newdoc;
+        TopinoDocument::FileError err = TopinoDocument::FileError::UnknownError;
+
+        if (ret == QMessageBox::Yes) {
+            applyFileOptions(newdoc);
+            err = newdoc.loadFromJournal(*it);
+
+            if (err != TopinoDocument::FileError::NoFailure) {
+                qDebug("Recovering '%s' was not successful. Error = %d.", it->toStdString().c_str(), int(err));
+                if (err == TopinoDocument::FileError::ImageNotFound) {
+                    QMessageBox::warning(this, tr("Changes could not be recovered"),
+                                         tr("The document was changed after the changes were recorded."));
+                } else {
+                    QMessageBox::warning(this, tr("Changes could not be recovered"),
+                                         tr("The journal or the document it belongs to could not be loaded."));
+                }
+            }
+        }
+
+        QFile::remove(*it);
+
+        if (err != TopinoDocument::FileError::NoFailure) {
+            continue;
+        }
+
+        /* The recovered document is not saved; it gets a new journal with the next record */
+        cancelImageLoading();
+        imageView.resetView();
+        angulagramView.resetView();
+        changeToView(viewPages::image);
+
+        TopinoData::uncacheImage(document.getData().getSourceHash());
+        document = newdoc;
+        document.addObserver(this);
+        document.addObserver(&imageView);
+        document.addObserver(&angulagramView);
+
+        /* The recovered document replaces everything shown */
+        document.notifyAllObserver(IObserver::changeAll);
+        imageView.createToolsFromDocument();
+
+        journalDirty = true;
+        journalTimer.start();
+
+        /* Only one document can be open; other journals are offered at the next start */
+        break;
+    }
+}
+
+QString MainWindow::getJournalFilename() const {
+    /* Next to the document; unnamed documents are journaled in the application data */
+    if (document.hasFileName()) {
+        return QDir(document.getPath()).absoluteFilePath(document.getFilename() + ".topjournal");
+    }
+
+    return QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation) +
+           QString("/journals/unnamed-%1.topjournal").arg(QCoreApplication::applicationPid());
+}
+
+void MainWindow::closeJournal(bool remove) {
+    journalTimer.stop();
+    journalWatcher.waitForFinished();
+
+    if (remove && !journalFile.isEmpty()) {
+        QFile::remove(journalFile);
+
+        QStringList journals = readJournalIndex();
+        journals.removeAll(journalFile);
+        writeJournalIndex(journals);
+    }
+
+    journalLock.clear();
+    journalFile.clear();
+    journalStarted = false;
+    journalDirty = false;
+}
+
+QString MainWindow::getJournalIndexFilename() const {
+    return QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation) + "/journals.txt";
+}
+
+QStringList MainWindow::readJournalIndex() const {
+    /* One journal file per line */
+    QFile f(getJournalIndexFilename());
+
+    if (!f.open(QFile::ReadOnly | QFile::Text)) {
+        return QStringList();
+    }
+
+    return QString::fromUtf8(f.readAll()).split('\n', QString::SkipEmptyParts);
+}
+
+void MainWindow::writeJournalIndex(const QStringList& journals) const {
+    QString indexFile = getJournalIndexFilename();
+
+    if (journals.isEmpty()) {
+        QFile::remove(indexFile);
+        return;
+    }
+
+    QDir().mkpath(QFileInfo(indexFile).absolutePath());
+    QSaveFile f(indexFile);
+
+    if (f.open(QFile::WriteOnly | QFile::Text)) {
+        f.write(journals.join('\n').toUtf8());
+        f.write("\n");
+        f.commit();
+    }
+}
+
+void MainWindow::startImageLoading(const QByteArray& encodedImage, const QString& imageFilename, bool importing,
+                                   const MappedImageReader::RawFormat& rawFormat) {
+    /* A running load is simply dropped when finished */
+    int loadID = ++imageLoadID;
+    imageLoadPending = true;
+    imageImporting = importing;
+    ui->statusBar->showMessage(tr("Loading image..."));
+
+    /* The image is decoded from the encoded data or the file; images that are already decoded (e.g. raw
+     * images of binary files) only need to be processed. Imported images are not processed, since a new
+     * image resets the processing anyway. */
+    TopinoData data = document.getData();
+    MainWindow *window = this;
+
+    imageWatcher.setFuture(QtConcurrent::run([data, encodedImage, imageFilename, importing, rawFormat, loadID, window]() mutable {
+        /* Uncompressed frames are mapped instead of decoded. Raw frames have no header that a reference could
+         * rely on, so they are imported without file (i.e. they are embedded when saved). */
+        QByteArray hash = data.getSourceHash();
+        QImage image;
+        bool mapped = false;
+
+        if (!imageFilename.isEmpty() && rawFormat.isValid()) {
+            image = MappedImageReader::readRaw(imageFilename, rawFormat);
+            hash.clear();
+            mapped = true;
+        } else if (!imageFilename.isEmpty() && MappedImageReader::canRead(imageFilename)) {
+            image = MappedImageReader::read(imageFilename, &hash);
+            mapped = !image.isNull();
+
+            if (mapped) {
+                TopinoData::cacheImage(hash, image);
+            }
+        }
+
+        /* Other imported files are read completely, since the hash of their content is needed anyway
+         * (documents can reference the file by it) */
+        if (!imageFilename.isEmpty() && !mapped) {
+            QFile file(imageFilename);
+
+            if (file.open(QIODevice::ReadOnly)) {
+                encodedImage = file.readAll();
+            }
+
+            hash = TopinoData::calculateContentHash(encodedImage);
+        }
+
+        /* Images used by another document of the session are already decoded */
+        if (image.isNull() && !hash.isEmpty() && !encodedImage.isEmpty()) {
+            image = TopinoData::findCachedImage(hash);
+        }
+
+        if (image.isNull() && !encodedImage.isEmpty()) {
+            QBuffer buffer(&encodedImage);
+            buffer.open(QIODevice::ReadOnly);
+            QImageReader reader;
+
+            auto openReader = [&buffer, &reader, &imageFilename]() {
+                buffer.seek(0);
+                reader.setDevice(&buffer);
+
+                /* The suffix is a hint for formats that cannot be detected by their content */
+                if (!imageFilename.isEmpty()) {
+                    reader.setFormat(QFileInfo(imageFilename).suffix().toLower().toLatin1());
+                }
+            };
+
+            /* Large images: decode a scaled preview first, if the format supports it (e.g. JPEG can do this
+             * much faster than decoding the full image); the reader has to start again afterwards */
+            const int previewSize = 1024;
+
+            openReader();
+            QSize size = reader.size();
+
+            if (size.isValid() && (qMax(size.width(), size.height()) > previewSize) &&
+                    reader.supportsOption(QImageIOHandler::ScaledSize)) {
+                reader.setScaledSize(size.scaled(previewSize, previewSize, Qt::KeepAspectRatio));
+                QImage preview = reader.read();
+
+                if (!preview.isNull()) {
+                    QMetaObject::invokeMethod(window, "onImagePreviewLoaded", Qt::QueuedConnection,
+                                              Q_ARG(QImage, preview), Q_ARG(QSize, size), Q_ARG(int, loadID));
+                }
+
+                openReader();
+                reader.setScaledSize(QSize());
+            }
+
+            image = reader.read();
+
+            if (image.isNull()) {
+                qDebug("Image could not be decoded: %s", reader.errorString().toStdString().c_str());
+                data.setImage(QImage());
+                return data;
+            }
+
+            TopinoData::cacheImage(hash, image);
+        }
+
+        if (!image.isNull()) {
+            data.setImage(image);
+
+            if (!imageFilename.isEmpty() && !rawFormat.isValid()) {
+                data.setSourceFile(imageFilename, hash);
+            }
+        } else if (!imageFilename.isEmpty()) {
+            qDebug("Image file %s could not be read.", imageFilename.toStdString().c_str());
+            data.setImage(QImage());
+            return data;
+        }
+
+        if (!importing) {
+            data.processImage();
+        }
+
+        return data;
+    }));
+}
+
+void MainWindow::cancelImageLoading() {
+    if (imageLoadPending) {
+        imageLoadPending = false;
+        ui->statusBar->clearMessage();
+    }
+}
+
+void MainWindow::onImagePreviewLoaded(const QImage& preview, const QSize& size, int loadID) {
+    /* The preview is only of interest until the full image is there */
+    if (!imageLoadPending || (loadID != imageLoadID)) {
+        return;
+    }
+
+    imageView.setImage(preview, size);
+}
+
+void MainWindow::onImageLoaded() {
+    /* Canceled loads are simply dropped */
+    if (!imageLoadPending) {
+        return;
+    }
+
+    imageLoadPending = false;
+    ui->statusBar->clearMessage();
+
+    TopinoData result = imageWatcher.result();
+
+    if (result.getImage().isNull()) {
+        QMessageBox::critical(this, tr("Failed to load image file"), tr("The image file could not be loaded."));
+
+        /* Show the image of the document again instead of the preview */
+        imageView.modelHasChanged(IObserver::changeImage | IObserver::changeProcessing);
+        return;
+    }
+
+    if (imageImporting) {
+        importImage(result.getImage(), result.getSourceFile(), result.getSourceHash());
+        return;
+    }
+
+    /* Publish the image of the opened document; the processed image is taken over if the processing
+     * parameters did not change in the meantime. Loading the image does not change the document. */
+    document.takeLoadedImage(result);
+
+    /* Saving waits for the image */
+    if (savePending) {
+        startSaving();
+    }
+}
+
+void MainWindow::updateAngulagramPreview(const TopinoData::PolarGeometry& geometry) {
+    /* The observers are notified before the preview is created */
+    if (angulagramPreview == nullptr) {
+        return;
+    }
+
+    /* Nothing to preview without main inlet or image; also skip the calculation if nobody sees it */
+    if ((document.getData().getMainInletID() == 0) || document.getData().getProcessedImage().isNull()) {
+        angulagramPreview->clearPreview();
+        return;
+    }
+
+    if (!dockAngulagramPreview->isVisible()) {
+        return;
+    }
+
+    angulagramPreview->requestPreview(document.getData().getProcessedImage(), geometry);
+}
+
+void MainWindow::onAngulagramPreviewVisibilityChanged(bool visible) {
+    /* Requests are skipped while the preview is hidden, so catch up */
+    if (visible) {
+        updateAngulagramPreview(document.getData().getPolarGeometry());
+    }
+}
+
+void MainWindow::checkAngulagramBackground() {
     /* Calculate the integral of the angulagram points and see if it is above
      * 80% of the integral of (maxAngle-minAngle) × maxIntensity. If yes, this
      * means that the user probably did NOT prepare the image before proceeding. */
-    QVector<QPointF> dataPoints = document.getData().getAngulagramPoints();
+    TopinoTools::SampledSignal angulagram = document.getData().getAngulagram();
 
-    if (dataPoints.length() == 0)
+    if (angulagram.length() == 0)
         return;
 
     /* Integral and maximum of data points */
     qreal int_datapoints = 0.0;
     qreal maximum = 0.0;
-    for(auto it = dataPoints.begin(); it != dataPoints.end(); ++it) {
-        int_datapoints += it->y();
+    for(auto it = angulagram.values.constBegin(); it != angulagram.values.constEnd(); ++it) {
+        int_datapoints += *it;
 
-        if (it->y() > maximum)
-            maximum = it->y();
+        if (*it > maximum)
+            maximum = *it;
     }
 
     /* Divide by 10 because dataPoints are divided in 0.1° steps not 1.0° */
@@ -788,8 +1720,8 @@ void MainWindow::onToolAngulagram() {
     qDebug("Integral datapoints: %.2f", int_datapoints);
 
     /* Integral of integral of (maxAngle-minAngle) × maxIntensity */
-    qreal int_rectangle = (dataPoints.last().x() - dataPoints.first().x()) * maximum;
-    qDebug("Integral rectangle: %.2f (x1: %.2f, x2: %.2f)", int_rectangle, dataPoints.first().x(), dataPoints.last().x());
+    qreal int_rectangle = (angulagram.x(angulagram.length() - 1) - angulagram.x(0)) * maximum;
+    qDebug("Integral rectangle: %.2f (x1: %.2f, x2: %.2f)", int_rectangle, angulagram.x(0), angulagram.x(angulagram.length() - 1));
 
     if (int_rectangle == 0.0)
         return;
@@ -815,8 +1747,8 @@ void MainWindow::onToolEditImage() {
     if (!isImageAvailable())
         return;
 
-    /* Copy data */
-    TopinoData data = document.getData();
+    /* The data is only read here; changes are applied in place below */
+    const TopinoData& data = document.getData();
 
     /* Open the image editing/preparing dialog to adjust saturation, levels, etc. before
      * analysis */
@@ -848,16 +1780,15 @@ void MainWindow::onToolEditImage() {
         qDebug("Image edit: desaturation mode %d", dlg.getDesaturationMode());
         qDebug("Image edit: min %d max %d", dlg.getLevelMin(), dlg.getLevelMax());
 
-        /* Process the image */
-        data.setInversion(dlg.getInvert());
-        data.setDesatMode(dlg.getDesaturationMode());
-        data.setLevelMin(dlg.getLevelMin());
-        data.setLevelMax(dlg.getLevelMax());
-        data.processImage();
-
-        /* Write back the data; set the view to show the processed image */
+        /* Process the image in place; set the view to show the processed image */
         imageView.showSourceImage(false);
-        document.setData(data);
+        document.edit([&dlg](TopinoData& data) {
+            data.setInversion(dlg.getInvert());
+            data.setDesatMode(dlg.getDesaturationMode());
+            data.setLevelMin(dlg.getLevelMin());
+            data.setLevelMax(dlg.getLevelMax());
+            data.processImage();
+        }, IObserver::changeProcessing);
 
         /* Update the image page */
         updateImagePage();
@@ -878,15 +1809,11 @@ void MainWindow::onToolResetImage() {
     if (!isImageAvailable())
         return;
 
-    /* Copy data */
-    TopinoData data = document.getData();
-
-    /* Reset processed image back to source image */
-    data.resetProcessing();
-
-    /* Write back the data; set the view to show the source image */
+    /* Reset processed image back to source image; set the view to show the source image */
     imageView.showSourceImage(true);
-    document.setData(data);
+    document.edit([](TopinoData& data) {
+        data.resetProcessing();
+    }, IObserver::changeProcessing);
 
     /* Update the image page */
     updateImagePage();
@@ -1215,26 +2142,26 @@ void MainWindow::onToolSetMainInlet() {
     if (inlet == nullptr)
         return;
 
-    /* Get data */
-    TopinoData data = document.getData();
-
     /* Is there a main inlet already defined? In this case, we need to
      * hide its segments drawing (i.e. the coordinate system). However,
      * we save the segments + diff angle and transfer it to the new one. */
     int diffangle = 0;
     int segments = 0;
-    if (data.getMainInletID() > 0) {
+    if (document.getData().getMainInletID() > 0) {
         imageView.getMainInletTool()->showSegments(false);
         diffangle = imageView.getMainInletTool()->getDiffAngle();
         segments = imageView.getMainInletTool()->getSegments();
     }
 
     /* Change new item id in data */
-    data.setMainInletID(inlet->getItemid());
-    document.setData(data);
+    int ID = inlet->getItemid();
+    document.edit([ID](TopinoData& data) {
+        data.setMainInletID(ID);
+    }, IObserver::changeGeometry);
 
     /* Set main inlet ID to the ID of the currently selected inlet. Also
      * transfer data to new main inlet */
+    const TopinoData& data = document.getData();
     inlet->showSegments(true);
     inlet->setZeroAngle(data.getCoordNeutralAngle());
     inlet->setMinAngle(data.getCoordMinAngle());
@@ -1405,8 +2332,14 @@ void MainWindow::onToolEvaluateAngulagram() {
     /* Opens the evaluation dialog for processing and setting parameters */
     EvalAngulagramDialog dlg(this);
 
-    /* Set data values and some options */
-    dlg.setDataPoints(document.getData().getAngulagramPoints());
+    /* Set data values and some options; stored fits are used as starting values for the new fits */
+    QVector<TopinoTools::Lorentzian> streams = document.getData().getStreamParameters();
+    if (!streams.isEmpty()) {
+        dlg.setPeakModel(streams.first().model);
+    }
+    dlg.setInitialLorentzians(streams);
+    dlg.setBaselineParameters(document.getData().getStreamBaseline());
+    dlg.setDataPoints(document.getData().getAngulagram());
     dlg.setOrientationRTL(document.getData().getCoordCounterClockwise());
     dlg.setAngularRange(QPair<int, int>(document.getData().getCoordMinAngle(), document.getData().getCoordMaxAngle()));
 
@@ -1415,12 +2348,16 @@ void MainWindow::onToolEvaluateAngulagram() {
         qDebug("Fitting accepted");
 
         /* Save the fits found as stream parameters in data. */
-        TopinoData data = document.getData();
-        data.setStreamParameters(dlg.getLorentzians());
-        document.setData(data);
+        document.edit([&dlg](TopinoData& data) {
+            data.setStreamParameters(dlg.getLorentzians());
+            data.setStreamBaseline(dlg.getBaseline());
+        }, IObserver::changeStreams);
 
         updateObjectPage(angulagramProps);
         getCurrentView()->viewport()->update();
+
+        /* Estimate the confidence intervals of the fits in the background (takes a moment) */
+        startBootstrapCalculation(dlg.getCorrectedDataPoints(), dlg.getSections(), dlg.getLorentzians());
     }
 }
 
@@ -1491,22 +2428,47 @@ void MainWindow::onToolExportAngulagramData() {
 
     /* Remove the extension if it exists and add a new one */
     filename.replace(".topxml", "", Qt::CaseInsensitive);
+    filename.replace(".topino", "", Qt::CaseInsensitive);
     filename += ".txt";
 
+    /* The data table as text or each data set as NumPy or raw float32 array */
+    QStringList filters;
+    filters.append(tr("Text files (*.txt)"));
+    for (int i = 0; i < TopinoDocument::exportDataSets::exportCOUNT; ++i) {
+        QString name = tr(TopinoDocument::getExportDataSetName(TopinoDocument::exportDataSets(i)));
+        filters.append(tr("%1, NumPy array (*.npy)").arg(name));
+        filters.append(tr("%1, raw float32 array (*.f32)").arg(name));
+    }
+    filters.append(tr("All files (*.*)"));
+
+    QString selectedFilter = filters[0];
     filename = QFileDialog::getSaveFileName(this, tr("Export angulagram data"), filename,
-                                            tr("Text files (*.txt);;All files (*.*)"));
+                                            filters.join(";;"), &selectedFilter);
 
     if (filename.length() == 0)
         return;
 
-    document.exportDataToText(filename);
+    int index = filters.indexOf(selectedFilter) - 1;
+    if ((index < 0) || (index >= 2 * TopinoDocument::exportDataSets::exportCOUNT)) {
+        document.exportDataToText(filename);
+        return;
+    }
+
+    if (!document.exportDataToBinary(filename, TopinoDocument::exportDataSets(index / 2), (index % 2) == 0)) {
+        QMessageBox::warning(this, tr("Data could not be exported"),
+                             tr("The data set is not available or the file could not be written."));
+    }
 }
 
 void MainWindow::onToolShowPolarImage() {
     qDebug("Show polar image");
 
+    /* The polar image might not be calculated yet (e.g. if the angulagram was stored in the document) */
+    TopinoData data = document.getData();
+    data.updateStage(TopinoData::stagePolar);
+
     /* Only works if there is a polar image available. */
-    if (document.getData().getPolarImage().isNull() || (document.getData().getMainInletID() == 0)) {
+    if (data.getPolarImage().isNull() || (data.getMainInletID() == 0)) {
         QMessageBox::information(nullptr, tr("No polar image data available"),
                                  tr("You need to process the image first by creating an inlet with a polar coordinate system before using"
                                     "this function."));
@@ -1516,10 +2478,10 @@ void MainWindow::onToolShowPolarImage() {
     /* Setup the dialog and give it the image data it needs */
     PolarImageDialog dlg(this);
 
-    dlg.setPolarImage(document.getData().getPolarImage());
-    int sign = document.getData().getCoordCounterClockwise() ? -1 : 1;
-    dlg.setAngleRange(QPair<int, int>(sign * qAbs(document.getData().getCoordMinAngle()),
-                                      -1 * sign * qAbs(document.getData().getCoordMaxAngle())));
+    dlg.setPolarImage(data.getPolarImage());
+    int sign = data.getCoordCounterClockwise() ? -1 : 1;
+    dlg.setAngleRange(QPair<int, int>(sign * qAbs(data.getCoordMinAngle()),
+                                      -1 * sign * qAbs(data.getCoordMaxAngle())));
 
     if (dlg.exec() == QDialog::DialogCode::Accepted) {
         qDebug("Accepted (but useless in this case).");
@@ -1529,8 +2491,8 @@ void MainWindow::onToolShowPolarImage() {
 void MainWindow::onToolShowRadialgram() {
     qDebug("Show radialgram");
 
-    /* Only works if there is a polar image available. */
-    if (document.getData().getPolarImage().isNull() || (document.getData().getMainInletID() == 0)) {
+    /* Only works if there is a polar image available (or can be calculated). */
+    if (document.getData().getImage().isNull() || (document.getData().getMainInletID() == 0)) {
         QMessageBox::information(nullptr, tr("No polar image data available"),
                                  tr("You need to process the image first by creating an inlet with a polar coordinate system before using"
                                     "this function."));
@@ -1542,8 +2504,8 @@ void MainWindow::onToolShowRadialgram() {
 
     /* Calculate the radialgram data */
     TopinoData data = document.getData();
-    data.calculateRadialgramPoints();
-    dlg.setDataPoints(data.getRadialgramPoints());
+    data.updateStage(TopinoData::stageRadialgram);
+    dlg.setDataPoints(data.getRadialgram());
 
     if (dlg.exec() == QDialog::DialogCode::Accepted) {
         qDebug("Accepted (but useless in this case).");
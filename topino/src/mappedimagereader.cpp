@@ -0,0 +1,361 @@
+#include "include/mappedimagereader.h"
+
+#include <climits>
+#include <cstring>
+
+#include <QFileInfo>
+#include <QList>
+#include <QRgba64>
+#include <QtEndian>
+
+#include "include/topinodata.h"
+
+/* Cleanup function of images using the mapped file; each image holds a reference to the file */
+static void releaseFileReference(void *info) {
+    delete static_cast<QSharedPointer<QFile> *>(info);
+}
+
+bool MappedImageReader::RawFormat::isValid() const {
+    return (width > 0) && (height > 0) && (bitDepth >= 1) && (bitDepth <= 16) && (offset >= 0) &&
+           ((stride == 0) || (stride >= width * getBytesPerPixel()));
+}
+
+int MappedImageReader::RawFormat::getBytesPerPixel() const {
+    return (bitDepth > 8) ? 2 : 1;
+}
+
+int MappedImageReader::RawFormat::getBytesPerLine() const {
+    return (stride > 0) ? stride : width * getBytesPerPixel();
+}
+
+qint64 MappedImageReader::RawFormat::getFrameSize() const {
+    return qint64(getBytesPerLine()) * qint64(height);
+}
+
+bool MappedImageReader::canRead(const QString& filename) {
+    QString suffix = QFileInfo(filename).suffix().toLower();
+    return (suffix == "pgm") || (suffix == "ppm") || (suffix == "pnm") || (suffix == "pfm");
+}
+
+bool MappedImageReader::isRawFrame(const QString& filename) {
+    QString suffix = QFileInfo(filename).suffix().toLower();
+    return (suffix == "raw") || (suffix == "bin");
+}
+
+QSharedPointer<QFile> MappedImageReader::mapFile(const QString& filename, const uchar *&data, qint64& size) {
+    QSharedPointer<QFile> file(new QFile(filename));
+    data = nullptr;
+    size = file->size();
+
+    if ((size <= 0) || !file->open(QIODevice::ReadOnly)) {
+        qDebug("Could not open %s.", filename.toStdString().c_str());
+        return QSharedPointer<QFile>();
+    }
+
+    data = file->map(0, size);
+
+    if (data == nullptr) {
+        qDebug("Could not map %s.", filename.toStdString().c_str());
+        return QSharedPointer<QFile>();
+    }
+
+    return file;
+}
+
+QImage MappedImageReader::wrapMapping(const QSharedPointer<QFile>& file, const uchar *pixels, int width, int height,
+                                      int bytesPerLine, QImage::Format format) {
+    /* Read-only image: writing to it detaches it from the mapping */
+    QSharedPointer<QFile> *reference = new QSharedPointer<QFile>(file);
+    QImage image(pixels, width, height, bytesPerLine, format, releaseFileReference, reference);
+
+    if (image.isNull()) {
+        delete reference;
+    }
+
+    return image;
+}
+
+QImage MappedImageReader::read(const QString& filename, QByteArray *hash) {
+    const uchar *data = nullptr;
+    qint64 size = 0;
+    QSharedPointer<QFile> file = mapFile(filename, data, size);
+
+    if (file.isNull() || (size < 2) || (data[0] != 'P')) {
+        return QImage();
+    }
+
+    QImage image;
+    switch (data[1]) {
+    case '5':
+    case '6':
+        image = readPNM(file, data, size);
+        break;
+
+    case 'f':
+    case 'F':
+        image = readPFM(data, size);
+        break;
+
+    default:
+        break;
+    }
+
+    if (!image.isNull() && (hash != nullptr)) {
+        *hash = TopinoData::calculateContentHash(data, size);
+    }
+
+    return image;
+}
+
+QImage MappedImageReader::readRaw(const QString& filename, const RawFormat& format) {
+    if (!format.isValid()) {
+        return QImage();
+    }
+
+    const uchar *data = nullptr;
+    qint64 size = 0;
+    QSharedPointer<QFile> file = mapFile(filename, data, size);
+
+    if (file.isNull()) {
+        return QImage();
+    }
+
+    if (format.offset + format.getFrameSize() > size) {
+        qDebug("Raw frame %s is smaller than its layout (%lld bytes).", filename.toStdString().c_str(),
+               format.offset + format.getFrameSize());
+        return QImage();
+    }
+
+    const uchar *pixels = data + format.offset;
+    int bytesPerLine = format.getBytesPerLine();
+    quint32 maxValue = (1u << format.bitDepth) - 1;
+
+    /* 8 bit frames and full 16 bit frames in the byte order of the machine are used as they are */
+    if (format.bitDepth == 8) {
+        return wrapMapping(file, pixels, format.width, format.height, bytesPerLine, QImage::Format_Grayscale8);
+    }
+
+    if ((format.bitDepth == 16) && (format.bigEndian == (Q_BYTE_ORDER == Q_BIG_ENDIAN)) &&
+            ((quintptr(pixels) % 2) == 0) && ((bytesPerLine % 2) == 0)) {
+        return wrapMapping(file, pixels, format.width, format.height, bytesPerLine, QImage::Format_Grayscale16);
+    }
+
+    /* Everything else is converted; smaller bit depths are stretched to the full range */
+    QImage image(format.width, format.height, (format.bitDepth > 8) ? QImage::Format_Grayscale16 : QImage::Format_Grayscale8);
+
+    for (int y = 0; y < format.height; ++y) {
+        const uchar *source = pixels + qint64(y) * bytesPerLine;
+
+        if (format.bitDepth > 8) {
+            quint16 *line = reinterpret_cast<quint16 *>(image.scanLine(y));
+
+            for (int x = 0; x < format.width; ++x) {
+                quint32 value = format.bigEndian ? qFromBigEndian<quint16>(source + 2 * x) : qFromLittleEndian<quint16>(source + 2 * x);
+                line[x] = quint16((value & maxValue) * 65535u / maxValue);
+            }
+        } else {
+            uchar *line = image.scanLine(y);
+
+            for (int x = 0; x < format.width; ++x) {
+                line[x] = uchar((source[x] & maxValue) * 255u / maxValue);
+            }
+        }
+    }
+
+    return image;
+}
+
+static bool isHeaderSpace(uchar c) {
+    return (c == ' ') || (c == '\t') || (c == '\n') || (c == '\r') || (c == '\v') || (c == '\f');
+}
+
+/* Reads the tokens of a PNM/PFM header (separated by whitespace; comments start with #) and returns the
+ * offset of the pixel data, which follow a single whitespace after the last token (-1 if not valid) */
+static qint64 readHeaderTokens(const uchar *data, qint64 size, QList<QByteArray>& tokens, int count) {
+    const int maxTokenLength = 32;
+    qint64 pos = 0;
+
+    while (tokens.size() < count) {
+        while (pos < size) {
+            if (isHeaderSpace(data[pos])) {
+                ++pos;
+            } else if (data[pos] == '#') {
+                while ((pos < size) && (data[pos] != '\n') && (data[pos] != '\r')) {
+                    ++pos;
+                }
+            } else {
+                break;
+            }
+        }
+
+        qint64 start = pos;
+        while ((pos < size) && !isHeaderSpace(data[pos]) && (data[pos] != '#') && (pos - start <= maxTokenLength)) {
+            ++pos;
+        }
+
+        if ((pos == start) || (pos - start > maxTokenLength)) {
+            return -1;
+        }
+
+        tokens.append(QByteArray(reinterpret_cast<const char *>(data + start), int(pos - start)));
+    }
+
+    return ((pos < size) && isHeaderSpace(data[pos])) ? (pos + 1) : -1;
+}
+
+QImage MappedImageReader::readPNM(const QSharedPointer<QFile>& file, const uchar *data, qint64 size) {
+    /* Binary PGM (P5) and PPM (P6): magic, width, height, maximum value */
+    QList<QByteArray> tokens;
+    qint64 offset = readHeaderTokens(data, size, tokens, 4);
+
+    bool okWidth = false, okHeight = false, okMax = false;
+    int width = (offset > 0) ? tokens[1].toInt(&okWidth) : 0;
+    int height = (offset > 0) ? tokens[2].toInt(&okHeight) : 0;
+    quint32 maxValue = (offset > 0) ? tokens[3].toUInt(&okMax) : 0;
+
+    if (!okWidth || !okHeight || !okMax || (width <= 0) || (height <= 0) || (maxValue == 0) || (maxValue > 65535)) {
+        qDebug("Not a valid binary PGM/PPM header.");
+        return QImage();
+    }
+
+    int channels = (tokens[0] == "P6") ? 3 : 1;
+    int bytesPerSample = (maxValue > 255) ? 2 : 1;
+    qint64 bytesPerLine = qint64(width) * channels * bytesPerSample;
+
+    if ((bytesPerLine > INT_MAX) || (offset + bytesPerLine * height > size)) {
+        qDebug("PGM/PPM file is smaller than its header says.");
+        return QImage();
+    }
+
+    const uchar *pixels = data + offset;
+
+    /* Full range 8 bit images are used as they are */
+    if ((bytesPerSample == 1) && (maxValue == 255)) {
+        return wrapMapping(file, pixels, width, height, int(bytesPerLine),
+                           (channels == 1) ? QImage::Format_Grayscale8 : QImage::Format_RGB888);
+    }
+
+    /* 16 bit samples are big-endian; on all common machines they have to be swapped anyway */
+    if ((bytesPerSample == 2) && (channels == 1) && (maxValue == 65535) && (Q_BYTE_ORDER == Q_BIG_ENDIAN) &&
+            ((quintptr(pixels) % 2) == 0)) {
+        return wrapMapping(file, pixels, width, height, int(bytesPerLine), QImage::Format_Grayscale16);
+    }
+
+    QImage::Format format = (channels == 1) ? ((bytesPerSample == 1) ? QImage::Format_Grayscale8 : QImage::Format_Grayscale16)
+                                            : ((bytesPerSample == 1) ? QImage::Format_RGB888 : QImage::Format_RGBX64);
+    QImage image(width, height, format);
+
+    for (int y = 0; y < height; ++y) {
+        const uchar *source = pixels + y * bytesPerLine;
+
+        if (bytesPerSample == 1) {
+            uchar *line = image.scanLine(y);
+
+            for (int i = 0; i < width * channels; ++i) {
+                line[i] = uchar(qMin(quint32(source[i]), maxValue) * 255u / maxValue);
+            }
+        } else if (channels == 1) {
+            quint16 *line = reinterpret_cast<quint16 *>(image.scanLine(y));
+
+            for (int x = 0; x < width; ++x) {
+                line[x] = quint16(qMin(quint32(qFromBigEndian<quint16>(source + 2 * x)), maxValue) * 65535u / maxValue);
+            }
+        } else {
+            QRgba64 *line = reinterpret_cast<QRgba64 *>(image.scanLine(y));
+
+            for (int x = 0; x < width; ++x) {
+                quint16 rgb[3];
+
+                for (int c = 0; c < 3; ++c) {
+                    rgb[c] = quint16(qMin(quint32(qFromBigEndian<quint16>(source + 6 * x + 2 * c)), maxValue) * 65535u / maxValue);
+                }
+
+                line[x] = qRgba64(rgb[0], rgb[1], rgb[2], 65535);
+            }
+        }
+    }
+
+    return image;
+}
+
+static float readFloat(const uchar *data, bool littleEndian) {
+    quint32 bits = littleEndian ? qFromLittleEndian<quint32>(data) : qFromBigEndian<quint32>(data);
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+
+    return value;
+}
+
+QImage MappedImageReader::readPFM(const uchar *data, qint64 size) {
+    /* PFM: magic (PF for color, Pf for gray), width, height, scale (negative for little-endian); the
+     * lines are stored from bottom to top */
+    QList<QByteArray> tokens;
+    qint64 offset = readHeaderTokens(data, size, tokens, 4);
+
+    bool okWidth = false, okHeight = false, okScale = false;
+    int width = (offset > 0) ? tokens[1].toInt(&okWidth) : 0;
+    int height = (offset > 0) ? tokens[2].toInt(&okHeight) : 0;
+    double scale = (offset > 0) ? tokens[3].toDouble(&okScale) : 0.0;
+
+    if (!okWidth || !okHeight || !okScale || (width <= 0) || (height <= 0) || (scale == 0.0)) {
+        qDebug("Not a valid PFM header.");
+        return QImage();
+    }
+
+    int channels = (tokens[0] == "PF") ? 3 : 1;
+    bool littleEndian = (scale < 0.0);
+    qint64 bytesPerLine = qint64(width) * channels * 4;
+    qint64 sampleCount = qint64(width) * height * channels;
+
+    if (offset + bytesPerLine * height > size) {
+        qDebug("PFM file is smaller than its header says.");
+        return QImage();
+    }
+
+    /* There is no floating point image format, so the values are stretched from their minimum to their
+     * maximum into 16 bits */
+    const uchar *pixels = data + offset;
+    float minValue = 0.0f, maxValue = 0.0f;
+    bool first = true;
+
+    for (qint64 i = 0; i < sampleCount; ++i) {
+        float value = readFloat(pixels + 4 * i, littleEndian);
+
+        if (!qIsFinite(value)) {
+            continue;
+        }
+
+        minValue = first ? value : qMin(minValue, value);
+        maxValue = first ? value : qMax(maxValue, value);
+        first = false;
+    }
+
+    double range = (maxValue > minValue) ? double(maxValue - minValue) : 1.0;
+    QImage image(width, height, (channels == 1) ? QImage::Format_Grayscale16 : QImage::Format_RGBX64);
+
+    auto convert = [minValue, range](float value) {
+        return qIsFinite(value) ? quint16(qBound(0.0, (double(value) - minValue) / range, 1.0) * 65535.0 + 0.5) : quint16(0);
+    };
+
+    for (int y = 0; y < height; ++y) {
+        const uchar *source = pixels + qint64(height - 1 - y) * bytesPerLine;
+
+        if (channels == 1) {
+            quint16 *line = reinterpret_cast<quint16 *>(image.scanLine(y));
+
+            for (int x = 0; x < width; ++x) {
+                line[x] = convert(readFloat(source + 4 * x, littleEndian));
+            }
+        } else {
+            QRgba64 *line = reinterpret_cast<QRgba64 *>(image.scanLine(y));
+
+            for (int x = 0; x < width; ++x) {
+                line[x] = qRgba64(convert(readFloat(source + 12 * x, littleEndian)),
+                                  convert(readFloat(source + 12 * x + 4, littleEndian)),
+                                  convert(readFloat(source + 12 * x + 8, littleEndian)), 65535);
+            }
+        }
+    }
+
+    return image;
+}
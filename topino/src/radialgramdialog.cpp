@@ -45,7 +45,7 @@ void RadialgramDialog::showEvent(QShowEvent* event) {
     QDialog::showEvent(event);
 }
 
-void RadialgramDialog::setDataPoints(const QVector<QPointF>& value) {
+void RadialgramDialog::setDataPoints(const TopinoTools::SampledSignal& value) {
     dataPoints = value;
 
     createAxes();
@@ -109,7 +109,7 @@ void RadialgramDialog::onExport() {
         textdata.append("Radius (Px)\tCircular intensity (a.u.)");
         for(int i = 0; i < dataPoints.length(); ++i) {
             QString line;
-            line.sprintf("%.0f\t%.3f", dataPoints[i].x(), dataPoints[i].y());
+            line.sprintf("%.0f\t%.3f", dataPoints.x(i), dataPoints.y(i));
             textdata.append(line);
         }
 
@@ -160,10 +160,9 @@ void RadialgramDialog::createAxes() {
         xaxis->setLabelFormat("%d");
         xaxis->setMinorTickCount(3);
 
-        /* We assume that dataPoints are sorted and the last element holds therefore the
-         * maximal x value. */
+        /* The radius grid is ascending, so the last element holds the maximal x value. */
         if (dataPoints.length() > 0) {
-            xaxis->setRange(0, dataPoints.last().x());
+            xaxis->setRange(0, dataPoints.x(dataPoints.length() - 1));
         } else {
             xaxis->setRange(0, 100);
         }
@@ -200,17 +199,13 @@ void RadialgramDialog::createSeries() {
 
     /* Let's calculate a scaling factor from this data to scale it to relative
      * intensities (makes the y-axis way more clear!). */
-    QPointF maxPoint = *std::max_element(dataPoints.constBegin(), dataPoints.constEnd(),
-    [](const QPointF& a,const QPointF& b) {
-        return a.y() < b.y();
-    });
-    setScalingFactor(maxPoint.y());
+    setScalingFactor(*std::max_element(dataPoints.values.constBegin(), dataPoints.values.constEnd()));
 
     /* Let's create a line series first with all the data points. */
     QtCharts::QLineSeries *series = new QtCharts::QLineSeries(chart);
 
-    for (auto iter = dataPoints.begin(); iter != dataPoints.end(); ++iter) {
-        series->append(iter->x(), iter->y() / scalingFactor);
+    for (int i = 0; i < dataPoints.length(); ++i) {
+        series->append(dataPoints.x(i), dataPoints.y(i) / scalingFactor);
     }
     chart->addSeries(series);
 }
@@ -0,0 +1,69 @@
+#include "include/rawimagedialog.h"
+#include "ui_rawimagedialog.h"
+
+#include <QPushButton>
+#include <QtMath>
+
+RawImageDialog::RawImageDialog(qint64 fileSize, QWidget *parent) :
+    QDialog(parent),
+    ui(new Ui::RawImageDialog),
+    fileSize(fileSize) {
+    /* Setup UI */
+    ui->setupUi(this);
+
+    setFormat(MappedImageReader::RawFormat());
+}
+
+RawImageDialog::~RawImageDialog() {
+    delete ui;
+}
+
+MappedImageReader::RawFormat RawImageDialog::getFormat() const {
+    MappedImageReader::RawFormat format;
+    format.width = ui->spinWidth->value();
+    format.height = ui->spinHeight->value();
+    format.bitDepth = ui->spinBitDepth->value();
+    format.bigEndian = (ui->comboByteOrder->currentIndex() == 1);
+    format.stride = ui->spinStride->value();
+    format.offset = ui->spinOffset->value();
+
+    return format;
+}
+
+void RawImageDialog::setFormat(const MappedImageReader::RawFormat& value) {
+    MappedImageReader::RawFormat format = value;
+
+    /* Square frames with 16 or 8 bits are the most common case */
+    if (!format.isValid()) {
+        for (int bytesPerPixel = 2; bytesPerPixel >= 1; --bytesPerPixel) {
+            int side = int(qSqrt(qreal(fileSize / bytesPerPixel)));
+
+            if ((fileSize % bytesPerPixel == 0) && (qint64(side) * side * bytesPerPixel == fileSize)) {
+                format.width = side;
+                format.height = side;
+                format.bitDepth = 8 * bytesPerPixel;
+                break;
+            }
+        }
+    }
+
+    ui->spinWidth->setValue(format.width);
+    ui->spinHeight->setValue(format.height);
+    ui->spinBitDepth->setValue(format.bitDepth);
+    ui->comboByteOrder->setCurrentIndex(format.bigEndian ? 1 : 0);
+    ui->spinStride->setValue(format.stride);
+    ui->spinOffset->setValue(int(format.offset));
+
+    updateFrameSize();
+}
+
+void RawImageDialog::updateFrameSize() {
+    /* The byte order only matters for more than 8 bits */
+    MappedImageReader::RawFormat format = getFormat();
+    ui->comboByteOrder->setEnabled(format.getBytesPerPixel() > 1);
+
+    bool fits = format.isValid() && (format.offset + format.getFrameSize() <= fileSize);
+
+    ui->labelFrameSize->setText(tr("Frame: %1 bytes, file: %2 bytes").arg(format.offset + format.getFrameSize()).arg(fileSize));
+    ui->buttonBox->button(QDialogButtonBox::Ok)->setEnabled(fits);
+}
@@ -0,0 +1,261 @@
+#include "include/resultstore.h"
+
+#include <QAtomicInt>
+#include <QDir>
+#include <QFileInfo>
+#include <QSqlError>
+#include <QVariant>
+
+ResultStore::ResultStore() {
+    static QAtomicInt connections;
+    connectionName = QString("topinoResults%1").arg(connections.fetchAndAddRelaxed(1));
+}
+
+ResultStore::~ResultStore() {
+    close();
+}
+
+bool ResultStore::open(const QString& databaseFile) {
+    close();
+
+    QDir().mkpath(QFileInfo(databaseFile).absolutePath());
+
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+    db.setDatabaseName(databaseFile);
+
+    if (!db.open()) {
+        qDebug("Could not open result store %s: %s", databaseFile.toStdString().c_str(),
+               db.lastError().text().toStdString().c_str());
+        db = QSqlDatabase();
+        QSqlDatabase::removeDatabase(connectionName);
+
+        return false;
+    }
+
+    if (!createTables()) {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void ResultStore::close() {
+    if (!QSqlDatabase::contains(connectionName)) {
+        return;
+    }
+
+    /* The database object has to be gone before the connection can be removed */
+    {
+        QSqlDatabase db = QSqlDatabase::database(connectionName, false);
+        db.close();
+    }
+
+    QSqlDatabase::removeDatabase(connectionName);
+}
+
+bool ResultStore::isOpen() const {
+    return QSqlDatabase::contains(connectionName) && QSqlDatabase::database(connectionName, false).isOpen();
+}
+
+bool ResultStore::createTables() {
+    QSqlQuery query(QSqlDatabase::database(connectionName, false));
+
+    /* Write-ahead logging keeps queries fast while documents are indexed */
+    const char *statements[] = {
+        "PRAGMA journal_mode = WAL",
+        "PRAGMA foreign_keys = ON",
+        "CREATE TABLE IF NOT EXISTS analyses ("
+        " id INTEGER PRIMARY KEY, file TEXT UNIQUE NOT NULL, saved TEXT NOT NULL, image_hash TEXT,"
+        " image_width INTEGER, image_height INTEGER, inlet_x REAL, inlet_y REAL, inlet_radius INTEGER,"
+        " neutral_angle INTEGER, min_angle INTEGER, max_angle INTEGER, outer_radius INTEGER,"
+        " desat_mode INTEGER, inversion INTEGER, level_min INTEGER, level_max INTEGER, stream_count INTEGER)",
+        "CREATE TABLE IF NOT EXISTS streams ("
+        " analysis INTEGER NOT NULL REFERENCES analyses(id) ON DELETE CASCADE, stream INTEGER NOT NULL,"
+        " pos REAL, pos_lower REAL, pos_upper REAL, width REAL, width_lower REAL, width_upper REAL,"
+        " height REAL, rsquare REAL, model TEXT, PRIMARY KEY (analysis, stream))",
+        "CREATE TABLE IF NOT EXISTS resolutions ("
+        " analysis INTEGER NOT NULL REFERENCES analyses(id) ON DELETE CASCADE, stream1 INTEGER NOT NULL,"
+        " stream2 INTEGER NOT NULL, resolution REAL, resolution_lower REAL, resolution_upper REAL,"
+        " PRIMARY KEY (analysis, stream1, stream2))",
+        "CREATE INDEX IF NOT EXISTS analyses_saved ON analyses(saved)",
+        "CREATE INDEX IF NOT EXISTS streams_pos ON streams(pos)"
+    };
+
+    for (auto statement : statements) {
+        if (!query.exec(statement)) {
+            qDebug("Could not prepare result store: %s", query.lastError().text().toStdString().c_str());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Confidence intervals that were not calculated are stored as NULL */
+static QVariant intervalBound(const TopinoTools::ConfidenceInterval& interval, qreal bound) {
+    return interval.isNull() ? QVariant(QVariant::Double) : QVariant(bound);
+}
+
+bool ResultStore::indexDocument(const TopinoDocument& document) {
+    if (!isOpen() || !document.hasFileName()) {
+        return false;
+    }
+
+    QSqlDatabase db = QSqlDatabase::database(connectionName, false);
+    const TopinoData& data = document.getData();
+    QString file = QDir(document.getPath()).absoluteFilePath(document.getFilename());
+    TopinoData::InletData inlet = data.getInletData(data.getMainInletID());
+    QVector<TopinoTools::Lorentzian> streams = data.getStreamParameters();
+
+    /* One transaction per document: the old entry (with its streams) is replaced */
+    db.transaction();
+    QSqlQuery query(db);
+
+    query.prepare("DELETE FROM analyses WHERE file = ?");
+    query.addBindValue(file);
+    bool success = query.exec();
+
+    query.prepare("INSERT INTO analyses (file, saved, image_hash, image_width, image_height, inlet_x, inlet_y,"
+                  " inlet_radius, neutral_angle, min_angle, max_angle, outer_radius, desat_mode, inversion,"
+                  " level_min, level_max, stream_count) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
+    query.addBindValue(file);
+    query.addBindValue(QDateTime::currentDateTime().toString(Qt::ISODate));
+    query.addBindValue(QString::fromLatin1(data.getSourceHash()));
+    query.addBindValue(data.getImage().width());
+    query.addBindValue(data.getImage().height());
+    query.addBindValue(inlet.coord.x());
+    query.addBindValue(inlet.coord.y());
+    query.addBindValue(inlet.radius);
+    query.addBindValue(data.getCoordNeutralAngle());
+    query.addBindValue(data.getCoordMinAngle());
+    query.addBindValue(data.getCoordMaxAngle());
+    query.addBindValue(data.getCoordOuterRadius());
+    query.addBindValue(int(data.getDesatMode()));
+    query.addBindValue(data.getInversion() ? 1 : 0);
+    query.addBindValue(data.getLevelMin());
+    query.addBindValue(data.getLevelMax());
+    query.addBindValue(streams.length());
+    success = success && query.exec();
+
+    QVariant analysis = query.lastInsertId();
+
+    query.prepare("INSERT INTO streams (analysis, stream, pos, pos_lower, pos_upper, width, width_lower, width_upper,"
+                  " height, rsquare, model) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
+
+    for (int i = 0; (i < streams.length()) && success; ++i) {
+        query.addBindValue(analysis);
+        query.addBindValue(i + 1);
+        query.addBindValue(streams[i].pos);
+        query.addBindValue(intervalBound(streams[i].posCI, streams[i].posCI.lower));
+        query.addBindValue(intervalBound(streams[i].posCI, streams[i].posCI.upper));
+        query.addBindValue(streams[i].width);
+        query.addBindValue(intervalBound(streams[i].widthCI, streams[i].widthCI.lower));
+        query.addBindValue(intervalBound(streams[i].widthCI, streams[i].widthCI.upper));
+        query.addBindValue(streams[i].height);
+        query.addBindValue(streams[i].rsquare);
+        query.addBindValue(TopinoTools::getPeakModelName(streams[i].model));
+        success = query.exec();
+    }
+
+    query.prepare("INSERT INTO resolutions (analysis, stream1, stream2, resolution, resolution_lower, resolution_upper)"
+                  " VALUES (?, ?, ?, ?, ?, ?)");
+
+    for (int i = 0; (i < streams.length()) && success; ++i) {
+        for (int j = (i+1); (j < streams.length()) && success; ++j) {
+            TopinoTools::ConfidenceInterval resolutionCI = TopinoTools::getResolutionCI(streams, i, j);
+
+            query.addBindValue(analysis);
+            query.addBindValue(i + 1);
+            query.addBindValue(j + 1);
+            query.addBindValue(TopinoTools::calculateResolution(streams[i].pos, streams[i].width,
+                                                                streams[j].pos, streams[j].width));
+            query.addBindValue(intervalBound(resolutionCI, resolutionCI.lower));
+            query.addBindValue(intervalBound(resolutionCI, resolutionCI.upper));
+            success = query.exec();
+        }
+    }
+
+    if (!success) {
+        qDebug("Could not index %s: %s", file.toStdString().c_str(), query.lastError().text().toStdString().c_str());
+        db.rollback();
+
+        return false;
+    }
+
+    return db.commit();
+}
+
+QString ResultStore::getColumnName(ResultStore::queryColumns column) {
+    const char *names[] = {
+        "File",
+        "Saved",
+        "Stream",
+        "𝜑 (°)",
+        "𝜑 lower",
+        "𝜑 upper",
+        "𝜔 (°)",
+        "𝜔 lower",
+        "𝜔 upper",
+        "L²",
+        "Model",
+        "R to next"
+    };
+
+    if (column >= columnCOUNT)
+        return QString();
+
+    return QString::fromUtf8(names[column]);
+}
+
+QSqlQuery ResultStore::queryStreams(const ResultStore::Filter& filter) const {
+    QSqlQuery query(QSqlDatabase::database(connectionName, false));
+
+    /* Same order as the queryColumns */
+    QString sql = "SELECT a.file, a.saved, s.stream, s.pos, s.pos_lower, s.pos_upper, s.width, s.width_lower,"
+                  " s.width_upper, s.rsquare, s.model, r.resolution"
+                  " FROM streams s JOIN analyses a ON a.id = s.analysis"
+                  " LEFT JOIN resolutions r ON r.analysis = s.analysis AND r.stream1 = s.stream AND r.stream2 = s.stream + 1"
+                  " WHERE s.pos BETWEEN ? AND ? AND s.rsquare >= ?";
+
+    if (!filter.file.isEmpty()) {
+        sql += " AND a.file LIKE ?";
+    }
+
+    if (filter.stream > 0) {
+        sql += " AND s.stream = ?";
+    }
+
+    sql += " ORDER BY a.saved, a.file, s.stream LIMIT ?";
+
+    query.prepare(sql);
+    query.addBindValue(filter.minPos);
+    query.addBindValue(filter.maxPos);
+    query.addBindValue(filter.minRSquare);
+
+    if (!filter.file.isEmpty()) {
+        query.addBindValue("%" + QString(filter.file).replace('*', '%') + "%");
+    }
+
+    if (filter.stream > 0) {
+        query.addBindValue(filter.stream);
+    }
+
+    query.addBindValue(filter.limit);
+
+    if (!query.exec()) {
+        qDebug("Query of result store failed: %s", query.lastError().text().toStdString().c_str());
+    }
+
+    return query;
+}
+
+int ResultStore::countAnalyses() const {
+    QSqlQuery query(QSqlDatabase::database(connectionName, false));
+
+    if (query.exec("SELECT COUNT(*) FROM analyses") && query.next()) {
+        return query.value(0).toInt();
+    }
+
+    return 0;
+}
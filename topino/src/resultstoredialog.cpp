@@ -0,0 +1,118 @@
+#include "include/resultstoredialog.h"
+#include "ui_resultstoredialog.h"
+
+#include <QDateTimeAxis>
+#include <QMap>
+#include <QScatterSeries>
+#include <QValueAxis>
+
+ResultStoreDialog::ResultStoreDialog(ResultStore& store, QWidget *parent) :
+    QDialog(parent),
+    ui(new Ui::ResultStoreDialog),
+    store(store) {
+    /* Setup UI */
+    ui->setupUi(this);
+
+    model = new QSqlQueryModel(this);
+    ui->tableResults->setModel(model);
+
+    /* Same look as the other charts */
+    ui->trendView->setBackgroundRole(QPalette::Window);
+    ui->trendView->setRenderHint(QPainter::Antialiasing);
+
+    chart = ui->trendView->chart();
+    chart->setTheme(QtCharts::QChart::ChartThemeDark);
+    chart->legend()->setAlignment(Qt::AlignRight);
+
+    on_buttonQuery_clicked();
+}
+
+ResultStoreDialog::~ResultStoreDialog() {
+    delete ui;
+}
+
+void ResultStoreDialog::on_buttonQuery_clicked() {
+    ResultStore::Filter filter;
+    filter.file = ui->editFile->text().trimmed();
+    filter.stream = ui->spinStream->value();
+    filter.minPos = ui->spinMinPos->value();
+    filter.maxPos = ui->spinMaxPos->value();
+    filter.minRSquare = ui->spinMinRSquare->value();
+
+    model->setQuery(store.queryStreams(filter));
+
+    /* All results are needed for the trend anyway */
+    while (model->canFetchMore()) {
+        model->fetchMore();
+    }
+
+    for (int i = 0; i < ResultStore::queryColumns::columnCOUNT; ++i) {
+        model->setHeaderData(i, Qt::Horizontal, ResultStore::getColumnName(ResultStore::queryColumns(i)));
+    }
+    ui->tableResults->resizeColumnsToContents();
+
+    ui->labelCount->setText(tr("%1 streams found in %2 analyses.").arg(model->rowCount()).arg(store.countAnalyses()));
+
+    updateTrend();
+}
+
+void ResultStoreDialog::updateTrend() {
+    chart->removeAllSeries();
+
+    QList<QtCharts::QAbstractAxis *> axes = chart->axes();
+    for (auto it = axes.begin(); it != axes.end(); ++it) {
+        chart->removeAxis(*it);
+        delete *it;
+    }
+
+    /* Position of each stream over the time it was saved */
+    QMap<int, QtCharts::QScatterSeries *> series;
+    qint64 minTime = 0;
+    qint64 maxTime = 0;
+    qreal minPos = 0.0;
+    qreal maxPos = 0.0;
+
+    for (int row = 0; row < model->rowCount(); ++row) {
+        int stream = model->index(row, ResultStore::columnStream).data().toInt();
+        qint64 time = QDateTime::fromString(model->index(row, ResultStore::columnSaved).data().toString(),
+                                            Qt::ISODate).toMSecsSinceEpoch();
+        qreal pos = model->index(row, ResultStore::columnPos).data().toDouble();
+
+        if (!series.contains(stream)) {
+            QtCharts::QScatterSeries *streamSeries = new QtCharts::QScatterSeries();
+            streamSeries->setName(tr("Stream %1").arg(stream));
+            streamSeries->setMarkerSize(6.0);
+            streamSeries->setColor(TopinoTools::colorsTableau10[(stream - 1 + 10) % 10]);
+            series.insert(stream, streamSeries);
+        }
+
+        series[stream]->append(qreal(time), pos);
+
+        minTime = (row == 0) ? time : qMin(minTime, time);
+        maxTime = (row == 0) ? time : qMax(maxTime, time);
+        minPos = (row == 0) ? pos : qMin(minPos, pos);
+        maxPos = (row == 0) ? pos : qMax(maxPos, pos);
+    }
+
+    if (series.isEmpty()) {
+        return;
+    }
+
+    QtCharts::QDateTimeAxis *xaxis = new QtCharts::QDateTimeAxis();
+    xaxis->setFormat("yyyy-MM-dd");
+    xaxis->setTitleText(tr("Saved"));
+    xaxis->setRange(QDateTime::fromMSecsSinceEpoch(minTime - 3600000), QDateTime::fromMSecsSinceEpoch(maxTime + 3600000));
+
+    QtCharts::QValueAxis *yaxis = new QtCharts::QValueAxis();
+    yaxis->setTitleText("𝜑 (°)");
+    yaxis->setRange(minPos - 1.0, maxPos + 1.0);
+
+    chart->addAxis(xaxis, Qt::AlignBottom);
+    chart->addAxis(yaxis, Qt::AlignLeft);
+
+    for (auto it = series.begin(); it != series.end(); ++it) {
+        chart->addSeries(it.value());
+        it.value()->attachAxis(xaxis);
+        it.value()->attachAxis(yaxis);
+    }
+}
@@ -1,5 +1,16 @@
 #include "include/topinodata.h"
 
+#include <cstring>
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QPolygonF>
+
+/* Cache of decoded images by content hash; the cost is given in MiB. Cached images might hold a mapped
+ * file, so the cache is kept small. */
+static QCache<QByteArray, QImage> imageCache(256);
+static QMutex imageCacheMutex;
+
 TopinoData::TopinoData() {
     nextInletID = 1;
 
@@ -25,8 +36,204 @@ QImage TopinoData::getImage() const {
 }
 
 void TopinoData::setImage(const QImage& value) {
+    /* Stored results belong to the image of the document (which might be set after loading); they are
+     * dropped if another image replaces it, and so is the position of a cropped image */
+    if (!sourceImage.isNull() && (sourceImage.cacheKey() != value.cacheKey())) {
+        sourceFile.clear();
+        sourceHash.clear();
+        sourceReference.clear();
+        storedProcessedImage = QImage();
+        storedProcessedData.clear();
+        storedProcessedHash = 0;
+        storedAngulagramHash = 0;
+        cropOffset = QPoint();
+        fullSize = QSize();
+        contextImage = QImage();
+    }
+
     sourceImage = value;
     processedImage = value;
+    stageKeys[stageProcessed] = 0;
+
+    validateCrop();
+}
+
+QString TopinoData::getSourceFile() const {
+    return sourceFile;
+}
+
+QByteArray TopinoData::getSourceHash() const {
+    return sourceHash;
+}
+
+void TopinoData::setSourceFile(const QString& file, const QByteArray& hash) {
+    sourceFile = file;
+    sourceHash = hash;
+}
+
+QString TopinoData::getSourceReference() const {
+    return sourceReference;
+}
+
+QByteArray TopinoData::calculateContentHash(const QByteArray& content) {
+    return QCryptographicHash::hash(content, QCryptographicHash::Sha256).toHex();
+}
+
+QByteArray TopinoData::calculateContentHash(const uchar *content, qint64 size) {
+    /* Memory (e.g. a mapped file) can be larger than a byte array, so it is hashed in blocks */
+    const qint64 blockSize = 64 * 1024 * 1024;
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+
+    for (qint64 offset = 0; offset < size; offset += blockSize) {
+        hash.addData(reinterpret_cast<const char *>(content + offset), int(qMin(blockSize, size - offset)));
+    }
+
+    return hash.result().toHex();
+}
+
+QImage TopinoData::findCachedImage(const QByteArray& hash) {
+    QMutexLocker locker(&imageCacheMutex);
+    QImage *image = imageCache.object(hash);
+
+    return (image != nullptr) ? *image : QImage();
+}
+
+void TopinoData::cacheImage(const QByteArray& hash, const QImage& image) {
+    if (hash.isEmpty() || image.isNull()) {
+        return;
+    }
+
+    QMutexLocker locker(&imageCacheMutex);
+    imageCache.insert(hash, new QImage(image), qMax(1, int(image.sizeInBytes() / (1024 * 1024))));
+}
+
+void TopinoData::uncacheImage(const QByteArray& hash) {
+    if (hash.isEmpty()) {
+        return;
+    }
+
+    QMutexLocker locker(&imageCacheMutex);
+    imageCache.remove(hash);
+}
+
+QRect TopinoData::calculateRegionOfInterest() const {
+    QRectF region;
+
+    for (auto it = inlets.constBegin(); it != inlets.constEnd(); ++it) {
+        region |= QRectF(it->coord - QPointF(it->radius, it->radius), QSizeF(2 * it->radius, 2 * it->radius));
+    }
+
+    /* Sector of the main inlet (same angles as the polar image); sampled every degree, the margin
+     * covers the arc between the samples */
+    if (mainInletID != 0) {
+        TopinoData::InletData mainInletData = getInletData(mainInletID);
+        QPolygonF sector;
+        sector.append(mainInletData.coord);
+
+        for (int angle = neutralAngle + minAngle; angle <= neutralAngle + maxAngle; ++angle) {
+            sector.append(mainInletData.coord + QPointF(outerRadius * qCos(qDegreesToRadians(qreal(angle))),
+                                                        -outerRadius * qSin(qDegreesToRadians(qreal(angle)))));
+        }
+
+        region |= sector.boundingRect();
+    }
+
+    if (region.isNull()) {
+        return QRect();
+    }
+
+    return region.toAlignedRect().adjusted(-2, -2, 2, 2) & sourceImage.rect();
+}
+
+QImage TopinoData::createContextImage(const QImage& image) {
+    /* Enough to recognize the frame around the region */
+    const int contextSize = 512;
+
+    if ((image.width() <= contextSize) && (image.height() <= contextSize)) {
+        return image;
+    }
+
+    return image.scaled(contextSize, contextSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+}
+
+TopinoData TopinoData::createCroppedData(const QRect& crop) const {
+    TopinoData cropped = *this;
+
+    QRect region = crop & sourceImage.rect();
+    if (region.isEmpty() || (region == sourceImage.rect())) {
+        return cropped;
+    }
+
+    /* Cropping a cropped image again keeps the full frame and its context */
+    if (!isCropped()) {
+        cropped.contextImage = createContextImage(sourceImage);
+        cropped.fullSize = sourceImage.size();
+    }
+    cropped.cropOffset = cropOffset + region.topLeft();
+
+    /* The processed image is cropped as well if it is up to date, so that nothing has to be calculated */
+    bool processedValid = isStageUpToDate(stageProcessed) && (stageKeys[stageProcessed] != 0);
+    bool polarValid = (stageKeys[stagePolar] != 0) && (stageKeys[stagePolar] == calculateStageKey(stagePolar));
+
+    cropped.sourceImage = sourceImage.copy(region);
+    cropped.processedImage = processedValid ? processedImage.copy(region) : cropped.sourceImage;
+    cropped.storedProcessedImage = QImage();
+    cropped.storedProcessedData.clear();
+    cropped.storedProcessedHash = 0;
+
+    for (InletData& inlet : cropped.inlets) {
+        inlet.coord -= QPointF(region.topLeft());
+    }
+
+    /* The cache keys of the copies are different; the geometry relative to the image is the same */
+    cropped.stageKeys[stageProcessed] = processedValid ? cropped.calculateStageKey(stageProcessed) : 0;
+    if (polarValid) {
+        cropped.stageKeys[stagePolar] = cropped.calculateStageKey(stagePolar);
+    }
+
+    return cropped;
+}
+
+bool TopinoData::isCropped() const {
+    return !fullSize.isEmpty();
+}
+
+QPoint TopinoData::getCropOffset() const {
+    return cropOffset;
+}
+
+QSize TopinoData::getFullSize() const {
+    return fullSize;
+}
+
+QImage TopinoData::getContextImage() const {
+    return contextImage;
+}
+
+void TopinoData::setContextImage(const QImage& value) {
+    contextImage = value;
+}
+
+void TopinoData::validateCrop() {
+    /* The crop information comes from a file, so it is checked against the image it belongs to */
+    const int maximumSide = 1 << 16;
+
+    if (!isCropped()) {
+        contextImage = QImage();
+        return;
+    }
+
+    if (sourceImage.isNull()) {
+        return;
+    }
+
+    if ((fullSize.width() > maximumSide) || (fullSize.height() > maximumSide) ||
+            !QRect(QPoint(0, 0), fullSize).contains(QRect(cropOffset, sourceImage.size()))) {
+        qDebug("Crop region does not fit into the full image. Crop information dropped.");
+        cropOffset = QPoint();
+        fullSize = QSize();
+        contextImage = QImage();
+    }
 }
 
 QPointF TopinoData::getCoordOrigin() const {
@@ -135,8 +342,11 @@ void TopinoData::removeInlet(int ID) {
              * some data here, too. */
             if (mainInletID == ID) {
                 mainInletID = 0;
-                angulagramPoints.clear();
+                angulagram = TopinoTools::SampledSignal();
+                stageKeys[stageAngulagram] = 0;
+                storedAngulagramHash = 0;
                 streamParameters.clear();
+                streamBaseline = TopinoTools::Baseline();
             };
 
             break;
@@ -157,37 +367,80 @@ TopinoData::InletData TopinoData::getInletData(int ID) const {
     return TopinoData::InletData();
 }
 
-TopinoData::ParsingError TopinoData::loadObject(QXmlStreamReader& xml) {
+TopinoData::ParsingError TopinoData::loadObject(QXmlStreamReader& xml, QByteArray *encodedImage) {
     /* Central function that loads the respective object depending on the name of the current
      * XML element; this function gets usually called by the document object */
     if (xml.name() == "sourceImage") {
-        return loadImageObject(xml);
+        return loadImageObject(xml, encodedImage);
     } else if (xml.name() == "coordinateSystem") {
         return loadCoordinateObject(xml);
     } else if (xml.name() == "inlets") {
         return loadInletsObject(xml);
     } else if (xml.name() == "stream") {
         return loadStreamParameters(xml);
+    } else if (xml.name() == "baseline") {
+        return loadStreamBaseline(xml);
+    } else if (xml.name() == "derived") {
+        return loadDerivedObject(xml);
     }
 
     /* Ignored an element */
     return ParsingError::IgnoredElement;
 }
 
-TopinoData::ParsingError TopinoData::loadImageObject(QXmlStreamReader& xml) {
+TopinoData::ParsingError TopinoData::loadImageObject(QXmlStreamReader& xml, QByteArray *encodedImage) {
     /* Read all elements of an image object and fill in the respective members; the data of
-     * source image is saved as base64 encoded PNG */
+     * source image is saved as base64 encoded PNG. Decoding large images takes a while, so the
+     * caller can also take the PNG data and decode it later (e.g. in the background). */
+    cropOffset = QPoint();
+    fullSize = QSize();
+
     while (xml.readNextStartElement()) {
 
         qDebug("Found element %s in image object...", xml.name().toString().toStdString().c_str());
 
+        /* Reference to an image file instead of the image data; resolved by the document */
+        if (xml.name() == "reference") {
+            sourceHash = xml.attributes().value("sha256").toLatin1().toLower();
+            sourceReference = xml.readElementText();
+            continue;
+        }
+
+        /* Position of a cropped image in the full frame; the context is small, so it is always decoded
+         * right away */
+        if (xml.name() == "crop") {
+            QPoint offset(xml.attributes().value("x").toInt(), xml.attributes().value("y").toInt());
+            QSize size(xml.attributes().value("fullWidth").toInt(), xml.attributes().value("fullHeight").toInt());
+            xml.readElementText();
+
+            if ((offset.x() >= 0) && (offset.y() >= 0) && !size.isEmpty()) {
+                cropOffset = offset;
+                fullSize = size;
+            } else {
+                qDebug("Invalid crop region ignored.");
+            }
+            continue;
+        }
+
+        if (xml.name() == "context") {
+            contextImage = QImage::fromData(QByteArray::fromBase64(xml.readElementText().toLatin1()), "PNG");
+            continue;
+        }
+
         if(xml.name() == "data") {
             QString text = xml.readElementText();
             QByteArray bytes;
             bytes.append(text);
             bytes = QByteArray::fromBase64(bytes);
+
+            if (encodedImage != nullptr) {
+                *encodedImage = bytes;
+                continue;
+            }
+
             sourceImage = QImage::fromData(bytes, "PNG");
             processedImage = sourceImage;
+            stageKeys[stageProcessed] = 0;
 
             if (sourceImage.isNull())
                 return ParsingError::CouldNotLoadImage;
@@ -213,23 +466,52 @@ TopinoData::ParsingError TopinoData::loadImageObject(QXmlStreamReader& xml) {
         }
     }
 
+    /* An image decoded later is checked when it is set */
+    validateCrop();
+
     /* No parsing error while loading the image */
     return ParsingError::NoFailure;
 }
 
-void TopinoData::saveImageObject(QXmlStreamWriter& xml) {
+void TopinoData::saveImageObject(QXmlStreamWriter& xml, bool includeImageData, const QString& reference) {
     /* Saves the image object and some data about it (original file name, etc) in <sourceImage> */
     xml.writeStartElement("sourceImage");
 
-    /* TODO: source file name, etc */
+    /* The image can be referenced by a (relative) path; the hash of the file content is checked when
+     * loading the document */
+    if (!reference.isEmpty()) {
+        xml.writeStartElement("reference");
+        xml.writeAttribute("sha256", QString::fromLatin1(sourceHash));
+        xml.writeCharacters(reference);
+        xml.writeEndElement();
+    }
 
     /* Actual image is converted (through a QBuffer) to a base64 encoded PNG and then written
      * into the XML as simple text element; makes it easier to edit this file with XML and
-     * text editors outside of Topino */
-    QByteArray bytes;
-    QBuffer buffer(&bytes);
-    sourceImage.save(&buffer, "PNG");
-    xml.writeTextElement("data", bytes.toBase64());
+     * text editors outside of Topino. Binary files store the image separately. */
+    if (isCropped()) {
+        /* The image is only the region; all coordinates are relative to it */
+        xml.writeStartElement("crop");
+        xml.writeAttribute("x", QString::number(cropOffset.x()));
+        xml.writeAttribute("y", QString::number(cropOffset.y()));
+        xml.writeAttribute("fullWidth", QString::number(fullSize.width()));
+        xml.writeAttribute("fullHeight", QString::number(fullSize.height()));
+        xml.writeEndElement();
+
+        if (includeImageData && reference.isEmpty() && !contextImage.isNull()) {
+            QByteArray contextBytes;
+            QBuffer contextBuffer(&contextBytes);
+            contextImage.save(&contextBuffer, "PNG");
+            xml.writeTextElement("context", contextBytes.toBase64());
+        }
+    }
+
+    if (includeImageData && reference.isEmpty()) {
+        QByteArray bytes;
+        QBuffer buffer(&bytes);
+        sourceImage.save(&buffer, "PNG");
+        xml.writeTextElement("data", bytes.toBase64());
+    }
 
     /* Save the processing data, i.e. mode, min and max level; here, we also add a description
      * for the mode enum, so that the XML can be read by humans */
@@ -244,6 +526,132 @@ void TopinoData::saveImageObject(QXmlStreamWriter& xml) {
     xml.writeEndElement();
 }
 
+TopinoData::ParsingError TopinoData::loadDerivedObject(QXmlStreamReader& xml) {
+    /* Read the stored results; the derived object is saved after all parameters, so the stored
+     * angulagram can be checked right away */
+    TopinoTools::SampledSignal storedAngulagram;
+    uint angulagramHash = 0;
+
+    while (xml.readNextStartElement()) {
+        qDebug("Found element %s in derived object...", xml.name().toString().toStdString().c_str());
+
+        /* Binary data is base64 encoded (and case sensitive) */
+        if (xml.name() == "processedData") {
+            storedProcessedData = QByteArray::fromBase64(xml.readElementText().toLatin1());
+            continue;
+        } else if (xml.name() == "angulagramData") {
+            QByteArray bytes = QByteArray::fromBase64(xml.readElementText().toLatin1());
+            QDataStream stream(bytes);
+            stream.setByteOrder(QDataStream::LittleEndian);
+            stream.setFloatingPointPrecision(QDataStream::DoublePrecision);
+
+            storedAngulagram.values.resize(bytes.size() / int(sizeof(double)));
+            for (auto it = storedAngulagram.values.begin(); it != storedAngulagram.values.end(); ++it) {
+                stream >> *it;
+            }
+            continue;
+        }
+
+        QString content = xml.readElementText().toLower();
+
+        if (xml.name() == "processedHash") {
+            storedProcessedHash = content.toUInt();
+        } else if (xml.name() == "angulagramHash") {
+            angulagramHash = content.toUInt();
+        } else if (xml.name() == "angulagramStart") {
+            storedAngulagram.start = content.toDouble();
+        } else if (xml.name() == "angulagramStep") {
+            storedAngulagram.step = content.toDouble();
+        } else {
+            xml.skipCurrentElement();
+        }
+    }
+
+    if ((angulagramHash != 0) && (angulagramHash == calculateParameterHash(stageAngulagram)) &&
+            !storedAngulagram.isEmpty()) {
+        angulagram = storedAngulagram;
+        storedAngulagramHash = angulagramHash;
+    } else if (angulagramHash != 0) {
+        qDebug("Stored angulagram does not fit the parameters.");
+    }
+
+    /* No parsing error while loading the stored results */
+    return ParsingError::NoFailure;
+}
+
+void TopinoData::saveDerivedObject(QXmlStreamWriter& xml, bool includeImageData) {
+    /* Only results that fit the current parameters are saved; binary files store the gray plane of the
+     * processed image separately */
+    QImage grayPlane = getProcessedGrayPlane();
+    bool angulagramValid = !angulagram.isEmpty() && isStageUpToDate(stageAngulagram);
+
+    if (grayPlane.isNull() && !angulagramValid) {
+        return;
+    }
+
+    xml.writeStartElement("derived");
+
+    if (!grayPlane.isNull()) {
+        xml.writeTextElement("processedHash", QString::number(calculateParameterHash(stageProcessed)));
+
+        if (includeImageData) {
+            QByteArray bytes;
+            QBuffer buffer(&bytes);
+            grayPlane.save(&buffer, "PNG");
+            xml.writeTextElement("processedData", bytes.toBase64());
+        }
+    }
+
+    if (angulagramValid) {
+        QByteArray bytes;
+        QDataStream stream(&bytes, QIODevice::WriteOnly);
+        stream.setByteOrder(QDataStream::LittleEndian);
+        stream.setFloatingPointPrecision(QDataStream::DoublePrecision);
+
+        for (auto it = angulagram.values.constBegin(); it != angulagram.values.constEnd(); ++it) {
+            stream << *it;
+        }
+
+        xml.writeTextElement("angulagramHash", QString::number(calculateParameterHash(stageAngulagram)));
+        xml.writeTextElement("angulagramStart", QString::number(angulagram.start, 'g', 17));
+        xml.writeTextElement("angulagramStep", QString::number(angulagram.step, 'g', 17));
+        xml.writeTextElement("angulagramData", bytes.toBase64());
+    }
+
+    xml.writeEndElement();
+}
+
+QImage TopinoData::getProcessedGrayPlane() const {
+    /* Unprocessed images (key 0) are not worth storing */
+    if (!isImageProcessed() || !isStageUpToDate(stageProcessed) || (processedImage.depth() != 32)) {
+        return QImage();
+    }
+
+    /* All channels have the same value, so the green channel is the gray value */
+    QImage grayPlane(processedImage.size(), QImage::Format_Grayscale8);
+
+    for (int y = 0; y < processedImage.height(); ++y) {
+        const QRgb *line = reinterpret_cast<const QRgb *>(processedImage.constScanLine(y));
+        uchar *grayLine = grayPlane.scanLine(y);
+
+        for (int x = 0; x < processedImage.width(); ++x) {
+            grayLine[x] = uchar(qGreen(line[x]));
+        }
+    }
+
+    return grayPlane;
+}
+
+void TopinoData::setStoredProcessedImage(const QImage& grayPlane) {
+    storedProcessedImage = grayPlane;
+    storedProcessedData.clear();
+}
+
+void TopinoData::setStoredProcessedData(const QByteArray& encodedGrayPlane) {
+    storedProcessedImage = QImage();
+    storedProcessedData = encodedGrayPlane;
+}
+
 TopinoData::ParsingError TopinoData::loadCoordinateObject(QXmlStreamReader& xml) {
     /* Read all elements of the coordinate object and fill in the respective members */
     while (xml.readNextStartElement()) {
@@ -406,6 +814,32 @@ TopinoData::ParsingError TopinoData::loadStreamParameters(QXmlStreamReader& xml)
             data.offset = content.toDouble();
         } else if (xml.name() == "rsquare") {
             data.rsquare = content.toDouble();
+        } else if (xml.name() == "model") {
+            int model = content.toInt();
+
+            if ((model >= 0) && (model < TopinoTools::peakModels::modelCOUNT)) {
+                data.model = TopinoTools::peakModels(model);
+            }
+        } else if (xml.name() == "shape") {
+            data.shape = content.toDouble();
+        } else if (xml.name() == "posCILower") {
+            data.posCI.lower = content.toDouble();
+        } else if (xml.name() == "posCIUpper") {
+            data.posCI.upper = content.toDouble();
+        } else if (xml.name() == "widthCILower") {
+            data.widthCI.lower = content.toDouble();
+        } else if (xml.name() == "widthCIUpper") {
+            data.widthCI.upper = content.toDouble();
+        } else if (xml.name() == "resolutionCI") {
+            /* Lower and upper bounds to the following streams separated by white spaces */
+            QStringList values = content.split(' ', QString::SkipEmptyParts);
+
+            for(int i = 0; (i + 1) < values.length(); i += 2) {
+                TopinoTools::ConfidenceInterval interval;
+                interval.lower = values[i].toDouble();
+                interval.upper = values[i+1].toDouble();
+                data.resolutionCIs.append(interval);
+            }
         } else {
             xml.skipCurrentElement();
         }
@@ -428,11 +862,113 @@ void TopinoData::saveStreamParameters(QXmlStreamWriter& xml) {
         xml.writeTextElement("height", QString::number(it->height));
         xml.writeTextElement("offset", QString::number(it->offset));
         xml.writeTextElement("rsquare", QString::number(it->rsquare));
+        xml.writeTextElement("model", QString::number(it->model));
+        xml.writeTextElement("shape", QString::number(it->shape));
+
+        /* Confidence intervals (only if calculated) */
+        if (!it->posCI.isNull() || !it->widthCI.isNull()) {
+            xml.writeTextElement("posCILower", QString::number(it->posCI.lower));
+            xml.writeTextElement("posCIUpper", QString::number(it->posCI.upper));
+            xml.writeTextElement("widthCILower", QString::number(it->widthCI.lower));
+            xml.writeTextElement("widthCIUpper", QString::number(it->widthCI.upper));
+        }
+
+        if (!it->resolutionCIs.isEmpty()) {
+            QStringList values;
+            for(auto interval = it->resolutionCIs.begin(); interval != it->resolutionCIs.end(); ++interval) {
+                values.append(QString::number(interval->lower));
+                values.append(QString::number(interval->upper));
+            }
+
+            xml.writeTextElement("resolutionCI", values.join(' '));
+        }
 
         xml.writeEndElement();
     }
 }
 
+TopinoData::ParsingError TopinoData::loadStreamBaseline(QXmlStreamReader& xml) {
+    /* Read all elements of the baseline object and fill in the respective members */
+    TopinoTools::Baseline data;
+
+    while (xml.readNextStartElement()) {
+        /* Binary data is base64 encoded (and case sensitive) */
+        if (xml.name() == "data") {
+            QByteArray bytes = QByteArray::fromBase64(xml.readElementText().toLatin1());
+            QDataStream stream(bytes);
+            stream.setByteOrder(QDataStream::LittleEndian);
+            stream.setFloatingPointPrecision(QDataStream::DoublePrecision);
+
+            data.signal.values.resize(bytes.size() / int(sizeof(double)));
+            for (auto it = data.signal.values.begin(); it != data.signal.values.end(); ++it) {
+                stream >> *it;
+            }
+            continue;
+        }
+
+        /* Read content of element and parse it */
+        QString content = xml.readElementText().toLower();
+
+        if (xml.name() == "lambda") {
+            data.lambda = content.toDouble();
+        } else if (xml.name() == "asymmetry") {
+            data.asymmetry = content.toDouble();
+        } else if (xml.name() == "start") {
+            data.signal.start = content.toDouble();
+        } else if (xml.name() == "step") {
+            data.signal.step = content.toDouble();
+        } else if (xml.name() == "points") {
+            /* Older files: pairs of x- and y-values separated by white spaces (on the grid of the angulagram) */
+            QStringList values = content.split(' ', QString::SkipEmptyParts);
+
+            data.signal.values.clear();
+            for(int i = 0; (i + 1) < values.length(); i += 2) {
+                data.signal.values.append(values[i+1].toDouble());
+            }
+
+            if (values.length() >= 2) {
+                data.signal.start = values[0].toDouble();
+            }
+            if (values.length() >= 4) {
+                data.signal.step = values[2].toDouble() - values[0].toDouble();
+            }
+        } else {
+            xml.skipCurrentElement();
+        }
+    }
+
+    streamBaseline = data;
+
+    /* No parsing error while loading the baseline */
+    return ParsingError::NoFailure;
+}
+
+void TopinoData::saveStreamBaseline(QXmlStreamWriter& xml) {
+    /* Save the baseline the streams were fitted on (if any) */
+    if (streamBaseline.isNull()) {
+        return;
+    }
+
+    QByteArray bytes;
+    QDataStream stream(&bytes, QIODevice::WriteOnly);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    stream.setFloatingPointPrecision(QDataStream::DoublePrecision);
+
+    for (auto it = streamBaseline.signal.values.constBegin(); it != streamBaseline.signal.values.constEnd(); ++it) {
+        stream << *it;
+    }
+
+    xml.writeStartElement("baseline");
+
+    xml.writeTextElement("lambda", QString::number(streamBaseline.lambda));
+    xml.writeTextElement("asymmetry", QString::number(streamBaseline.asymmetry));
+    xml.writeTextElement("start", QString::number(streamBaseline.signal.start, 'g', 17));
+    xml.writeTextElement("step", QString::number(streamBaseline.signal.step, 'g', 17));
+    xml.writeTextElement("data", bytes.toBase64());
+
+    xml.writeEndElement();
+}
+
 bool TopinoData::getInversion() const {
     return inversion;
 }
@@ -471,75 +1007,355 @@ QImage TopinoData::getProcessedImage() const {
 
 void TopinoData::setProcessedImage(const QImage& value) {
     processedImage = value;
+    stageKeys[stageProcessed] = 0;
 }
 
-void TopinoData::processImage() {
-    /* Start with the source image */
-    processedImage = sourceImage;
+uint TopinoData::calculateStageKey(TopinoData::pipelineStages stage) const {
+    /* The input of each stage is identified by the cache key of the image it is calculated from;
+     * this key changes whenever the image (data) changes. */
+    uint key = 0;
+
+    switch (stage) {
+    case stageProcessed:
+        key = qHash(sourceImage.cacheKey(), key);
+        key = qHash(inversion, key);
+        key = qHash(int(desatMode), key);
+        key = qHash(levelMin, key);
+        key = qHash(levelMax, key);
+        break;
+
+    case stagePolar: {
+        TopinoData::InletData mainInletData = getInletData(mainInletID);
+        key = qHash(processedImage.cacheKey(), key);
+        key = qHash(mainInletID, key);
+        key = qHash(mainInletData.coord.x(), key);
+        key = qHash(mainInletData.coord.y(), key);
+        key = qHash(mainInletData.radius, key);
+        key = qHash(neutralAngle, key);
+        key = qHash(minAngle, key);
+        key = qHash(maxAngle, key);
+        key = qHash(outerRadius, key);
+        break;
+    }
 
-    /* Invert if needed */
-    if (inversion) {
-        processedImage.invertPixels();
+    case stageAngulagram:
+        key = qHash(polarImage.cacheKey(), key);
+        key = qHash(mainInletID, key);
+        key = qHash(minAngle, key);
+        key = qHash(counterClockwise, key);
+        break;
+
+    case stageRadialgram:
+        key = qHash(polarImage.cacheKey(), key);
+        key = qHash(mainInletID, key);
+        break;
+
+    default:
+        break;
     }
 
-    /* Iterate over all pixels and apply desaturation method. Count the
-     * values for the histogram in the same run. */
-    int pixelCount = processedImage.width() * processedImage.height();
-    QRgb *pixels = reinterpret_cast<QRgb *>(processedImage.bits());
+    /* 0 is reserved for "not calculated" */
+    return (key == 0) ? 1 : key;
+}
 
-    /* Process all pixels individually */
-    qreal scale = 255.0 / (qreal)(levelMax - levelMin);
-    for (int p = 0; p < pixelCount; ++p) {
-        /* The value calculated depends on the method selected */
-        int value = 0;
-
-        switch(desatMode) {
-        /* Luminance method */
-        case TopinoTools::desaturationModes::desatLuminance:
-            value = TopinoTools::qLuminance(pixels[p]);
-            break;
+uint TopinoData::calculateParameterHash(TopinoData::pipelineStages stage) const {
+    /* Same parameters as the keys of the stages, but chained through the hashes of the stages before
+     * instead of the cache keys of the images. The parameters are serialized and hashed with a stable
+     * cryptographic hash, since the hash is compared with hashes of other sessions (and machines). */
+    QByteArray parameters;
+    QDataStream stream(&parameters, QIODevice::WriteOnly);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    stream.setFloatingPointPrecision(QDataStream::DoublePrecision);
+
+    switch (stage) {
+    case stageProcessed:
+        stream << inversion << qint32(desatMode) << qint32(levelMin) << qint32(levelMax);
+        break;
+
+    case stagePolar: {
+        TopinoData::InletData mainInletData = getInletData(mainInletID);
+        stream << calculateParameterHash(stageProcessed) << qint32(mainInletID);
+        stream << mainInletData.coord.x() << mainInletData.coord.y() << qint32(mainInletData.radius);
+        stream << qint32(neutralAngle) << qint32(minAngle) << qint32(maxAngle) << qint32(outerRadius);
+        break;
+    }
 
-        /* Average method */
-        case TopinoTools::desaturationModes::desatAverage:
-            value = TopinoTools::qAverage(pixels[p]);
-            break;
+    case stageAngulagram:
+        stream << calculateParameterHash(stagePolar) << qint32(minAngle) << counterClockwise;
+        break;
 
-        /* Maximum method */
-        case TopinoTools::desaturationModes::desatMaximum:
-            value = TopinoTools::qMaximum(pixels[p]);
-            break;
+    case stageRadialgram:
+        stream << calculateParameterHash(stagePolar);
+        break;
 
-        /* Red channel */
-        case TopinoTools::desaturationModes::desatRed:
-            value = qRed(pixels[p]);
-            break;
+    default:
+        break;
+    }
 
-        /* Green channel */
-        case TopinoTools::desaturationModes::desatGreen:
-            value = qGreen(pixels[p]);
-            break;
+    stream << qint32(stage);
 
-        /* Blue channel */
-        case TopinoTools::desaturationModes::desatBlue:
-            value = qBlue(pixels[p]);
-            break;
+    QByteArray hash = QCryptographicHash::hash(parameters, QCryptographicHash::Sha1);
+    uint key = qFromLittleEndian<quint32>(reinterpret_cast<const uchar *>(hash.constData()));
+
+    /* 0 is reserved for "not stored" */
+    return (key == 0) ? 1 : key;
+}
+
+bool TopinoData::isStageUpToDate(TopinoData::pipelineStages stage) const {
+    switch (stage) {
+    /* Processing is applied explicitly; an unprocessed image (key 0) is up to date, too */
+    case stageProcessed:
+        return (stageKeys[stageProcessed] == 0) || (stageKeys[stageProcessed] == calculateStageKey(stageProcessed));
+
+    case stagePolar:
+        return isStageUpToDate(stageProcessed) && (stageKeys[stagePolar] == calculateStageKey(stagePolar));
+
+    /* A stored angulagram has no polar image; it is up to date as long as the parameters fit */
+    case stageAngulagram:
+        if ((storedAngulagramHash != 0) && (storedAngulagramHash == calculateParameterHash(stageAngulagram))) {
+            return true;
+        }
+        return isStageUpToDate(stagePolar) && (stageKeys[stage] == calculateStageKey(stage));
+
+    case stageRadialgram:
+        return isStageUpToDate(stagePolar) && (stageKeys[stage] == calculateStageKey(stage));
+
+    default:
+        return false;
+    }
+}
+
+bool TopinoData::updateStage(TopinoData::pipelineStages stage, const TopinoData::ProgressCallback& progress) {
+    /* Each calculation checks its own key, so simply go through the stages in order */
+    if (!isStageUpToDate(stageProcessed)) {
+        processImage();
+    }
+
+    if (stage == stageProcessed) {
+        return true;
+    }
+
+    if (!calculatePolarImage(progress)) {
+        return false;
+    }
+
+    if (stage == stageAngulagram) {
+        calculateAngulagramPoints();
+    } else if (stage == stageRadialgram) {
+        calculateRadialgramPoints();
+    }
+
+    return true;
+}
+
+bool TopinoData::takeStageResults(const TopinoData& other) {
+    /* Go through the stages in order; each stage is only taken over if it was calculated with the
+     * parameters of this object. Since the keys include the input image of the stage, a stage can
+     * only fit if the stage before was taken over (or was already the same). */
+    for (int i = 0; i < stageCOUNT; ++i) {
+        pipelineStages stage = pipelineStages(i);
 
-        /* Lightness method (default) */
-        case TopinoTools::desaturationModes::desatLightness:
+        if ((other.stageKeys[stage] == 0) || (other.stageKeys[stage] == stageKeys[stage])) {
+            continue;
+        }
+
+        if (other.stageKeys[stage] != calculateStageKey(stage)) {
+            qDebug("Stage %d of other data does not fit the current parameters.", i);
+            return false;
+        }
+
+        switch (stage) {
+        case stageProcessed:
+            processedImage = other.processedImage;
+            break;
+        case stagePolar:
+            polarImage = other.polarImage;
+            break;
+        case stageAngulagram:
+            angulagram = other.angulagram;
+            storedAngulagramHash = 0;
+            break;
+        case stageRadialgram:
+            radialgram = other.radialgram;
+            break;
         default:
-            value = TopinoTools::qLightness(pixels[p]);
             break;
         }
 
-        /* Subtract the bottom value; since all the channels are the same
-         * it does not really matter which channel we use here. */
-        value = qMax(0, value - levelMin);
+        stageKeys[stage] = other.stageKeys[stage];
+    }
+
+    return true;
+}
+
+/* Desaturates a single pixel; the value calculated depends on the method selected */
+static int desaturatePixel(QRgb pixel, TopinoTools::desaturationModes mode) {
+    switch(mode) {
+    /* Luminance method */
+    case TopinoTools::desaturationModes::desatLuminance:
+        return TopinoTools::qLuminance(pixel);
+
+    /* Average method */
+    case TopinoTools::desaturationModes::desatAverage:
+        return TopinoTools::qAverage(pixel);
+
+    /* Maximum method */
+    case TopinoTools::desaturationModes::desatMaximum:
+        return TopinoTools::qMaximum(pixel);
+
+    /* Red channel */
+    case TopinoTools::desaturationModes::desatRed:
+        return qRed(pixel);
+
+    /* Green channel */
+    case TopinoTools::desaturationModes::desatGreen:
+        return qGreen(pixel);
+
+    /* Blue channel */
+    case TopinoTools::desaturationModes::desatBlue:
+        return qBlue(pixel);
+
+    /* Lightness method (default) */
+    case TopinoTools::desaturationModes::desatLightness:
+    default:
+        return TopinoTools::qLightness(pixel);
+    }
+}
+
+void TopinoData::processImage() {
+    /* Nothing to do if the image was already processed with the same parameters */
+    uint key = calculateStageKey(stageProcessed);
+    if (stageKeys[stageProcessed] == key) {
+        qDebug("Image already processed with these parameters.");
+        return;
+    }
+
+    /* A processed image stored in the document saves the whole processing */
+    if (restoreProcessedImage()) {
+        qDebug("Processed image restored from document.");
+        stageKeys[stageProcessed] = key;
+        return;
+    }
+
+    /* The source image is only read, line by line, so that images using memory they do not own (e.g.
+     * mapped frames) are never copied. Gray images with 8 or 16 bits and RGB images are read as they
+     * are; other formats are converted first. */
+    QImage source = sourceImage;
+
+    switch (source.format()) {
+    case QImage::Format_Grayscale8:
+    case QImage::Format_Grayscale16:
+    case QImage::Format_RGB888:
+    case QImage::Format_RGB32:
+    case QImage::Format_ARGB32:
+    case QImage::Format_ARGB32_Premultiplied:
+        break;
+    default:
+        source = source.convertToFormat(QImage::Format_RGB32);
+        break;
+    }
+
+    processedImage = QImage(source.size(), QImage::Format_RGB32);
+
+    /* The levels are given for 8 bits; 16 bit values are reduced to 8 bits only after the levels are
+     * applied, so that narrow levels keep the resolution of the source. Gray values are the same for
+     * all desaturation methods. */
+    qreal scale = 255.0 / (qreal)(levelMax - levelMin);
+
+    for (int y = 0; y < source.height(); ++y) {
+        const uchar *sourceLine = source.constScanLine(y);
+        QRgb *line = reinterpret_cast<QRgb *>(processedImage.scanLine(y));
+
+        for (int x = 0; x < source.width(); ++x) {
+            int value = 0;
+
+            if (source.format() == QImage::Format_Grayscale16) {
+                int gray = reinterpret_cast<const quint16 *>(sourceLine)[x];
+                gray = inversion ? (65535 - gray) : gray;
+
+                value = qMin(255, (int)(qMax(0, gray - levelMin * 257) * scale / 257.0));
+                line[x] = qRgb(value, value, value);
+                continue;
+            }
+
+            if (source.format() == QImage::Format_Grayscale8) {
+                value = inversion ? (255 - sourceLine[x]) : sourceLine[x];
+            } else {
+                QRgb pixel = (source.format() == QImage::Format_RGB888) ?
+                             qRgb(sourceLine[3 * x], sourceLine[3 * x + 1], sourceLine[3 * x + 2]) :
+                             reinterpret_cast<const QRgb *>(sourceLine)[x];
+
+                /* Invert if needed (the alpha channel is kept) */
+                if (inversion) {
+                    pixel ^= 0x00ffffff;
+                }
+
+                value = desaturatePixel(pixel, desatMode);
+            }
+
+            /* Subtract the bottom value and multiply with the scale */
+            value = qMax(0, value - levelMin);
+            value = qMin(255, (int)(value * scale));
+
+            /* Apply new desaturated value */
+            line[x] = qRgb(value, value, value);
+        }
+    }
+
+    stageKeys[stageProcessed] = key;
+}
+
+bool TopinoData::restoreProcessedImage() {
+    if ((storedProcessedHash == 0) || (storedProcessedHash != calculateParameterHash(stageProcessed))) {
+        return false;
+    }
+
+    /* Encoded images are decoded only now, since the processing might have changed after loading */
+    if (storedProcessedImage.isNull() && !storedProcessedData.isEmpty()) {
+        storedProcessedImage = QImage::fromData(storedProcessedData, "PNG").convertToFormat(QImage::Format_Grayscale8);
+        storedProcessedData.clear();
+    }
+
+    if (storedProcessedImage.isNull() || (storedProcessedImage.size() != sourceImage.size()) ||
+            (storedProcessedImage.format() != QImage::Format_Grayscale8)) {
+        return false;
+    }
+
+    /* All channels of the processed image have the gray value; copied by hand to keep the values exact */
+    processedImage = QImage(storedProcessedImage.size(), QImage::Format_RGB32);
+
+    for (int y = 0; y < processedImage.height(); ++y) {
+        const uchar *grayLine = storedProcessedImage.constScanLine(y);
+        QRgb *line = reinterpret_cast<QRgb *>(processedImage.scanLine(y));
+
+        for (int x = 0; x < processedImage.width(); ++x) {
+            line[x] = qRgb(grayLine[x], grayLine[x], grayLine[x]);
+        }
+    }
+
+    return true;
+}
+
+void TopinoData::detachImages() {
+    /* The cache keys of the copies are different, so the keys of valid stages are renewed */
+    bool processedValid = (stageKeys[stageProcessed] != 0) && (stageKeys[stageProcessed] == calculateStageKey(stageProcessed));
+    bool polarValid = (stageKeys[stagePolar] != 0) && (stageKeys[stagePolar] == calculateStageKey(stagePolar));
+    bool processedShared = (processedImage.cacheKey() == sourceImage.cacheKey());
 
-        /* Multiply with the scale */
-        value = qMin(255, (int)(value * scale));
+    sourceImage = sourceImage.copy();
+    storedProcessedImage = storedProcessedImage.copy();
 
-        /* Apply new desaturated value */
-        pixels[p] = qRgb(value, value, value);
+    /* A processed image of its own was calculated, so only the unprocessed image has to be replaced */
+    if (processedShared) {
+        processedImage = sourceImage;
+    }
+
+    if (processedValid) {
+        stageKeys[stageProcessed] = calculateStageKey(stageProcessed);
+    }
+
+    if (polarValid) {
+        stageKeys[stagePolar] = calculateStageKey(stagePolar);
     }
 }
 
@@ -552,9 +1368,44 @@ void TopinoData::resetProcessing() {
 
     /* Reset image as well */
     processedImage = sourceImage;
+    stageKeys[stageProcessed] = 0;
+}
+
+bool TopinoData::isImageProcessed() const {
+    return stageKeys[stageProcessed] != 0;
 }
 
-void TopinoData::calculatePolarImage() {
+/* Intensity of a pixel of the image the polar image is sampled from. A processed image has the signal
+ * in all channels (green is used); an image that is not processed yet can have any format, e.g. an 8 or
+ * 16 bit frame using the memory of a mapped file, which is read as it is. */
+static int sampleIntensity(const QImage& image, int x, int y) {
+    const uchar *line = image.constScanLine(y);
+
+    switch (image.format()) {
+    case QImage::Format_RGB32:
+    case QImage::Format_ARGB32:
+    case QImage::Format_ARGB32_Premultiplied:
+        return qGreen(reinterpret_cast<const QRgb *>(line)[x]);
+    case QImage::Format_Grayscale8:
+        return line[x];
+    case QImage::Format_Grayscale16:
+        return reinterpret_cast<const quint16 *>(line)[x] >> 8;
+    case QImage::Format_RGB888:
+        return line[3 * x + 1];
+    default:
+        return qGreen(image.pixel(x, y));
+    }
+}
+
+bool TopinoData::calculatePolarImage(const TopinoData::ProgressCallback& progress) {
+    /* Nothing to do if the polar image was calculated from the same image and parameters */
+    uint key = calculateStageKey(stagePolar);
+    if (stageKeys[stagePolar] == key) {
+        qDebug("Polar image is up to date.");
+        return true;
+    }
+    stageKeys[stagePolar] = key;
+
     qDebug("Calculate polar image");
 
     /* Check for the main inlet. If not defined, we set the polar image to
@@ -563,7 +1414,7 @@ void TopinoData::calculatePolarImage() {
         qDebug("No main inlet defined. Did not calculate a polar image.");
         polarImage = QImage();
 
-        return;
+        return true;
     }
 
     /* Need the data of the main inlet (radii, etc) */
@@ -580,8 +1431,17 @@ void TopinoData::calculatePolarImage() {
      * image to a RGB color (each channel intensity = signal). Using the direct access to
      * bit data of the image ensures high performance. */
     QRgb *polarPixels = reinterpret_cast<QRgb *>(polarImage.bits());
-    QRgb *processedPixels = reinterpret_cast<QRgb *>(processedImage.bits());
     for (int r = 0; r < outerRadius; ++r) {
+        /* Report the progress once per radius; stop if the calculation was canceled. The polar image
+         * is invalid in this case. */
+        if (progress && !progress(r * 100 / outerRadius)) {
+            qDebug("Calculation of polar image canceled.");
+            polarImage = QImage();
+            stageKeys[stagePolar] = 0;
+
+            return false;
+        }
+
         for (int a = 0; a < angleSteps; ++a ) {
             /* Ignore the inner radius of the inlet (garbage data) */
             if (r < mainInletData.radius)
@@ -602,20 +1462,31 @@ void TopinoData::calculatePolarImage() {
             int intensity = 0;
 
             if ((x > 0) && (x < processedImage.width()) && (y > 0) && (y < processedImage.height())) {
-                intensity = qGreen(processedPixels[y * processedImage.width() + x]);
+                intensity = sampleIntensity(processedImage, x, y);
             }
 
             /* Write to the polar pixels. Here, x = r and y = a */
             polarPixels[a * polarImage.width() + r] = qRgb(intensity, intensity, intensity);
         }
     }
+
+    return true;
 }
 
 void TopinoData::calculateAngulagramPoints() {
+    /* Nothing to do if the angulagram was calculated from the same polar image */
+    uint key = calculateStageKey(stageAngulagram);
+    if (stageKeys[stageAngulagram] == key) {
+        qDebug("Angulagram is up to date.");
+        return;
+    }
+    stageKeys[stageAngulagram] = key;
+
     qDebug("Calculate angulagram points");
 
-    /* Clear old points */
-    angulagramPoints.clear();
+    /* Clear old points (including stored ones) */
+    angulagram = TopinoTools::SampledSignal();
+    storedAngulagramHash = 0;
 
     /* Make sure the image has been created */
     if (polarImage.isNull() || (mainInletID == 0)) {
@@ -625,7 +1496,7 @@ void TopinoData::calculateAngulagramPoints() {
     }
 
     /* Process all the data of the image and integrate over the x-axis (radius) */
-    QRgb *polarPixels = reinterpret_cast<QRgb *>(polarImage.bits());
+    const QRgb *polarPixels = reinterpret_cast<const QRgb *>(polarImage.constBits());
     int width = polarImage.width();
     int height = polarImage.height();
 
@@ -633,6 +1504,12 @@ void TopinoData::calculateAngulagramPoints() {
      * on counterclockwise */
     qreal xFactor = counterClockwise ? 1.0 : -1.0;
 
+    /* The angle of each point is minAngle + y * 0.1° - this is how we created the image in the
+     * previous step (see calculatePolarImage() above). So only the intensities are stored. */
+    angulagram.start = minAngle * xFactor;
+    angulagram.step = 0.1 * xFactor;
+    angulagram.values.resize(height);
+
     for (int y = 0; y < height; ++y) {
         /* Integrate over x-axis (radius). Again, the intensities of each channel
          * should be the same, so we just take the green channel here. */
@@ -642,24 +1519,87 @@ void TopinoData::calculateAngulagramPoints() {
             intensity += qGreen(polarPixels[y * width + x]);
         }
 
-        /* Finally, add the data point to the angulagram data. The angle is
-         * minAngle + y * 0.1° - this is how we created the image in the
-         * previous step (see calculatePolarImage() above). */
-        angulagramPoints.append(QPointF((minAngle + y * 0.1) * xFactor, intensity));
+        /* Finally, add the data point to the angulagram data. */
+        angulagram.values[y] = intensity;
     }
 
     qDebug("Angulagram has been calculated");
 }
 
-QVector<QPointF> TopinoData::getAngulagramPoints() const {
-    return angulagramPoints;
+TopinoTools::SampledSignal TopinoData::getAngulagram() const {
+    return angulagram;
+}
+
+TopinoData::PolarGeometry TopinoData::getPolarGeometry() const {
+    TopinoData::InletData mainInletData = getInletData(mainInletID);
+
+    PolarGeometry geometry;
+    geometry.origin = mainInletData.coord;
+    geometry.innerRadius = mainInletData.radius;
+    geometry.outerRadius = outerRadius;
+    geometry.neutralAngle = neutralAngle;
+    geometry.minAngle = minAngle;
+    geometry.maxAngle = maxAngle;
+    geometry.counterClockwise = counterClockwise;
+
+    return geometry;
+}
+
+TopinoTools::SampledSignal TopinoData::calculateAngulagramPreview(const QImage& image, const TopinoData::PolarGeometry& geometry,
+                                                                  qreal angleStep, int radiusStep) {
+    TopinoTools::SampledSignal preview;
+
+    if (image.isNull() || (angleStep <= 0.0) || (radiusStep <= 0) || (geometry.maxAngle <= geometry.minAngle)) {
+        return preview;
+    }
+
+    /* Same orientation of the angles as the full angulagram (see calculateAngulagramPoints() above) */
+    qreal xFactor = geometry.counterClockwise ? 1.0 : -1.0;
+    int angleSteps = int((geometry.maxAngle - geometry.minAngle) / angleStep);
+
+    preview.start = geometry.minAngle * xFactor;
+    preview.step = angleStep * xFactor;
+    preview.values.resize(angleSteps);
+
+    /* Sample the image directly along each ray instead of creating the polar image first; the sine and
+     * cosine are only calculated once per angle. Only every n-th radius is taken into account. */
+    int width = image.width();
+    int height = image.height();
+
+    for (int a = 0; a < angleSteps; ++a) {
+        qreal angle = qDegreesToRadians(geometry.neutralAngle + geometry.minAngle + a * angleStep);
+        qreal cosAngle = qCos(angle);
+        qreal sinAngle = qSin(angle);
+
+        int intensity = 0;
+        for (int r = geometry.innerRadius; r < geometry.outerRadius; r += radiusStep) {
+            int x = geometry.origin.x() + int(qRound(r * cosAngle));
+            int y = geometry.origin.y() - int(qRound(r * sinAngle));
+
+            if ((x > 0) && (x < width) && (y > 0) && (y < height)) {
+                intensity += sampleIntensity(image, x, y);
+            }
+        }
+
+        preview.values[a] = intensity;
+    }
+
+    return preview;
 }
 
 void TopinoData::calculateRadialgramPoints() {
+    /* Nothing to do if the radialgram was calculated from the same polar image */
+    uint key = calculateStageKey(stageRadialgram);
+    if (stageKeys[stageRadialgram] == key) {
+        qDebug("Radialgram is up to date.");
+        return;
+    }
+    stageKeys[stageRadialgram] = key;
+
     qDebug("Calculate radialgram points");
 
     /* Clear old points */
-    radialgramPoints.clear();
+    radialgram = TopinoTools::SampledSignal();
 
     /* Make sure the image has been created */
     if (polarImage.isNull() || (mainInletID == 0)) {
@@ -669,12 +1609,16 @@ void TopinoData::calculateRadialgramPoints() {
     }
 
     /* Process all the data of the image and integrate over the x-axis (radius) */
-    QRgb *polarPixels = reinterpret_cast<QRgb *>(polarImage.bits());
+    const QRgb *polarPixels = reinterpret_cast<const QRgb *>(polarImage.constBits());
     int width = polarImage.width();
     int height = polarImage.height();
 
     /* Simply go over the image x-axis (= radius) and integrate over y. In this case
-     * the angle sign etc. does not matter. */
+     * the angle sign etc. does not matter. The radius is simply the index. */
+    radialgram.start = 0.0;
+    radialgram.step = 1.0;
+    radialgram.values.resize(width);
+
     for (int x = 0; x < width; ++x) {
         /* Integrate over y-axis (angle). Again, the intensities of each channel
          * should be the same, so we just take the green channel here. */
@@ -685,14 +1629,14 @@ void TopinoData::calculateRadialgramPoints() {
         }
 
         /* Finally, add the data point to the radialgram data. */
-        radialgramPoints.append(QPointF(x * 1.0, intensity));
+        radialgram.values[x] = intensity;
     }
 
-    qDebug("Radialgram has been calculated with %d points.", radialgramPoints.length());
+    qDebug("Radialgram has been calculated with %d points.", radialgram.length());
 }
 
-QVector<QPointF> TopinoData::getRadialgramPoints() const {
-    return radialgramPoints;
+TopinoTools::SampledSignal TopinoData::getRadialgram() const {
+    return radialgram;
 }
 
 int TopinoData::getCoordOuterRadius() const {
@@ -704,7 +1648,7 @@ void TopinoData::setCoordOuterRadius(int value) {
 }
 
 bool TopinoData::isAngulagramAvailable() const {
-    return angulagramPoints.length() > 0;
+    return !angulagram.isEmpty();
 }
 
 QVector<TopinoTools::Lorentzian> TopinoData::getStreamParameters() const {
@@ -715,6 +1659,14 @@ void TopinoData::setStreamParameters(const QVector<TopinoTools::Lorentzian>& val
     streamParameters = value;
 }
 
+TopinoTools::Baseline TopinoData::getStreamBaseline() const {
+    return streamBaseline;
+}
+
+void TopinoData::setStreamBaseline(const TopinoTools::Baseline& value) {
+    streamBaseline = value;
+}
+
 QImage TopinoData::getPolarImage() const {
     return polarImage;
 }
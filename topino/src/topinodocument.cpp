@@ -1,14 +1,22 @@
 #include "include/topinodocument.h"
 
 #include <algorithm>
+#include <climits>
+#include <cstring>
 
 #include <QObject>
 #include <QFile>
 #include <QFileInfo>
+#include <QDir>
+#include <QSaveFile>
+#include <QSharedPointer>
+#include <QtEndian>
 #include <QXmlStreamReader>
 #include <QXmlStreamWriter>
 #include <QBuffer>
 
+#include "include/mappedimagereader.h"
+
 TopinoDocument::TopinoDocument() {
     filename = QObject::tr("Unnamed");
 }
@@ -28,25 +36,49 @@ void TopinoDocument::removeObserver(IObserver *observer) {
         observers.erase(item);
 }
 
-void TopinoDocument::notifyAllObserver() const {
+void TopinoDocument::notifyAllObserver(int changes) const {
     for (auto observer : observers)
-        observer->modelHasChanged();
+        observer->modelHasChanged(changes);
 }
 
 bool TopinoDocument::hasChanged() const {
     return changed;
 }
 
-void TopinoDocument::modify() {
+void TopinoDocument::modify(int changes) {
+    /* The saved state changes, too */
     changed = true;
-    notifyAllObserver();
+    ++revision;
+
+    if (changes & IObserver::changeImage) {
+        imageSaved = false;
+    }
+
+    notifyAllObserver(changes | IObserver::changeFile);
 }
 
 void TopinoDocument::saveChanges() {
+    /* A cropped copy of the image is not the image of the document */
     changed = false;
+    imageSaved = prepareCropRegion().isEmpty();
+}
+
+quint64 TopinoDocument::getRevision() const {
+    return revision;
+}
+
+TopinoDocument TopinoDocument::createSnapshot() const {
+    /* Copying is cheap, since the images and lists are implicitly shared */
+    TopinoDocument snapshot(*this);
+    snapshot.observers.clear();
+    snapshot.undoSteps.clear();
+    snapshot.redoSteps.clear();
+    snapshot.undoMemory = 0;
+
+    return snapshot;
 }
 
-TopinoDocument::FileError TopinoDocument::loadFromXML(const QString& xmlfilename) {
+TopinoDocument::FileError TopinoDocument::loadFromXML(const QString& xmlfilename, QByteArray *encodedImage) {
     /* Try to open the file from xmlfilename, which should
        include the whole path */
     QFile f(xmlfilename);
@@ -65,7 +97,7 @@ TopinoDocument::FileError TopinoDocument::loadFromXML(const QString& xmlfilename
     while (!xml.atEnd()) {
         if (xml.readNext() != QXmlStreamReader::EndDocument) {
             if (xml.isStartElement() && xml.name() == "topino") {
-                FileError err = readTopinoXML(xml);
+                FileError err = readTopinoXML(xml, encodedImage);
 
                 if (err != FileError::NoFailure)
                     return err;
@@ -86,11 +118,18 @@ TopinoDocument::FileError TopinoDocument::loadFromXML(const QString& xmlfilename
     filename = fi.fileName();
     path = fi.absolutePath();
 
-    /* Apply processing parameters */
-    data.processImage();
+    FileError err = resolveImageReference(encodedImage);
+    if (err != FileError::NoFailure)
+        return err;
+
+    /* Apply processing parameters (unless the caller does it) */
+    if (encodedImage == nullptr) {
+        data.processImage();
+    }
 
     /* Freshly opened files are not changed (yet) */
     changed = false;
+    imageSaved = true;
 
     return FileError::NoFailure;
 }
@@ -107,7 +146,9 @@ TopinoDocument::FileError TopinoDocument::saveToXML(const QString& xmlfilename)
     if (filename.length() == 0 || path.length() == 0)
         return FileError::FileNameOrPathNotSet;
 
-    QFile f(path + "/" + filename);
+    /* Write into a temporary file that replaces the old one when finished, so that an aborted save never
+     * leaves a broken file behind */
+    QSaveFile f(path + "/" + filename);
 
     if (!f.open(QFile::WriteOnly))
         return FileError::CouldNotOpen;
@@ -117,176 +158,1572 @@ TopinoDocument::FileError TopinoDocument::saveToXML(const QString& xmlfilename)
     xml.setAutoFormatting(true);
     xml.writeStartDocument();
 
-    saveTopinoXML(xml);
+    saveTopinoXML(xml, true, prepareImageReference());
 
-    /* Finish document and close file */
+    /* Finish document and replace the file */
     xml.writeEndDocument();
-    f.close();
+
+    if (xml.hasError() || !f.commit())
+        return FileError::CouldNotOpen;
 
     /* Was saved; remove the modification flag */
     changed = false;
+    imageSaved = true;
 
     return FileError::NoFailure;
 }
 
-QString TopinoDocument::getFilename() const {
-    return filename;
+/* Layout of binary files: a header (magic, version, number of chunks) followed by the chunks. Each
+ * chunk has a header (id, codec, size) and its data is padded to 16 bytes, so that all data starts
+ * at an aligned offset and can be used directly from the mapped file. All numbers are little endian.
+ * The image chunks (IMAG for the image, PROC for the gray plane of the processed image) start with their
+ * own header (width, height, format, bytes per line). */
+static const char binaryMagic[8] = { 'T', 'O', 'P', 'I', 'N', 'O', 'B', 'C' };
+static const quint32 binaryVersion = 1;
+static const int binaryAlignment = 16;
+
+static void writeBinaryValue(QIODevice& device, quint32 value) {
+    value = qToLittleEndian(value);
+    device.write(reinterpret_cast<const char *>(&value), sizeof(value));
 }
 
-void TopinoDocument::setFilename(const QString& value) {
-    filename = value;
-    modify();
+static void writeBinaryValue(QIODevice& device, quint64 value) {
+    value = qToLittleEndian(value);
+    device.write(reinterpret_cast<const char *>(&value), sizeof(value));
 }
 
-QString TopinoDocument::getPath() const {
-    return path;
+static void writeBinaryChunkHeader(QIODevice& device, const char* id, quint32 codec, quint64 size) {
+    device.write(id, 4);
+    writeBinaryValue(device, codec);
+    writeBinaryValue(device, size);
 }
 
-void TopinoDocument::setPath(const QString& value) {
-    path = value;
-    modify();
+static void writeBinaryPadding(QIODevice& device, quint64 size) {
+    int padding = int((binaryAlignment - size % binaryAlignment) % binaryAlignment);
+    device.write(QByteArray(padding, 0));
 }
 
-void TopinoDocument::setFullFilename(const QString& value) {
-    QFileInfo fi(value);
-    filename = fi.fileName();
-    path = fi.absolutePath();
-    modify();
+static bool writeBinaryChunk(QIODevice& device, const char* id, const QByteArray& bytes) {
+    writeBinaryChunkHeader(device, id, TopinoDocument::codecRaw, quint64(bytes.size()));
+    bool success = (device.write(bytes) == bytes.size());
+    writeBinaryPadding(device, quint64(bytes.size()));
+
+    return success;
 }
 
-bool TopinoDocument::hasFileName() const {
-    return (filename.length() > 0 && path.length() > 0);
+/* Cleanup function for images using memory they do not own (images from the mapped file, see
+ * MappedImageReader::wrapMapping) */
+static void releaseByteArray(void *info) {
+    delete static_cast<QByteArray *>(info);
 }
 
-const TopinoData &TopinoDocument::getData() const {
-    /* For fast access a const reference is given */
-    return data;
+static void writeBinaryImage(QIODevice& device, const char* id, quint32 codec, const QImage& image) {
+    /* Encode the pixels of the image; raw data is written without copying it */
+    QByteArray pixels;
+
+    switch (codec) {
+    case TopinoDocument::codecCompressed:
+        /* Fast compression level; the aim is speed, not size */
+        pixels = qCompress(image.constBits(), int(image.sizeInBytes()), 1);
+        break;
+
+    case TopinoDocument::codecPNG: {
+        QBuffer buffer(&pixels);
+        image.save(&buffer, "PNG");
+        break;
+    }
+
+    case TopinoDocument::codecRaw:
+    default:
+        pixels = QByteArray::fromRawData(reinterpret_cast<const char *>(image.constBits()), int(image.sizeInBytes()));
+        break;
+    }
+
+    quint64 size = 16 + quint64(pixels.size());
+
+    writeBinaryChunkHeader(device, id, codec, size);
+    writeBinaryValue(device, quint32(image.width()));
+    writeBinaryValue(device, quint32(image.height()));
+    writeBinaryValue(device, quint32(image.format()));
+    writeBinaryValue(device, quint32(image.bytesPerLine()));
+    device.write(pixels);
+    writeBinaryPadding(device, size);
 }
 
-void TopinoDocument::getData(TopinoData& value) const {
-    /* Copy data to the given reference */
-    value = data;
+static QImage readBinaryImage(const QSharedPointer<QFile>& file, const uchar *chunk, quint64 size, quint32 codec) {
+    /* Image header followed by the pixel data */
+    int width = int(qFromLittleEndian<quint32>(chunk));
+    int height = int(qFromLittleEndian<quint32>(chunk + 4));
+    quint32 formatValue = qFromLittleEndian<quint32>(chunk + 8);
+    int bytesPerLine = int(qFromLittleEndian<quint32>(chunk + 12));
+
+    /* The format comes from the file; QImage cannot handle unknown formats */
+    if ((formatValue <= quint32(QImage::Format_Invalid)) || (formatValue >= quint32(QImage::NImageFormats)) ||
+            (width <= 0) || (height <= 0) || (bytesPerLine <= 0)) {
+        qDebug("Image chunk with invalid format %u or size %d × %d.", formatValue, width, height);
+        return QImage();
+    }
+
+    QImage::Format format = QImage::Format(formatValue);
+    const uchar *pixels = chunk + 16;
+    quint64 pixelSize = size - 16;
+    quint64 imageSize = quint64(bytesPerLine) * quint64(height);
+
+    /* Encoded pixels are passed as int; only the mapped pixels may exceed it */
+    if ((codec != TopinoDocument::codecRaw) && (pixelSize > quint64(INT_MAX))) {
+        qDebug("Image chunk with %llu bytes is too large to decode.", pixelSize);
+        return QImage();
+    }
+
+    QImage image;
+    switch (codec) {
+    case TopinoDocument::codecRaw:
+        /* Zero copy: the image uses the mapped file (read-only, writing detaches the image) */
+        if (pixelSize >= imageSize) {
+            image = MappedImageReader::wrapMapping(file, pixels, width, height, bytesPerLine, format);
+        }
+        break;
+
+    case TopinoDocument::codecCompressed: {
+        QByteArray *bytes = new QByteArray(qUncompress(pixels, int(pixelSize)));
+
+        if (quint64(bytes->size()) >= imageSize) {
+            image = QImage(reinterpret_cast<uchar *>(bytes->data()), width, height, bytesPerLine, format,
+                           releaseByteArray, bytes);
+        }
+
+        if (image.isNull()) {
+            delete bytes;
+        }
+        break;
+    }
+
+    case TopinoDocument::codecPNG:
+        image = QImage::fromData(pixels, int(pixelSize), "PNG");
+        break;
+
+    default:
+        break;
+    }
+
+    return image;
 }
 
-void TopinoDocument::setData(const TopinoData& value) {
-    data = value;
-    modify();
+const char* TopinoDocument::getImageCodecName(TopinoDocument::imageCodecs codec) {
+    const char *names[] = {
+        "Uncompressed",
+        "Compressed",
+        "PNG"
+    };
+
+    if (codec >= codecCOUNT)
+        return "";
+
+    return names[codec];
 }
 
-void TopinoDocument::createDataHeader(QStringList& textData) const {
-    /* First, let's put in the name of the file we are evaluating here and then
-     * some information about the image */
-    textData.append(QObject::tr("Timestamp:") +"\t" + QDateTime::currentDateTime().toString("yyyy.MM.dd hh:mm:ss"));
+TopinoDocument::imageCodecs TopinoDocument::getImageCodec() const {
+    return imageCodec;
+}
 
-    if (hasFileName()) {
-        textData.append(QObject::tr("File:") + "\t" + filename);
+void TopinoDocument::setImageCodec(TopinoDocument::imageCodecs value) {
+    imageCodec = value;
+}
+
+bool TopinoDocument::getReferenceImage() const {
+    return referenceImage;
+}
+
+void TopinoDocument::setReferenceImage(bool value) {
+    referenceImage = value;
+}
+
+QString TopinoDocument::getImageStore() const {
+    return imageStore;
+}
+
+void TopinoDocument::setImageStore(const QString& value) {
+    imageStore = value;
+}
+
+void TopinoDocument::takeImageReference(const TopinoDocument& saved) {
+    /* A file without the image of the document (e.g. cropped) cannot be used to recover it */
+    if (!saved.imageSaved) {
+        imageSaved = false;
     }
-    textData.append(QString(QObject::tr("Image:") + "\t%1 × %2 Px²").arg(data.getImage().width()).arg(data.getImage().height()));
 
-    TopinoData::InletData inletData = data.getInletData(data.getMainInletID());
-    textData.append(QString(QObject::tr("Inlet:") + "\tx:\t%1 Px\ty:\t%2 Px\tRef. angle:\t%3°\tInner radius:\t%4 Px\tOuter radius:\t%5 Px")
-                    .arg(qRound(inletData.coord.x())).arg(qRound(inletData.coord.y()))
-                    .arg(data.getCoordNeutralAngle()).arg(inletData.radius).arg(data.getCoordOuterRadius()));
-    textData.append("");
+    /* The image might have been replaced during saving; the file and hash do not change the document */
+    if (saved.data.getImage().cacheKey() != data.getImage().cacheKey() || saved.data.getSourceHash().isEmpty()) {
+        return;
+    }
 
-    /* Stream data: first the data of each stream */
-    textData.append("\t\t𝜑\t𝜔\tL²");
-    QVector<TopinoTools::Lorentzian> streams = data.getStreamParameters();
-    for(int i = 0; i < streams.length(); ++i) {
-        QString line;
-        line.sprintf("Stream %d\t%+.1f°\t%.1f°\t%.2f", i+1, streams[i].pos, streams[i].width, streams[i].rsquare);
-        textData.append(line);
+    data.setSourceFile(saved.data.getSourceFile(), saved.data.getSourceHash());
+}
+
+QString TopinoDocument::prepareImageReference() {
+    if (!referenceImage || data.getImage().isNull()) {
+        return QString();
     }
-    textData.append("");
 
-    /* Stream data: add the resolutions between each stream */
-    textData.append("1. Stream\t2.Stream\tR₁₂");
-    for(int i = 0; i < streams.length(); ++i) {
-        for(int j = (i+1); j < streams.length(); ++j) {
-            QString line;
-            line.sprintf("%d\t%d\t%.2f", i+1, j+1, TopinoTools::calculateResolution(
-                             streams[i].pos, streams[i].width,
-                             streams[j].pos, streams[j].width));
-            textData.append(line);
+    QString file = data.getSourceFile();
+    QByteArray hash = data.getSourceHash();
+
+    /* Images in the store are named by their hash; images without a file are saved as PNG */
+    if (!imageStore.isEmpty() && QDir().mkpath(imageStore)) {
+        QString storeFile;
+
+        if (file.isEmpty() || hash.isEmpty()) {
+            QByteArray bytes;
+            QBuffer buffer(&bytes);
+            data.getImage().save(&buffer, "PNG");
+            hash = TopinoData::calculateContentHash(bytes);
+            storeFile = QDir(imageStore).absoluteFilePath(hash + ".png");
+
+            QSaveFile f(storeFile);
+            if (!QFileInfo::exists(storeFile) && f.open(QIODevice::WriteOnly)) {
+                f.write(bytes);
+                f.commit();
+            }
+        } else {
+            storeFile = QDir(imageStore).absoluteFilePath(hash + "." + QFileInfo(file).suffix().toLower());
+
+            if (!QFileInfo::exists(storeFile)) {
+                QFile::copy(file, storeFile);
+            }
         }
+
+        if (QFileInfo::exists(storeFile)) {
+            file = storeFile;
+            data.setSourceFile(file, hash);
+        }
+    }
+
+    /* Without a file (or hash) the image has to be embedded */
+    if (file.isEmpty() || hash.isEmpty() || !QFileInfo::exists(file)) {
+        return QString();
     }
+
+    return QDir(path).relativeFilePath(file);
 }
 
-void TopinoDocument::createDataTable(QStringList& textData) const {
-    /* For each point in data points, we add the respective raw data point and the
-    * stream fits. */
-    QVector<TopinoTools::Lorentzian> parameters = data.getStreamParameters();
-    int fits = parameters.length();
+TopinoDocument::FileError TopinoDocument::resolveImageReference(QByteArray* encodedImage) {
+    QString reference = data.getSourceReference();
+    QByteArray hash = data.getSourceHash();
 
-    /* Header of table */
-    textData.append(QObject::tr("All data intensities are in arbitrary units."));
-    QString header = "𝜑 (°)\traw data int";
-    for (int i = 0; i < fits; ++i) {
-        header += "\tStream " + QString::number(i+1);
+    if (reference.isEmpty()) {
+        return FileError::NoFailure;
+    }
+
+    /* The referenced file first, then the files in the store with this hash */
+    QStringList candidates;
+    candidates.append(QDir(path).absoluteFilePath(reference));
+
+    if (!imageStore.isEmpty()) {
+        QDir store(imageStore);
+        QStringList storeFiles = store.entryList(QStringList(QString::fromLatin1(hash) + ".*"), QDir::Files);
+
+        for (auto it = storeFiles.constBegin(); it != storeFiles.constEnd(); ++it) {
+            candidates.append(store.absoluteFilePath(*it));
+        }
+    }
+
+    /* An image used by another document is not decoded again */
+    QImage image = TopinoData::findCachedImage(hash);
+
+    if (!image.isNull()) {
+        data.setImage(image);
+        data.setSourceFile(candidates.first(), hash);
+
+        return FileError::NoFailure;
     }
-    textData.append(header);
 
-    /* Contents of table */
-    QVector<QPointF> points = data.getAngulagramPoints();
-    for(int i = 0; i < points.length(); ++i) {
-        QStringList line;
+    for (auto it = candidates.constBegin(); it != candidates.constEnd(); ++it) {
+        /* Uncompressed frames are mapped instead of read (and decoded right away) */
+        if (MappedImageReader::canRead(*it)) {
+            QByteArray fileHash;
+            image = MappedImageReader::read(*it, &fileHash);
 
-        /* Raw data */
-        line.append(QString::number(points[i].x()));
-        line.append(QString::number(points[i].y()));
+            if (!image.isNull() && (fileHash == hash)) {
+                TopinoData::cacheImage(hash, image);
+                data.setImage(image);
+                data.setSourceFile(*it, hash);
 
-        /* Data for the fits */
-        for(int j = 0; j < fits; ++j) {
-            line.append(QString::number(parameters[j].f(points[i].x())));
+                return FileError::NoFailure;
+            }
+
+            if (!image.isNull()) {
+                qDebug("Image file %s does not have the referenced content.", it->toStdString().c_str());
+                continue;
+            }
+        }
+
+        QFile f(*it);
+
+        if (!f.open(QIODevice::ReadOnly)) {
+            continue;
+        }
+
+        QByteArray bytes = f.readAll();
+
+        if (TopinoData::calculateContentHash(bytes) != hash) {
+            qDebug("Image file %s does not have the referenced content.", it->toStdString().c_str());
+            continue;
+        }
+
+        if (encodedImage != nullptr) {
+            *encodedImage = bytes;
+        } else {
+            image = QImage::fromData(bytes);
+
+            if (image.isNull()) {
+                return FileError::ParsingError;
+            }
+
+            TopinoData::cacheImage(hash, image);
+            data.setImage(image);
         }
 
-        textData.append(line.join("\t"));
+        data.setSourceFile(*it, hash);
+
+        return FileError::NoFailure;
     }
 
+    qDebug("Referenced image %s not found.", reference.toStdString().c_str());
+    return FileError::ImageNotFound;
 }
 
-void TopinoDocument::exportDataToText(const QString& filename) const {
-    qDebug("Exporting data to %s", filename.toStdString().c_str());
+bool TopinoDocument::getCropImage() const {
+    return cropImage;
+}
 
-    /* Prepare all the data in text form, line by line */
-    QStringList textdata;
-    createDataHeader(textdata);
-    textdata.append("");
-    createDataTable(textdata);
+void TopinoDocument::setCropImage(bool value) {
+    cropImage = value;
+}
 
-    /* Write it to the given file */
-    QFile file(filename);
-    if (file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
-        file.write(textdata.join("\n").toUtf8());
-        file.close();
-    } else {
-        qDebug("Could not open file %s", filename.toStdString().c_str());
+QRect TopinoDocument::prepareCropRegion() const {
+    /* Referenced images are not embedded, so there is nothing to crop */
+    if (!cropImage || referenceImage || data.getImage().isNull()) {
+        return QRect();
+    }
+
+    /* Without inlets, there is nothing to crop to */
+    QRect region = data.calculateRegionOfInterest();
+    if (region.isEmpty() || (region == data.getImage().rect())) {
+        return QRect();
     }
+
+    return region;
 }
 
-TopinoDocument::FileError TopinoDocument::readTopinoXML(QXmlStreamReader& xml) {
-    /* Read all elements */
-    while (xml.readNextStartElement()) {
-        qDebug("Found element %s in XML...", xml.name().toString().toStdString().c_str());
+bool TopinoDocument::getStoreResults() const {
+    return storeResults;
+}
 
-        if (data.loadObject(xml) == TopinoData::ParsingError::IgnoredElement) {
-            xml.skipCurrentElement();
+void TopinoDocument::setStoreResults(bool value) {
+    storeResults = value;
+}
+
+void TopinoDocument::releaseMappedFile(const QString& filename) {
+    QSharedPointer<QFile> mapped = mappedFile.toStrongRef();
+
+    if (mapped.isNull() || (QFileInfo(mapped->fileName()) != QFileInfo(filename))) {
+        return;
+    }
+
+    /* The file is unmapped when the last image using it is gone (other copies of the images, e.g. of
+     * a running calculation, might still use it) */
+    mapped.clear();
+    data.detachImages();
+}
+
+QByteArray TopinoDocument::calculateFileHash(const QString& filename) {
+    /* The file is mapped, since documents might be large */
+    QFile f(filename);
+
+    if (!f.open(QFile::ReadOnly)) {
+        return QByteArray();
+    }
+
+    qint64 size = f.size();
+    const uchar *map = (size > 0) ? f.map(0, size) : nullptr;
+
+    if (map == nullptr) {
+        return QByteArray();
+    }
+
+    return TopinoData::calculateContentHash(map, size);
+}
+
+bool TopinoDocument::isBinaryFileName(const QString& filename) {
+    return QFileInfo(filename).suffix().toLower() == "topino";
+}
+
+TopinoDocument::FileError TopinoDocument::load(const QString& filename, QByteArray *encodedImage) {
+    if (isBinaryFileName(filename)) {
+        return loadFromBinary(filename, encodedImage);
+    }
+
+    return loadFromXML(filename, encodedImage);
+}
+
+TopinoDocument::FileError TopinoDocument::save(const QString& filename) {
+    /* The cropped image is saved from a copy of the document; the document keeps the full image */
+    QRect crop = prepareCropRegion();
+
+    if (!crop.isEmpty()) {
+        TopinoDocument cropped = createSnapshot();
+        cropped.data = data.createCroppedData(crop);
+        cropped.cropImage = false;
+
+        FileError err = cropped.save(filename);
+        if (err == FileError::NoFailure) {
+            this->filename = cropped.filename;
+            path = cropped.path;
+            changed = false;
+            imageSaved = false;
+        }
+
+        return err;
+    }
+
+    if (isBinaryFileName((filename.length() > 0) ? filename : this->filename)) {
+        return saveToBinary(filename);
+    }
+
+    return saveToXML(filename);
+}
+
+TopinoDocument::FileError TopinoDocument::loadFromBinary(const QString& binfilename, QByteArray *encodedImage) {
+    /* The file is mapped into memory; it has to live as long as an image uses the mapped memory,
+     * so it is shared with the images using it */
+    QSharedPointer<QFile> f(new QFile(binfilename));
+
+    if (!f->exists()) {
+        return FileError::FileNotFound;
+    }
+
+    if (!f->open(QFile::ReadOnly)) {
+        return FileError::CouldNotOpen;
+    }
+
+    qint64 fileSize = f->size();
+    const uchar *map = (fileSize >= 16) ? f->map(0, fileSize) : nullptr;
+
+    if ((map == nullptr) || (memcmp(map, binaryMagic, sizeof(binaryMagic)) != 0) ||
+            (qFromLittleEndian<quint32>(map + 8) > binaryVersion)) {
+        return FileError::ParsingError;
+    }
+
+    quint32 chunkCount = qFromLittleEndian<quint32>(map + 12);
+    qint64 offset = 16;
+    FileError err = FileError::NoFailure;
+
+    for (quint32 c = 0; (c < chunkCount) && (err == FileError::NoFailure); ++c) {
+        /* Chunk header: id, codec, size */
+        if (offset + 16 > fileSize) {
+            err = FileError::ParsingError;
+            break;
+        }
+
+        QByteArray id(reinterpret_cast<const char *>(map + offset), 4);
+        quint32 codec = qFromLittleEndian<quint32>(map + offset + 4);
+        quint64 size = qFromLittleEndian<quint64>(map + offset + 8);
+        const uchar *chunk = map + offset + 16;
+
+        if (size > quint64(fileSize - offset - 16)) {
+            err = FileError::ParsingError;
+            break;
+        }
+
+        /* Chunks that are copied or parsed from memory are limited to int sizes (unlike mapped images) */
+        bool copied = (id == "META") || (((id == "IMAG") || (id == "PROC")) && (codec == codecPNG));
+
+        if (copied && (size > quint64(INT_MAX))) {
+            qDebug("Chunk %s with %llu bytes is too large.", id.constData(), size);
+            err = FileError::ParsingError;
+            break;
+        }
+
+        qDebug("Found chunk %s (codec %d, %llu bytes) in binary file...", id.constData(), codec, size);
+
+        if (id == "META") {
+            /* Metadata: read the XML directly from the mapped memory */
+            QXmlStreamReader xml(QByteArray::fromRawData(reinterpret_cast<const char *>(chunk), int(size)));
+
+            while (!xml.atEnd()) {
+                if ((xml.readNext() != QXmlStreamReader::EndDocument) && xml.isStartElement() && (xml.name() == "topino")) {
+                    err = readTopinoXML(xml, encodedImage);
+                }
+            }
+
+            if (xml.hasError()) {
+                qDebug("XML errors = %d: %s", xml.error(), xml.errorString().toStdString().c_str());
+                err = FileError::ParsingError;
+            }
+        } else if ((id == "CTXT") && (size >= 16) && (codec < codecCOUNT)) {
+            /* Context of a cropped image (the crop itself is described in the metadata) */
+            data.setContextImage(readBinaryImage(f, chunk, size, codec));
+        } else if ((id == "IMAG") && (size >= 16) && (codec < codecCOUNT)) {
+            /* Copy the PNG data if the caller decodes it; the file is closed afterwards */
+            if ((codec == codecPNG) && (encodedImage != nullptr)) {
+                *encodedImage = QByteArray(reinterpret_cast<const char *>(chunk + 16), int(size - 16));
+            } else {
+                QImage image = readBinaryImage(f, chunk, size, codec);
+
+                if (image.isNull()) {
+                    err = FileError::ParsingError;
+                    break;
+                }
+
+                data.setImage(image);
+            }
+
+            imageCodec = imageCodecs(codec);
+        } else if ((id == "PROC") && (size >= 16) && (codec < codecCOUNT)) {
+            /* Stored gray plane of the processed image; it is only decoded if it is used */
+            if (codec == codecPNG) {
+                data.setStoredProcessedData(QByteArray(reinterpret_cast<const char *>(chunk + 16), int(size - 16)));
+            } else {
+                data.setStoredProcessedImage(readBinaryImage(f, chunk, size, codec));
+            }
         }
+
+        /* Unknown chunks are ignored */
+        offset += 16 + qint64(size);
+        offset += (binaryAlignment - offset % binaryAlignment) % binaryAlignment;
+    }
+
+    /* The file stays open as long as an image uses it */
+    if (err != FileError::NoFailure) {
+        return err;
+    }
+
+    mappedFile = f;
+
+    /* Split the full path into filename and path */
+    QFileInfo fi(binfilename);
+    filename = fi.fileName();
+    path = fi.absolutePath();
+
+    err = resolveImageReference(encodedImage);
+    if (err != FileError::NoFailure)
+        return err;
+
+    /* Apply processing parameters (unless the caller does it) */
+    if (encodedImage == nullptr) {
+        data.processImage();
     }
 
+    /* Freshly opened files are not changed (yet) */
+    changed = false;
+    imageSaved = true;
+
     return FileError::NoFailure;
 }
 
-TopinoDocument::FileError TopinoDocument::saveTopinoXML(QXmlStreamWriter& xml) {
-    /* Document header <topino> with <version> element */
-    xml.writeStartElement("topino");
-    xml.writeTextElement("version", version);
+TopinoDocument::FileError TopinoDocument::saveToBinary(const QString& binfilename) {
+    /* Use the full filename given to the function if available; split into components */
+    if (binfilename.length() > 0) {
+        QFileInfo fi(binfilename);
+        filename = fi.fileName();
+        path = fi.absolutePath();
+    }
 
-    /* Save all the data objects */
-    data.saveImageObject(xml);
-    data.saveCoordinateObject(xml);
-    data.saveInletsObject(xml);
-    data.saveStreamParameters(xml);
+    /* File name AND path must be set to save the file somewhere */
+    if (filename.length() == 0 || path.length() == 0)
+        return FileError::FileNameOrPathNotSet;
+
+    /* Metadata as XML without the image */
+    QByteArray meta;
+    QBuffer metaBuffer(&meta);
+    metaBuffer.open(QIODevice::WriteOnly);
+
+    QXmlStreamWriter xml(&metaBuffer);
+    xml.setAutoFormatting(true);
+    xml.writeStartDocument();
+    QString imageReference = prepareImageReference();
+    saveTopinoXML(xml, false, imageReference);
+    xml.writeEndDocument();
+    metaBuffer.close();
+
+    /* The gray plane of the processed image is stored with the same codec as the image; a referenced
+     * image is not stored at all. The context of a cropped image is always stored as PNG. */
+    QImage image = imageReference.isEmpty() ? data.getImage() : QImage();
+    QImage context = (image.isNull() || !data.isCropped()) ? QImage() : data.getContextImage();
+    QImage grayPlane = storeResults ? data.getProcessedGrayPlane() : QImage();
+
+    /* Write into a temporary file that replaces the old one when finished; this also keeps a file that is
+     * still mapped by the current image intact */
+    QSaveFile f(path + "/" + filename);
+
+    if (!f.open(QIODevice::WriteOnly))
+        return FileError::CouldNotOpen;
+
+    f.write(binaryMagic, sizeof(binaryMagic));
+    writeBinaryValue(f, binaryVersion);
+    writeBinaryValue(f, quint32(1 + (image.isNull() ? 0 : 1) + (grayPlane.isNull() ? 0 : 1) + (context.isNull() ? 0 : 1)));
+
+    writeBinaryChunkHeader(f, "META", codecRaw, quint64(meta.size()));
+    f.write(meta);
+    writeBinaryPadding(f, quint64(meta.size()));
+
+    if (!context.isNull()) {
+        writeBinaryImage(f, "CTXT", codecPNG, context);
+    }
+
+    if (!image.isNull()) {
+        writeBinaryImage(f, "IMAG", imageCodec, image);
+    }
+
+    if (!grayPlane.isNull()) {
+        writeBinaryImage(f, "PROC", imageCodec, grayPlane);
+    }
+
+    if (!f.commit()) {
+        /* Replacing a file that is still mapped fails on some systems */
+        QSharedPointer<QFile> mapped = mappedFile.toStrongRef();
+        if (!mapped.isNull() && (QFileInfo(mapped->fileName()) == QFileInfo(QDir(path).absoluteFilePath(filename)))) {
+            return FileError::FileInUse;
+        }
+
+        return FileError::CouldNotOpen;
+    }
+
+    /* Was saved; remove the modification flag */
+    changed = false;
+    imageSaved = true;
+
+    return FileError::NoFailure;
+}
+
+/* Layout of journal files: a header (magic, version, reserved) followed by chunks like in binary files.
+ * FILE is the name of the document file (if it has one), HASH the hash of its content (if the image is
+ * taken from there), IMAG the compressed image (if it is not the one of the document file), and each
+ * META chunk a record of the metadata. There is no number of chunks, so that records can be appended. */
+static const char journalMagic[8] = { 'T', 'O', 'P', 'I', 'N', 'O', 'J', 'L' };
+static const quint32 journalVersion = 1;
+
+TopinoDocument::FileError TopinoDocument::startJournal(const QString& journalfilename) {
+    /* A new journal replaces the old one completely */
+    QSaveFile f(journalfilename);
+
+    if (!f.open(QIODevice::WriteOnly))
+        return FileError::CouldNotOpen;
+
+    f.write(journalMagic, sizeof(journalMagic));
+    writeBinaryValue(f, journalVersion);
+    writeBinaryValue(f, quint32(0));
+
+    /* The image is written only once; if it is the one of the document file, it is taken from there. The
+     * hash of the file makes sure that the file did not change before the journal is recovered. */
+    QString documentFile = hasFileName() ? QDir(path).absoluteFilePath(filename) : QString();
+    QByteArray documentHash = (imageSaved && !documentFile.isEmpty()) ? calculateFileHash(documentFile) : QByteArray();
+
+    if (!documentFile.isEmpty()) {
+        writeBinaryChunk(f, "FILE", documentFile.toUtf8());
+    }
+
+    if (!documentHash.isEmpty()) {
+        writeBinaryChunk(f, "HASH", documentHash);
+    } else if (!data.getImage().isNull()) {
+        writeBinaryImage(f, "IMAG", codecCompressed, data.getImage());
+    }
+
+    writeBinaryChunk(f, "META", createJournalRecord());
+
+    if (!f.commit())
+        return FileError::CouldNotOpen;
+
+    return FileError::NoFailure;
+}
+
+TopinoDocument::FileError TopinoDocument::appendJournal(const QString& journalfilename) {
+    /* Only a record of a few kilobytes is appended */
+    QFile f(journalfilename);
+
+    if (!f.exists()) {
+        return FileError::FileNotFound;
+    }
+
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Append))
+        return FileError::CouldNotOpen;
+
+    if (!writeBinaryChunk(f, "META", createJournalRecord()) || !f.flush())
+        return FileError::CouldNotOpen;
+
+    return FileError::NoFailure;
+}
+
+TopinoDocument::FileError TopinoDocument::loadFromJournal(const QString& journalfilename) {
+    QFile f(journalfilename);
+
+    if (!f.exists()) {
+        return FileError::FileNotFound;
+    }
+
+    if (!f.open(QFile::ReadOnly)) {
+        return FileError::CouldNotOpen;
+    }
+
+    QByteArray bytes = f.readAll();
+    f.close();
+
+    const uchar *map = reinterpret_cast<const uchar *>(bytes.constData());
+    qint64 fileSize = bytes.size();
+
+    if ((fileSize < 16) || (memcmp(map, journalMagic, sizeof(journalMagic)) != 0) ||
+            (qFromLittleEndian<quint32>(map + 8) > journalVersion)) {
+        return FileError::ParsingError;
+    }
+
+    QString documentFile;
+    QByteArray documentHash;
+    QImage image;
+    QByteArray record;
+    qint64 offset = 16;
+
+    /* Reads up to the first incomplete chunk; only the last record is needed */
+    while (offset + 16 <= fileSize) {
+        QByteArray id(reinterpret_cast<const char *>(map + offset), 4);
+        quint32 codec = qFromLittleEndian<quint32>(map + offset + 4);
+        quint64 size = qFromLittleEndian<quint64>(map + offset + 8);
+        const uchar *chunk = map + offset + 16;
+
+        if (size > quint64(fileSize - offset - 16)) {
+            qDebug("Incomplete chunk %s at the end of the journal ignored.", id.constData());
+            break;
+        }
+
+        if (size > quint64(INT_MAX)) {
+            return FileError::ParsingError;
+        }
+
+        if (id == "FILE") {
+            documentFile = QString::fromUtf8(reinterpret_cast<const char *>(chunk), int(size));
+        } else if (id == "HASH") {
+            documentHash = QByteArray(reinterpret_cast<const char *>(chunk), int(size));
+        } else if ((id == "IMAG") && (size >= 16) && (codec == codecCompressed)) {
+            image = readBinaryImage(QSharedPointer<QFile>(), chunk, size, codec);
+        } else if (id == "META") {
+            record = QByteArray(reinterpret_cast<const char *>(chunk), int(size));
+        }
+
+        offset += 16 + qint64(size);
+        offset += (binaryAlignment - offset % binaryAlignment) % binaryAlignment;
+    }
+
+    if (record.isEmpty()) {
+        return FileError::ParsingError;
+    }
+
+    /* Start with the image only; the image of the document file is loaded from there */
+    TopinoData recovered;
+
+    if (image.isNull() && !documentFile.isEmpty()) {
+        /* The record belongs to the document file as it was when the journal was started */
+        if (documentHash.isEmpty() || (calculateFileHash(documentFile) != documentHash)) {
+            qDebug("Document file %s changed since the journal was started.", documentFile.toStdString().c_str());
+            return FileError::ImageNotFound;
+        }
+
+        TopinoDocument base;
+        base.setImageStore(imageStore);
+
+        FileError err = base.load(documentFile);
+        if (err != FileError::NoFailure)
+            return err;
+
+        recovered.setImage(base.getData().getImage());
+        recovered.setContextImage(base.getData().getContextImage());
+        recovered.setSourceFile(base.getData().getSourceFile(), base.getData().getSourceHash());
+        imageSaved = true;
+    } else {
+        recovered.setImage(image);
+        imageSaved = false;
+    }
+
+    data = recovered;
+
+    /* Apply the last record */
+    QXmlStreamReader xml(record);
+
+    while (!xml.atEnd()) {
+        if ((xml.readNext() != QXmlStreamReader::EndDocument) && xml.isStartElement() && (xml.name() == "topino")) {
+            readTopinoXML(xml);
+        }
+    }
+
+    if (xml.hasError()) {
+        qDebug("XML errors = %d: %s", xml.error(), xml.errorString().toStdString().c_str());
+        return FileError::ParsingError;
+    }
+
+    data.processImage();
+
+    /* Recovered documents are saved to the original file (if there is one) */
+    if (!documentFile.isEmpty()) {
+        QFileInfo fi(documentFile);
+        filename = fi.fileName();
+        path = fi.absolutePath();
+    }
+
+    clearUndoHistory();
+    changed = true;
+    ++revision;
+
+    return FileError::NoFailure;
+}
+
+QByteArray TopinoDocument::createJournalRecord() {
+    QByteArray record;
+    QBuffer buffer(&record);
+    buffer.open(QIODevice::WriteOnly);
+
+    QXmlStreamWriter xml(&buffer);
+    xml.writeStartDocument();
+    xml.writeStartElement("topino");
+    xml.writeTextElement("version", version);
+
+    data.saveImageObject(xml, false);
+    data.saveCoordinateObject(xml);
+    data.saveInletsObject(xml);
+    data.saveStreamParameters(xml);
+    data.saveStreamBaseline(xml);
+
+    xml.writeEndElement();
+    xml.writeEndDocument();
+    buffer.close();
+
+    return record;
+}
+
+QString TopinoDocument::getFilename() const {
+    return filename;
+}
+
+void TopinoDocument::setFilename(const QString& value) {
+    filename = value;
+    modify(IObserver::changeFile);
+}
+
+QString TopinoDocument::getPath() const {
+    return path;
+}
+
+void TopinoDocument::setPath(const QString& value) {
+    path = value;
+    modify(IObserver::changeFile);
+}
+
+void TopinoDocument::setFullFilename(const QString& value) {
+    QFileInfo fi(value);
+    filename = fi.fileName();
+    path = fi.absolutePath();
+    modify(IObserver::changeFile);
+}
+
+bool TopinoDocument::hasFileName() const {
+    return (filename.length() > 0 && path.length() > 0);
+}
+
+const TopinoData &TopinoDocument::getData() const {
+    /* For fast access a const reference is given */
+    return data;
+}
+
+void TopinoDocument::getData(TopinoData& value) const {
+    /* Copy data to the given reference */
+    value = data;
+}
+
+void TopinoDocument::setData(const TopinoData& value) {
+    /* Only tell the observers what actually changed */
+    int changes = compareData(data, value);
+
+    UndoStep before = captureUndoStep(changes);
+    data = value;
+    recordUndoStep(before, changes);
+
+    modify(changes);
+}
+
+bool TopinoDocument::takeStageResults(const TopinoData& results, int changes) {
+    bool taken = data.takeStageResults(results);
+    notifyAllObserver(changes);
+
+    return taken;
+}
+
+bool TopinoDocument::takeConfidenceIntervals(const QVector<TopinoTools::Lorentzian>& fits) {
+    QVector<TopinoTools::Lorentzian> streams = data.getStreamParameters();
+
+    /* Only if the streams are still the ones the intervals were calculated for */
+    if (streams.length() != fits.length()) {
+        return false;
+    }
+
+    for (int i = 0; i < streams.length(); ++i) {
+        if ((streams[i].pos != fits[i].pos) || (streams[i].height != fits[i].height) ||
+                (streams[i].width != fits[i].width) || (streams[i].offset != fits[i].offset) ||
+                (streams[i].model != fits[i].model) || (streams[i].shape != fits[i].shape)) {
+            return false;
+        }
+
+        streams[i].posCI = fits[i].posCI;
+        streams[i].widthCI = fits[i].widthCI;
+        streams[i].resolutionCIs = fits[i].resolutionCIs;
+    }
+
+    data.setStreamParameters(streams);
+    modify(IObserver::changeStreams);
+
+    return true;
+}
+
+void TopinoDocument::takeLoadedImage(const TopinoData& loaded) {
+    data.setImage(loaded.getImage());
+
+    if (!data.takeStageResults(loaded)) {
+        data.processImage();
+    }
+
+    notifyAllObserver(IObserver::changeImage | IObserver::changeProcessing);
+}
+
+int TopinoDocument::compareData(const TopinoData& oldData, const TopinoData& newData) {
+    int changes = IObserver::changeNone;
+
+    /* Images are compared by their cache keys (i.e. if they share the same data), which is cheap */
+    if (oldData.getImage().cacheKey() != newData.getImage().cacheKey()) {
+        changes |= IObserver::changeImage;
+    }
+
+    if ((oldData.getProcessedImage().cacheKey() != newData.getProcessedImage().cacheKey()) ||
+            (oldData.getInversion() != newData.getInversion()) ||
+            (oldData.getDesatMode() != newData.getDesatMode()) ||
+            (oldData.getLevelMin() != newData.getLevelMin()) ||
+            (oldData.getLevelMax() != newData.getLevelMax())) {
+        changes |= IObserver::changeProcessing;
+    }
+
+    if ((oldData.getMainInletID() != newData.getMainInletID()) ||
+            (oldData.getCoordNeutralAngle() != newData.getCoordNeutralAngle()) ||
+            (oldData.getCoordMinAngle() != newData.getCoordMinAngle()) ||
+            (oldData.getCoordMaxAngle() != newData.getCoordMaxAngle()) ||
+            (oldData.getCoordDiffAngle() != newData.getCoordDiffAngle()) ||
+            (oldData.getCoordOuterRadius() != newData.getCoordOuterRadius()) ||
+            (oldData.getCoordCounterClockwise() != newData.getCoordCounterClockwise()) ||
+            (oldData.getCoordSectors() != newData.getCoordSectors())) {
+        changes |= IObserver::changeGeometry;
+    }
+
+    if (!isSameInlets(oldData.getInlets(), newData.getInlets())) {
+        changes |= IObserver::changeInlets;
+    }
+
+    /* Moving the main inlet changes the polar coordinate system as well */
+    if (changes & IObserver::changeInlets) {
+        TopinoData::InletData oldMainInlet = oldData.getInletData(oldData.getMainInletID());
+        TopinoData::InletData newMainInlet = newData.getInletData(newData.getMainInletID());
+
+        if ((oldMainInlet.coord != newMainInlet.coord) || (oldMainInlet.radius != newMainInlet.radius)) {
+            changes |= IObserver::changeGeometry;
+        }
+    }
+
+    /* Shared vectors are compared by their data pointer first, so this is cheap as well */
+    if ((oldData.getPolarImage().cacheKey() != newData.getPolarImage().cacheKey()) ||
+            (oldData.getAngulagram().values != newData.getAngulagram().values) ||
+            (oldData.getAngulagram().start != newData.getAngulagram().start) ||
+            (oldData.getAngulagram().step != newData.getAngulagram().step) ||
+            (oldData.getRadialgram().values != newData.getRadialgram().values)) {
+        changes |= IObserver::changeAngulagram;
+    }
+
+    if (!isSameStreams(oldData.getStreamParameters(), oldData.getStreamBaseline(),
+                       newData.getStreamParameters(), newData.getStreamBaseline())) {
+        changes |= IObserver::changeStreams;
+    }
+
+    return changes;
+}
+
+bool TopinoDocument::isSameInlets(const QList<TopinoData::InletData>& a, const QList<TopinoData::InletData>& b) {
+    if (a.length() != b.length()) {
+        return false;
+    }
+
+    for (int i = 0; i < a.length(); ++i) {
+        if ((a[i].ID != b[i].ID) || (a[i].coord != b[i].coord) || (a[i].radius != b[i].radius)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool TopinoDocument::isSameStreams(const QVector<TopinoTools::Lorentzian>& a, const TopinoTools::Baseline& baselineA,
+                                   const QVector<TopinoTools::Lorentzian>& b, const TopinoTools::Baseline& baselineB) {
+    if ((a.length() != b.length()) || (baselineA.signal.values != baselineB.signal.values) ||
+            (baselineA.signal.start != baselineB.signal.start) || (baselineA.signal.step != baselineB.signal.step) ||
+            (baselineA.lambda != baselineB.lambda) || (baselineA.asymmetry != baselineB.asymmetry)) {
+        return false;
+    }
+
+    for (int i = 0; i < a.length(); ++i) {
+        if ((a[i].pos != b[i].pos) || (a[i].height != b[i].height) || (a[i].width != b[i].width) ||
+                (a[i].offset != b[i].offset) || (a[i].rsquare != b[i].rsquare) || (a[i].model != b[i].model) ||
+                (a[i].shape != b[i].shape) ||
+                (a[i].posCI.lower != b[i].posCI.lower) || (a[i].posCI.upper != b[i].posCI.upper) ||
+                (a[i].widthCI.lower != b[i].widthCI.lower) || (a[i].widthCI.upper != b[i].widthCI.upper) ||
+                (a[i].resolutionCIs.length() != b[i].resolutionCIs.length())) {
+            return false;
+        }
+
+        for (int j = 0; j < a[i].resolutionCIs.length(); ++j) {
+            if ((a[i].resolutionCIs[j].lower != b[i].resolutionCIs[j].lower) ||
+                    (a[i].resolutionCIs[j].upper != b[i].resolutionCIs[j].upper)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/* Parts of the data that can be undone; a new image cannot (it would need the old image) */
+static const int undoableChanges = IObserver::changeProcessing | IObserver::changeGeometry |
+                                   IObserver::changeInlets | IObserver::changeStreams;
+
+bool TopinoDocument::canUndo() const {
+    return !undoSteps.isEmpty();
+}
+
+bool TopinoDocument::canRedo() const {
+    return !redoSteps.isEmpty();
+}
+
+int TopinoDocument::undo() {
+    if (undoSteps.isEmpty()) {
+        return IObserver::changeNone;
+    }
+
+    /* Swap the step with the current state of the same parts; the current state becomes the redo step */
+    UndoStep step = undoSteps.takeLast();
+    UndoStep current = captureUndoStep(step.changes);
+    undoMemory += estimateUndoStepSize(current) - estimateUndoStepSize(step);
+
+    restoreUndoStep(step);
+    redoSteps.append(current);
+
+    modify(step.changes);
+    return step.changes;
+}
+
+int TopinoDocument::redo() {
+    if (redoSteps.isEmpty()) {
+        return IObserver::changeNone;
+    }
+
+    UndoStep step = redoSteps.takeLast();
+    UndoStep current = captureUndoStep(step.changes);
+    undoMemory += estimateUndoStepSize(current) - estimateUndoStepSize(step);
+
+    restoreUndoStep(step);
+    undoSteps.append(current);
+
+    modify(step.changes);
+    return step.changes;
+}
+
+void TopinoDocument::clearUndoHistory() {
+    undoSteps.clear();
+    redoSteps.clear();
+    undoMemory = 0;
+}
+
+int TopinoDocument::getUndoMemoryLimit() const {
+    return undoMemoryLimit;
+}
+
+void TopinoDocument::setUndoMemoryLimit(int value) {
+    undoMemoryLimit = qMax(0, value);
+    limitUndoMemory();
+}
+
+TopinoDocument::UndoStep TopinoDocument::captureUndoStep(int changes) const {
+    UndoStep step;
+    step.changes = changes & undoableChanges;
+
+    if (step.changes & IObserver::changeProcessing) {
+        step.processed = data.isImageProcessed();
+        step.inversion = data.getInversion();
+        step.desatMode = data.getDesatMode();
+        step.levelMin = data.getLevelMin();
+        step.levelMax = data.getLevelMax();
+    }
+
+    if (step.changes & IObserver::changeGeometry) {
+        step.mainInletID = data.getMainInletID();
+        step.neutralAngle = data.getCoordNeutralAngle();
+        step.minAngle = data.getCoordMinAngle();
+        step.maxAngle = data.getCoordMaxAngle();
+        step.diffAngle = data.getCoordDiffAngle();
+        step.outerRadius = data.getCoordOuterRadius();
+        step.counterClockwise = data.getCoordCounterClockwise();
+        step.sectors = data.getCoordSectors();
+    }
+
+    if (step.changes & IObserver::changeInlets) {
+        step.inlets = data.getInlets();
+    }
+
+    if (step.changes & IObserver::changeStreams) {
+        step.streamParameters = data.getStreamParameters();
+        step.streamBaseline = data.getStreamBaseline();
+    }
+
+    return step;
+}
+
+void TopinoDocument::restoreUndoStep(const TopinoDocument::UndoStep& step) {
+    /* The processed image is recalculated from the parameters (or reset to the source image) */
+    if (step.changes & IObserver::changeProcessing) {
+        if (!step.processed) {
+            data.resetProcessing();
+        }
+
+        data.setInversion(step.inversion);
+        data.setDesatMode(step.desatMode);
+        data.setLevelMin(step.levelMin);
+        data.setLevelMax(step.levelMax);
+
+        if (step.processed) {
+            data.processImage();
+        }
+    }
+
+    /* Inlets before the geometry, since the geometry refers to the main inlet */
+    if (step.changes & IObserver::changeInlets) {
+        data.setInlets(step.inlets);
+    }
+
+    if (step.changes & IObserver::changeGeometry) {
+        data.setMainInletID(step.mainInletID);
+        data.setCoordNeutralAngle(step.neutralAngle);
+        data.setCoordMinAngle(step.minAngle);
+        data.setCoordMaxAngle(step.maxAngle);
+        data.setCoordDiffAngle(step.diffAngle);
+        data.setCoordOuterRadius(step.outerRadius);
+        data.setCoordCounterClockwise(step.counterClockwise);
+        data.setCoordSectors(step.sectors);
+    }
+
+    if (step.changes & IObserver::changeStreams) {
+        data.setStreamParameters(step.streamParameters);
+        data.setStreamBaseline(step.streamBaseline);
+    }
+}
+
+void TopinoDocument::recordUndoStep(const TopinoDocument::UndoStep& before, int changes) {
+    /* A new image cannot be undone, and the old steps do not fit it anymore */
+    if (changes & IObserver::changeImage) {
+        clearUndoHistory();
+        return;
+    }
+
+    /* Nothing to record if the edit did not change anything that can be undone */
+    if (before.changes == IObserver::changeNone) {
+        return;
+    }
+
+    if (isSameUndoStep(before, captureUndoStep(before.changes))) {
+        return;
+    }
+
+    undoSteps.append(before);
+    undoMemory += estimateUndoStepSize(before);
+
+    /* A new edit invalidates everything that could be redone */
+    for (auto it = redoSteps.constBegin(); it != redoSteps.constEnd(); ++it) {
+        undoMemory -= estimateUndoStepSize(*it);
+    }
+    redoSteps.clear();
+
+    limitUndoMemory();
+}
+
+void TopinoDocument::limitUndoMemory() {
+    while ((undoMemory > undoMemoryLimit) && !undoSteps.isEmpty()) {
+        undoMemory -= estimateUndoStepSize(undoSteps.takeFirst());
+    }
+}
+
+bool TopinoDocument::isSameUndoStep(const TopinoDocument::UndoStep& a, const TopinoDocument::UndoStep& b) {
+    if (a.changes != b.changes) {
+        return false;
+    }
+
+    if ((a.changes & IObserver::changeProcessing) &&
+            ((a.processed != b.processed) || (a.inversion != b.inversion) || (a.desatMode != b.desatMode) ||
+             (a.levelMin != b.levelMin) || (a.levelMax != b.levelMax))) {
+        return false;
+    }
+
+    if ((a.changes & IObserver::changeGeometry) &&
+            ((a.mainInletID != b.mainInletID) || (a.neutralAngle != b.neutralAngle) || (a.minAngle != b.minAngle) ||
+             (a.maxAngle != b.maxAngle) || (a.diffAngle != b.diffAngle) || (a.outerRadius != b.outerRadius) ||
+             (a.counterClockwise != b.counterClockwise) || (a.sectors != b.sectors))) {
+        return false;
+    }
+
+    if ((a.changes & IObserver::changeInlets) && !isSameInlets(a.inlets, b.inlets)) {
+        return false;
+    }
+
+    if ((a.changes & IObserver::changeStreams) &&
+            !isSameStreams(a.streamParameters, a.streamBaseline, b.streamParameters, b.streamBaseline)) {
+        return false;
+    }
+
+    return true;
+}
+
+int TopinoDocument::estimateUndoStepSize(const TopinoDocument::UndoStep& step) {
+    /* Rough estimate; shared vectors are counted for every step */
+    int size = int(sizeof(UndoStep));
+    size += step.inlets.length() * int(sizeof(TopinoData::InletData));
+    size += step.streamBaseline.signal.length() * int(sizeof(double));
+
+    for (auto it = step.streamParameters.constBegin(); it != step.streamParameters.constEnd(); ++it) {
+        size += int(sizeof(TopinoTools::Lorentzian)) +
+                (*it).resolutionCIs.length() * int(sizeof(TopinoTools::ConfidenceInterval));
+    }
+
+    return size;
+}
+
+void TopinoDocument::createDataHeader(QStringList& textData) const {
+    /* First, let's put in the name of the file we are evaluating here and then
+     * some information about the image */
+    textData.append(QObject::tr("Timestamp:") +"\t" + QDateTime::currentDateTime().toString("yyyy.MM.dd hh:mm:ss"));
+
+    if (hasFileName()) {
+        textData.append(QObject::tr("File:") + "\t" + filename);
+    }
+    textData.append(QString(QObject::tr("Image:") + "\t%1 × %2 Px²").arg(data.getImage().width()).arg(data.getImage().height()));
+
+    TopinoData::InletData inletData = data.getInletData(data.getMainInletID());
+    textData.append(QString(QObject::tr("Inlet:") + "\tx:\t%1 Px\ty:\t%2 Px\tRef. angle:\t%3°\tInner radius:\t%4 Px\tOuter radius:\t%5 Px")
+                    .arg(qRound(inletData.coord.x())).arg(qRound(inletData.coord.y()))
+                    .arg(data.getCoordNeutralAngle()).arg(inletData.radius).arg(data.getCoordOuterRadius()));
+    textData.append("");
+
+    /* Stream data: first the data of each stream */
+    textData.append("\t\t𝜑\t𝜑 (95% CI)\t𝜔\t𝜔 (95% CI)\tL²\tModel");
+    QVector<TopinoTools::Lorentzian> streams = data.getStreamParameters();
+    for(int i = 0; i < streams.length(); ++i) {
+        QString line;
+        line.sprintf("Stream %d\t%+.1f°\t%s\t%.1f°\t%s\t%.2f\t", i+1,
+                     streams[i].pos, formatConfidenceInterval(streams[i].posCI, "%+.2f°").toStdString().c_str(),
+                     streams[i].width, formatConfidenceInterval(streams[i].widthCI, "%.2f°").toStdString().c_str(),
+                     streams[i].rsquare);
+        textData.append(line + TopinoTools::getPeakModelName(streams[i].model));
+    }
+    textData.append("");
+
+    /* Stream data: add the resolutions between each stream */
+    textData.append("1. Stream\t2.Stream\tR₁₂\tR₁₂ (95% CI)");
+    for(int i = 0; i < streams.length(); ++i) {
+        for(int j = (i+1); j < streams.length(); ++j) {
+            QString line;
+            line.sprintf("%d\t%d\t%.2f\t%s", i+1, j+1, TopinoTools::calculateResolution(
+                             streams[i].pos, streams[i].width,
+                             streams[j].pos, streams[j].width),
+                         formatConfidenceInterval(TopinoTools::getResolutionCI(streams, i, j), "%.2f")
+                         .toStdString().c_str());
+            textData.append(line);
+        }
+    }
+}
+
+QString TopinoDocument::formatConfidenceInterval(const TopinoTools::ConfidenceInterval& interval, const char* format) const {
+    /* No interval calculated */
+    if (interval.isNull()) {
+        return QString("–");
+    }
+
+    QString lower;
+    lower.sprintf(format, interval.lower);
+    QString upper;
+    upper.sprintf(format, interval.upper);
+
+    return "[" + lower + ", " + upper + "]";
+}
+
+void TopinoDocument::createDataTable(QStringList& textData) const {
+    /* Same table as for the export, just split into lines */
+    QByteArray table;
+    QBuffer buffer(&table);
+    buffer.open(QIODevice::WriteOnly);
+    writeDataTable(buffer);
+    buffer.close();
+
+    textData.append(QString::fromUtf8(table).split('\n', QString::SkipEmptyParts));
+}
+
+/* Size of the blocks written by the exports */
+static const int exportBlockSize = 64 * 1024;
+
+QVector<QVector<double>> TopinoDocument::calculateFittedCurves(const TopinoTools::SampledSignal& angulagram) const {
+    QVector<TopinoTools::Lorentzian> parameters = data.getStreamParameters();
+    TopinoTools::Baseline baseline = data.getStreamBaseline();
+    int length = angulagram.length();
+
+    /* Column by column, so that each loop only evaluates one function */
+    QVector<double> base(length, 0.0);
+    if (!baseline.isNull()) {
+        for (int i = 0; i < length; ++i) {
+            base[i] = baseline.f(angulagram.x(i));
+        }
+    }
+
+    QVector<QVector<double>> columns;
+    if (!baseline.isNull()) {
+        columns.append(base);
+    }
+
+    for (auto it = parameters.constBegin(); it != parameters.constEnd(); ++it) {
+        QVector<double> column(base);
+        double *values = column.data();
+
+        for (int i = 0; i < length; ++i) {
+            values[i] += it->f(angulagram.x(i));
+        }
+
+        columns.append(column);
+    }
+
+    return columns;
+}
+
+void TopinoDocument::writeDataTable(QIODevice& device) const {
+    /* For each point in data points, we add the respective raw data point and the
+    * stream fits. */
+    int fits = data.getStreamParameters().length();
+    bool hasBaseline = !data.getStreamBaseline().isNull();
+
+    /* Header of table; if there is a baseline, it is added to the fits and included as column */
+    QString header = QObject::tr("All data intensities are in arbitrary units.") + "\n" + "𝜑 (°)\traw data int";
+    if (hasBaseline) {
+        header += "\tBaseline";
+    }
+    for (int i = 0; i < fits; ++i) {
+        header += "\tStream " + QString::number(i+1);
+    }
+    device.write(header.toUtf8() + "\n");
+
+    /* Contents of table; the rows are formatted into a buffer that is written in blocks */
+    TopinoTools::SampledSignal angulagram = data.getAngulagram();
+    QVector<QVector<double>> columns = calculateFittedCurves(angulagram);
+
+    QByteArray buffer;
+    buffer.reserve(exportBlockSize + 1024);
+
+    for (int i = 0; i < angulagram.length(); ++i) {
+        TopinoTools::appendFixedNumber(buffer, angulagram.x(i), 3);
+        buffer.append('\t');
+        TopinoTools::appendFixedNumber(buffer, angulagram.y(i), 4);
+
+        for (auto it = columns.constBegin(); it != columns.constEnd(); ++it) {
+            buffer.append('\t');
+            TopinoTools::appendFixedNumber(buffer, it->at(i), 4);
+        }
+
+        buffer.append('\n');
+
+        if (buffer.size() >= exportBlockSize) {
+            device.write(buffer);
+            buffer.clear();
+        }
+    }
+
+    device.write(buffer);
+}
+
+void TopinoDocument::exportDataToText(const QString& filename) const {
+    qDebug("Exporting data to %s", filename.toStdString().c_str());
+
+    /* The header is small; the table is written row by row */
+    QStringList textdata;
+    createDataHeader(textdata);
+    textdata.append("");
+
+    QFile file(filename);
+    if (file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+        file.write(textdata.join("\n").toUtf8() + "\n");
+        writeDataTable(file);
+        file.close();
+    } else {
+        qDebug("Could not open file %s", filename.toStdString().c_str());
+    }
+}
+
+const char* TopinoDocument::getExportDataSetName(TopinoDocument::exportDataSets set) {
+    const char *names[] = {
+        "Angulagram",
+        "Fitted curves",
+        "Radialgram",
+        "Polar image"
+    };
+
+    if (set >= exportCOUNT)
+        return "";
+
+    return names[set];
+}
+
+static void appendFloat32(QByteArray& buffer, double value) {
+    float single = float(value);
+    quint32 bits;
+    memcpy(&bits, &single, sizeof(bits));
+    bits = qToLittleEndian(bits);
+    buffer.append(reinterpret_cast<const char *>(&bits), sizeof(bits));
+}
+
+static void writeNumPyHeader(QIODevice& device, int rows, int columns) {
+    /* Format version 1.0: magic, version, header length, and the header as Python dictionary padded
+     * with spaces (and a final newline), so that the data starts at a multiple of 64 bytes */
+    QByteArray header = QString("{'descr': '<f4', 'fortran_order': False, 'shape': (%1, %2), }")
+                        .arg(rows).arg(columns).toLatin1();
+    int total = 10 + header.size() + 1;
+    header.append(QByteArray((64 - total % 64) % 64, ' '));
+    header.append('\n');
+
+    quint16 length = qToLittleEndian(quint16(header.size()));
+
+    device.write("\x93NUMPY\x01\x00", 8);
+    device.write(reinterpret_cast<const char *>(&length), sizeof(length));
+    device.write(header);
+}
+
+bool TopinoDocument::exportDataToBinary(const QString& filename, TopinoDocument::exportDataSets set, bool numpy) const {
+    qDebug("Exporting %s to %s", getExportDataSetName(set), filename.toStdString().c_str());
+
+    /* The radialgram and the polar image might not be calculated yet; a copy is cheap */
+    TopinoData exportData = data;
+    TopinoTools::SampledSignal signal;
+    QVector<QVector<double>> columns;
+    QImage polarImage;
+    int rows = 0;
+    int columnCount = 0;
+
+    switch (set) {
+    case exportFittedCurves:
+        signal = exportData.getAngulagram();
+        columns = calculateFittedCurves(signal);
+        rows = signal.length();
+        columnCount = 2 + columns.length();
+        break;
+
+    case exportRadialgram:
+        exportData.updateStage(TopinoData::stageRadialgram);
+        signal = exportData.getRadialgram();
+        rows = signal.length();
+        columnCount = 2;
+        break;
+
+    case exportPolarImage:
+        exportData.updateStage(TopinoData::stagePolar);
+        polarImage = exportData.getPolarImage();
+        rows = polarImage.height();
+        columnCount = polarImage.width();
+        break;
+
+    case exportAngulagram:
+    default:
+        signal = exportData.getAngulagram();
+        rows = signal.length();
+        columnCount = 2;
+        break;
+    }
+
+    if ((rows == 0) || (columnCount == 0)) {
+        qDebug("Nothing to export.");
+        return false;
+    }
+
+    QFile file(filename);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qDebug("Could not open file %s", filename.toStdString().c_str());
+        return false;
+    }
+
+    if (numpy) {
+        writeNumPyHeader(file, rows, columnCount);
+    }
+
+    /* Rows are converted into a buffer that is written in blocks */
+    QByteArray buffer;
+    buffer.reserve(exportBlockSize + columnCount * int(sizeof(float)));
+
+    for (int i = 0; i < rows; ++i) {
+        if (!polarImage.isNull()) {
+            /* All channels have the same value, so the green channel is the gray value */
+            const QRgb *line = reinterpret_cast<const QRgb *>(polarImage.constScanLine(i));
+
+            for (int x = 0; x < columnCount; ++x) {
+                appendFloat32(buffer, qGreen(line[x]));
+            }
+        } else {
+            appendFloat32(buffer, signal.x(i));
+            appendFloat32(buffer, signal.y(i));
+
+            for (auto it = columns.constBegin(); it != columns.constEnd(); ++it) {
+                appendFloat32(buffer, it->at(i));
+            }
+        }
+
+        if (buffer.size() >= exportBlockSize) {
+            file.write(buffer);
+            buffer.clear();
+        }
+    }
+
+    file.write(buffer);
+
+    return (file.error() == QFileDevice::NoError);
+}
+
+TopinoDocument::FileError TopinoDocument::readTopinoXML(QXmlStreamReader& xml, QByteArray *encodedImage) {
+    /* Read all elements */
+    while (xml.readNextStartElement()) {
+        qDebug("Found element %s in XML...", xml.name().toString().toStdString().c_str());
+
+        if (data.loadObject(xml, encodedImage) == TopinoData::ParsingError::IgnoredElement) {
+            xml.skipCurrentElement();
+        }
+    }
+
+    return FileError::NoFailure;
+}
+
+TopinoDocument::FileError TopinoDocument::saveTopinoXML(QXmlStreamWriter& xml, bool includeImageData, const QString& imageReference) {
+    /* Document header <topino> with <version> element */
+    xml.writeStartElement("topino");
+    xml.writeTextElement("version", version);
+
+    /* Save all the data objects */
+    data.saveImageObject(xml, includeImageData, imageReference);
+    data.saveCoordinateObject(xml);
+    data.saveInletsObject(xml);
+    data.saveStreamParameters(xml);
+    data.saveStreamBaseline(xml);
+
+    /* Calculated results are saved last, so that they can be checked against the parameters when loading */
+    if (storeResults) {
+        data.saveDerivedObject(xml, includeImageData);
+    }
 
     xml.writeEndElement();
 
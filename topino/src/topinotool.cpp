@@ -1,5 +1,14 @@
 #include "include/topinotool.h"
 
+#include <cstring>
+#include <functional>
+#include <numeric>
+#include <QElapsedTimer>
+#include <QRandomGenerator>
+#include <QtConcurrent/QtConcurrentMap>
+
+#include <unsupported/Eigen/FFT>
+
 /* Receives the unit prefix (e.g. nano, micro, milli, etc) for a double value and updates the
  * value to match the prefix. */
 QString TopinoTools::getUnitPrefix(qreal &value) {
@@ -27,6 +36,40 @@ QString TopinoTools::getUnitPrefix(qreal &value) {
     return QString("");
 }
 
+void TopinoTools::appendFixedNumber(QByteArray& buffer, double value, int decimals) {
+    static const double powers[10] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+    decimals = qBound(0, decimals, 9);
+
+    double scaled = qAbs(value) * powers[decimals];
+    if (!qIsFinite(value) || (scaled >= 9.0e18)) {
+        buffer.append(QByteArray::number(value, 'f', decimals));
+        return;
+    }
+
+    /* Digits of the rounded, scaled value in reverse order; at least one digit before the point */
+    quint64 fixed = quint64(scaled + 0.5);
+    bool negative = (value < 0.0) && (fixed > 0);
+    char digits[24];
+    int count = 0;
+
+    do {
+        digits[count++] = char('0' + fixed % 10);
+        fixed /= 10;
+    } while ((fixed > 0) || (count <= decimals));
+
+    if (negative) {
+        buffer.append('-');
+    }
+
+    for (int i = count - 1; i >= 0; --i) {
+        buffer.append(digits[i]);
+
+        if ((i == decimals) && (decimals > 0)) {
+            buffer.append('.');
+        }
+    }
+}
+
 QString TopinoTools::getDesaturationModeName(TopinoTools::desaturationModes mode) {
     /* Names for the desaturation modes */
     const char *desatNames[desaturationModes::desatCOUNT] = {
@@ -474,9 +517,19 @@ qreal TopinoTools::crossProduct(const QPointF& p, const QPointF& q) {
 }
 
 
-void TopinoTools::smoothByGaussianKernel(QVector<QPointF> &points, int size, qreal sigma) {
+QVector<QPointF> TopinoTools::SampledSignal::toPoints() const {
+    QVector<QPointF> points(values.length());
+
+    for(int i = 0; i < values.length(); ++i) {
+        points[i] = QPointF(x(i), values[i]);
+    }
+
+    return points;
+}
+
+void TopinoTools::smoothByGaussianKernel(SampledSignal &signal, int size, qreal sigma) {
     /* First, we need to prepare the kernel weight array. */
-    QVector<qreal> kernel;
+    QVector<double> kernel;
 
     int midIndex = size / 2;
     for (int i = 0; i < size; ++i) {
@@ -489,36 +542,44 @@ void TopinoTools::smoothByGaussianKernel(QVector<QPointF> &points, int size, qre
      * the length - midindex) so that we have enough points to the left and
      * right to smooth. Ideally, the points to the left and right should be
      * background anyway. */
-    QVector<QPointF> smoothendPoints;
-    qreal sum = 0.0;
-    for(int i = midIndex; i < (points.length() - midIndex); ++i) {
-        sum = 0.0;
+    int length = signal.values.length() - 2 * midIndex;
+    if (length <= 0) {
+        signal.values.clear();
+        return;
+    }
 
-        /* Now smoothen the points around this middle point with the kernel
-         * weights. */
+    QVector<double> smoothendValues(length);
+    const double *source = signal.values.constData();
+    const double *weights = kernel.constData();
+    double *target = smoothendValues.data();
+
+    for(int i = 0; i < length; ++i) {
+        /* Now smoothen the values around this middle point with the kernel
+         * weights; both arrays are contiguous, so this loop vectorizes. */
+        double sum = 0.0;
         for(int k = 0; k < size; ++k) {
-            sum += points[i + k - midIndex].y() * kernel[k];
+            sum += source[i + k] * weights[k];
         }
 
-        /* Save the new value. */
-        smoothendPoints.append(QPointF(points[i].x(), sum));
+        target[i] = sum;
     }
 
-    /* Return the smoothened points in the same array. */
-    points = smoothendPoints;
+    /* Return the smoothened values in the same signal; the grid starts midIndex points later. */
+    signal.start = signal.x(midIndex);
+    signal.values = smoothendValues;
 }
 
 qreal TopinoTools::gaussianKernel(qreal value, qreal sigma) {
     return 1.0 / sqrt(2.0 * M_PI * sigma * sigma) * qExp(- (value * value) / (2.0 * sigma * sigma));
 }
 
-void TopinoTools::getExtrema(const QVector<QPointF>& points, QVector<Extrema>& extrema) {
+void TopinoTools::getExtrema(const SampledSignal& signal, QVector<Extrema>& extrema) {
     /* Clear list to be sure that there is no remaining data in it */
     extrema.clear();
 
-    /* Make sure there are at least 3 points in points; otherwise this does not make much
+    /* Make sure there are at least 3 points in the signal; otherwise this does not make much
      * sense there. */
-    if (points.length() < 3) {
+    if (signal.length() < 3) {
         return;
     }
 
@@ -528,23 +589,23 @@ void TopinoTools::getExtrema(const QVector<QPointF>& points, QVector<Extrema>& e
     TopinoTools::slopeDirection lastDirection = directionAscending;
 
     currentExtrema.index = 0;
-    currentExtrema.pos = points[0];
+    currentExtrema.pos = signal.point(0);
 
-    for(int i = 1; i < points.length(); ++i) {
+    for(int i = 1; i < signal.length(); ++i) {
         /* Delta is always between this point and the last one */
-        qreal delta = points[i].y() - points[i-1].y();
+        qreal delta = signal.values[i] - signal.values[i-1];
 
         /* Value changed? Then update the index/value of the current extrema */
         if (delta != 0.0) {
             currentExtrema.index = i;
-            currentExtrema.pos = points[i];
+            currentExtrema.pos = signal.point(i);
         }
 
         /* Asceding now, but last direction was descending -> Minima found! */
         if ((delta > 0) && (lastDirection == directionDescending)) {
             /* Calculate the average index if we are sitting on a flat point (to get the middle) */
             currentExtrema.index = (currentExtrema.index + i) / 2;
-            currentExtrema.pos = points[i];
+            currentExtrema.pos = signal.point(i);
             currentExtrema.type = extremaMinimum;
 
             /* Save extrema */
@@ -554,7 +615,7 @@ void TopinoTools::getExtrema(const QVector<QPointF>& points, QVector<Extrema>& e
         else if ((delta < 0) && (lastDirection == directionAscending)) {
             /* Calculate the average index if we are sitting on a flat point (to get the middle) */
             currentExtrema.index = (currentExtrema.index + i) / 2;
-            currentExtrema.pos = points[i];
+            currentExtrema.pos = signal.point(i);
             currentExtrema.type = extremaMaximum;
 
             /* Save extrema */
@@ -586,6 +647,347 @@ void TopinoTools::filterExtrema(QVector<TopinoTools::Extrema>& extrema, qreal th
     extrema = filteredExtrema;
 }
 
+qreal TopinoTools::Baseline::f(qreal x) const {
+    if (signal.isEmpty()) {
+        return 0.0;
+    }
+
+    /* Position on the grid; the step is negative for descending x-values (depending on the orientation) */
+    qreal t = (signal.step != 0.0) ? (x - signal.start) / signal.step : 0.0;
+
+    /* Outside of the baseline: keep the value of the first/last sample */
+    if (t <= 0.0) {
+        return signal.values.first();
+    } else if (t >= (signal.length() - 1)) {
+        return signal.values.last();
+    }
+
+    int left = qFloor(t);
+    qreal fraction = t - left;
+
+    return signal.values[left] + (signal.values[left + 1] - signal.values[left]) * fraction;
+}
+
+TopinoTools::Baseline TopinoTools::calculateBaselineALS(const QVector<QPointF>& points, qreal lambda, qreal asymmetry, int iterations) {
+    TopinoTools::Baseline baseline;
+    baseline.lambda = lambda;
+    baseline.asymmetry = asymmetry;
+
+    int n = points.length();
+    if (n == 0) {
+        return baseline;
+    }
+
+    baseline.signal.start = points.first().x();
+    baseline.signal.step = (n > 1) ? (points[1].x() - points[0].x()) : 1.0;
+
+    if (n < 3) {
+        for(int i = 0; i < n; ++i) {
+            baseline.signal.values.append(points[i].y());
+        }
+
+        return baseline;
+    }
+
+    /* The penalty matrix lambda * D^T * D with the second difference matrix D is pentadiagonal; the
+     * entries are lambda * (1, -4, 6, -4, 1) except for the first and last two rows. */
+    QVector<Eigen::Triplet<double>> triplets;
+    triplets.reserve(5 * n);
+
+    for(int k = 0; k < (n - 2); ++k) {
+        /* Each row of D is (1, -2, 1) at k, k+1, k+2; add its outer product */
+        const double d[3] = { 1.0, -2.0, 1.0 };
+
+        for(int i = 0; i < 3; ++i) {
+            for(int j = 0; j < 3; ++j) {
+                triplets.append(Eigen::Triplet<double>(k + i, k + j, lambda * d[i] * d[j]));
+            }
+        }
+    }
+
+    Eigen::SparseMatrix<double> penalty(n, n);
+    penalty.setFromTriplets(triplets.begin(), triplets.end());
+
+    /* Weights and data */
+    Eigen::VectorXd y(n);
+    for(int i = 0; i < n; ++i) {
+        y(i) = points[i].y();
+    }
+
+    Eigen::VectorXd w = Eigen::VectorXd::Ones(n);
+    Eigen::VectorXd z = y;
+
+    /* The pattern of the matrix does not change, so analyze it only once */
+    Eigen::SimplicialLDLT<Eigen::SparseMatrix<double>> solver;
+    Eigen::SparseMatrix<double> system = penalty;
+    solver.analyzePattern(system);
+
+    for(int iteration = 0; iteration < iterations; ++iteration) {
+        /* System matrix W + lambda * D^T * D (the diagonal is always part of the pattern) */
+        system = penalty;
+        for(int i = 0; i < n; ++i) {
+            system.coeffRef(i, i) += w(i);
+        }
+
+        solver.factorize(system);
+        if (solver.info() != Eigen::Success) {
+            qDebug("Baseline: factorization failed in iteration %d", iteration);
+            break;
+        }
+
+        z = solver.solve(w.cwiseProduct(y));
+
+        /* New weights: small for points above (i.e. peaks), large for points below the baseline */
+        Eigen::VectorXd newWeights(n);
+        for(int i = 0; i < n; ++i) {
+            newWeights(i) = (y(i) > z(i)) ? asymmetry : (1.0 - asymmetry);
+        }
+
+        /* Converged? */
+        if (newWeights == w) {
+            break;
+        }
+
+        w = newWeights;
+    }
+
+    baseline.signal.values.resize(n);
+    for(int i = 0; i < n; ++i) {
+        baseline.signal.values[i] = z(i);
+    }
+
+    return baseline;
+}
+
+QVector<QPointF> TopinoTools::subtractBaseline(const QVector<QPointF>& points, const TopinoTools::Baseline& baseline) {
+    QVector<QPointF> corrected = points;
+
+    if (baseline.signal.length() != points.length()) {
+        return corrected;
+    }
+
+    for(int i = 0; i < corrected.length(); ++i) {
+        corrected[i].setY(points[i].y() - baseline.signal.values[i]);
+    }
+
+    return corrected;
+}
+
+QString TopinoTools::getPeakFilterCriterionName(TopinoTools::peakFilterCriteria criterion) {
+    /* Names for the filter criteria */
+    const char *criteriaNames[peakFilterCriteria::filterCOUNT] = {
+        "Height",
+        "Prominence",
+        "Wavelet (SNR)"
+    };
+
+    if ((criterion < 0) || (criterion >= peakFilterCriteria::filterCOUNT)) {
+        return QString("");
+    }
+
+    return QString(criteriaNames[criterion]);
+}
+
+QString TopinoTools::getPeakModelName(TopinoTools::peakModels model) {
+    /* Names for the peak models */
+    const char *modelNames[peakModels::modelCOUNT] = {
+        "Lorentzian",
+        "Gaussian",
+        "Pseudo-Voigt",
+        "EMG"
+    };
+
+    if ((model < 0) || (model >= peakModels::modelCOUNT)) {
+        return QString("");
+    }
+
+    return QString(modelNames[model]);
+}
+
+int TopinoTools::PeakHierarchy::indexOfMinimum(int left, int right) const {
+    if (left > right) {
+        std::swap(left, right);
+    }
+
+    /* Two (overlapping) ranges of length 2^k cover the full range */
+    int k = 0;
+    while ((2 << k) <= (right - left + 1)) {
+        ++k;
+    }
+
+    int a = minimumTable[k][left];
+    int b = minimumTable[k][right - (1 << k) + 1];
+
+    return (points[b].y() < points[a].y()) ? b : a;
+}
+
+TopinoTools::PeakHierarchy TopinoTools::calculatePeakHierarchy(const QVector<QPointF>& points) {
+    TopinoTools::PeakHierarchy hierarchy;
+    hierarchy.points = points;
+
+    int n = points.length();
+    if (n < 3) {
+        return hierarchy;
+    }
+
+    /* Sort the indices from the highest to the lowest value; for the same value, the left one first */
+    QVector<int> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&points](int a, int b) {
+        return (points[a].y() > points[b].y()) || ((points[a].y() == points[b].y()) && (a < b));
+    });
+
+    /* Union-find structure; each component is represented by its peak (the highest point) */
+    QVector<int> parent(n, -1);
+    QVector<int> saddle(n, -1);
+    QVector<qreal> death(n, 0.0);
+
+    std::function<int(int)> find = [&parent](int i) {
+        int root = i;
+        while (parent[root] != root) {
+            root = parent[root];
+        }
+
+        /* Path compression */
+        while (parent[i] != root) {
+            int next = parent[i];
+            parent[i] = root;
+            i = next;
+        }
+
+        return root;
+    };
+
+    for(auto it = order.begin(); it != order.end(); ++it) {
+        int i = *it;
+        parent[i] = i;
+
+        /* Merge with the active neighbours; when two components meet, the one with the lower
+         * peak dies here and this point is its saddle. */
+        for(int neighbour = i - 1; neighbour <= i + 1; neighbour += 2) {
+            if ((neighbour < 0) || (neighbour >= n) || (parent[neighbour] == -1)) {
+                continue;
+            }
+
+            int rootA = find(i);
+            int rootB = find(neighbour);
+
+            if (rootA == rootB) {
+                continue;
+            }
+
+            /* The higher peak survives (roots are peaks, so they were inserted before this point) */
+            bool aHigher = (points[rootA].y() > points[rootB].y()) || ((points[rootA].y() == points[rootB].y()) && (rootA < rootB));
+            int survivor = aHigher ? rootA : rootB;
+            int dying = aHigher ? rootB : rootA;
+
+            /* A component consisting of only this point is not a peak */
+            if (dying != i) {
+                saddle[dying] = i;
+                death[dying] = points[i].y();
+            }
+
+            parent[dying] = survivor;
+        }
+    }
+
+    /* Collect all real peaks, i.e. all local maxima that are not at the borders (same as getExtrema).
+     * The highest peak never dies; its prominence is taken to the lowest point. */
+    qreal minValue = points[order.last()].y();
+
+    for(int i = 1; i < (n - 1); ++i) {
+        bool isRoot = (find(i) == i);
+        bool isPeak = isRoot || (saddle[i] != -1);
+
+        if (!isPeak) {
+            continue;
+        }
+
+        /* Peaks on a plateau are found at the left end; move them to the middle like getExtrema */
+        int right = i;
+        while ((right + 1 < n) && (points[right + 1].y() == points[i].y())) {
+            ++right;
+        }
+
+        if ((right == n - 1) || (points[i - 1].y() >= points[i].y())) {
+            continue;
+        }
+
+        TopinoTools::PersistencePeak peak;
+        peak.index = (i + right) / 2;
+        peak.saddleIndex = saddle[i];
+        peak.height = points[i].y();
+        peak.prominence = points[i].y() - (isRoot ? minValue : death[i]);
+
+        hierarchy.peaks.append(peak);
+    }
+
+    std::sort(hierarchy.peaks.begin(), hierarchy.peaks.end(), [](const TopinoTools::PersistencePeak &a, const TopinoTools::PersistencePeak &b) {
+        return a.prominence > b.prominence;
+    });
+
+    /* Sparse table: minimumTable[k][i] is the index of the minimum in [i, i + 2^k) */
+    QVector<int> identity(n);
+    std::iota(identity.begin(), identity.end(), 0);
+    hierarchy.minimumTable.append(identity);
+
+    for(int k = 1; (1 << k) <= n; ++k) {
+        const QVector<int> &previous = hierarchy.minimumTable[k - 1];
+        QVector<int> current(n - (1 << k) + 1);
+
+        for(int i = 0; i < current.length(); ++i) {
+            int a = previous[i];
+            int b = previous[i + (1 << (k - 1))];
+            current[i] = (points[b].y() < points[a].y()) ? b : a;
+        }
+
+        hierarchy.minimumTable.append(current);
+    }
+
+    return hierarchy;
+}
+
+QVector<TopinoTools::Extrema> TopinoTools::getExtremaFromHierarchy(const TopinoTools::PeakHierarchy& hierarchy, qreal cutoff,
+        TopinoTools::peakFilterCriteria criterion) {
+    QVector<TopinoTools::Extrema> extrema;
+
+    /* Select all maxima above the cutoff and sort them by their position */
+    QVector<int> maxima;
+    for(auto it = hierarchy.peaks.begin(); it != hierarchy.peaks.end(); ++it) {
+        qreal value = (criterion == filterProminence) ? it->prominence : it->height;
+
+        if (value > cutoff) {
+            maxima.append(it->index);
+        }
+    }
+
+    std::sort(maxima.begin(), maxima.end());
+
+    /* Add the maxima and the minimum between each pair of them; like in filterExtrema, a minimum is only
+     * kept above the cutoff when filtering by height. The minimum between two prominent peaks is always
+     * lower than both by more than the cutoff, so it is always kept. */
+    for(int i = 0; i < maxima.length(); ++i) {
+        if (i > 0) {
+            TopinoTools::Extrema minimum;
+            minimum.index = hierarchy.indexOfMinimum(maxima[i - 1], maxima[i]);
+            minimum.pos = hierarchy.points[minimum.index];
+            minimum.type = extremaMinimum;
+
+            if ((criterion == filterProminence) || (minimum.pos.y() > cutoff)) {
+                extrema.append(minimum);
+            }
+        }
+
+        TopinoTools::Extrema maximum;
+        maximum.index = maxima[i];
+        maximum.pos = hierarchy.points[maxima[i]];
+        maximum.type = extremaMaximum;
+        extrema.append(maximum);
+    }
+
+    return extrema;
+}
+
 int TopinoTools::countExtrema(const QVector<TopinoTools::Extrema>& extrema, TopinoTools::extremaType type) {
     int count = 0;
 
@@ -610,6 +1012,252 @@ QVector<TopinoTools::Extrema> TopinoTools::splitExtrema(const QVector<TopinoTool
     return splitted;
 }
 
+QVector<TopinoTools::WaveletPeak> TopinoTools::calculateWaveletPeaks(const TopinoTools::SampledSignal& signal, int scaleCount,
+        qreal minScale, qreal maxScale) {
+    QVector<TopinoTools::WaveletPeak> peaks;
+    int n = signal.length();
+
+    if (maxScale <= 0.0) {
+        maxScale = n / 8.0;
+    }
+
+    if ((n < 8) || (scaleCount < 2) || (minScale <= 0.0) || (maxScale <= minScale)) {
+        return peaks;
+    }
+
+    /* Logarithmically spaced scales (in points) */
+    QVector<qreal> scales(scaleCount);
+    for(int s = 0; s < scaleCount; ++s) {
+        scales[s] = minScale * qPow(maxScale / minScale, qreal(s) / (scaleCount - 1));
+    }
+
+    /* The signal is mirrored at both ends (to avoid artifacts at the borders) and zero-padded to a power
+     * of two, so that the circular convolution of the FFT does not wrap around. The wavelet decays to
+     * virtually zero within 5 scales. */
+    int padding = qMin(n - 1, int(qCeil(5.0 * maxScale)));
+    int length = 1;
+    while (length < (n + 2 * padding + int(qCeil(5.0 * maxScale)))) {
+        length *= 2;
+    }
+
+    std::vector<double> padded(length, 0.0);
+    for(int i = 0; i < n + 2 * padding; ++i) {
+        int index = i - padding;
+        if (index < 0) {
+            index = -index;
+        } else if (index >= n) {
+            index = 2 * (n - 1) - index;
+        }
+        padded[i] = signal.values[index];
+    }
+
+    Eigen::FFT<double> fft;
+    std::vector<std::complex<double>> spectrum;
+    fft.fwd(spectrum, padded);
+
+    /* The Ricker wavelet psi(t) = A (1 - t²/a²) exp(-t²/(2a²)) with A = 2 / (sqrt(3a) pi^(1/4)) has the
+     * (real) Fourier transform A a sqrt(2 pi) a² w² exp(-a² w²/2). Hence, the transform for each scale is
+     * a multiplication of the spectrum and one inverse FFT. */
+    QVector<QVector<double>> coefficients(scaleCount);
+    std::vector<std::complex<double>> product(length);
+    std::vector<double> result;
+
+    for(int s = 0; s < scaleCount; ++s) {
+        qreal a = scales[s];
+        qreal amplitude = 2.0 / (qSqrt(3.0 * a) * qPow(M_PI, 0.25)) * a * qSqrt(2.0 * M_PI) * a * a;
+
+        for(int k = 0; k < length; ++k) {
+            qreal w = 2.0 * M_PI * ((k <= length / 2) ? k : k - length) / length;
+            product[k] = spectrum[k] * (amplitude * w * w * qExp(-a * a * w * w / 2.0));
+        }
+
+        fft.inv(result, product);
+        coefficients[s] = QVector<double>(result.begin() + padding, result.begin() + padding + n);
+    }
+
+    /* Link the local maxima of the coefficients to ridge lines, starting at the largest scale. A ridge line
+     * continues at the closest maximum of the next smaller scale within a distance of a quarter of the
+     * scale (at least one point); up to two scales may be skipped (gap). */
+    struct RidgeLine {
+        QVector<int> indices;
+        QVector<int> scaleIndices;
+        int gap = 0;
+    };
+
+    QVector<RidgeLine> activeLines;
+    QVector<RidgeLine> finishedLines;
+    const int maxGap = 2;
+
+    for(int s = scaleCount - 1; s >= 0; --s) {
+        const QVector<double> &row = coefficients[s];
+
+        QVector<int> maxima;
+        for(int i = 1; i < (n - 1); ++i) {
+            if ((row[i] > 0.0) && (row[i] >= row[i-1]) && (row[i] > row[i+1])) {
+                maxima.append(i);
+            }
+        }
+
+        QVector<bool> used(maxima.length(), false);
+        int maxDistance = qMax(1, qRound(scales[s] / 4.0));
+
+        for(auto line = activeLines.begin(); line != activeLines.end(); ++line) {
+            int last = line->indices.last();
+            int best = -1;
+
+            for(int m = 0; m < maxima.length(); ++m) {
+                int distance = qAbs(maxima[m] - last);
+                if (!used[m] && (distance <= maxDistance) && ((best == -1) || (distance < qAbs(maxima[best] - last)))) {
+                    best = m;
+                }
+            }
+
+            if (best != -1) {
+                used[best] = true;
+                line->indices.append(maxima[best]);
+                line->scaleIndices.append(s);
+                line->gap = 0;
+            } else {
+                line->gap++;
+            }
+        }
+
+        /* Lines with too large gaps are finished */
+        for(int l = activeLines.length() - 1; l >= 0; --l) {
+            if (activeLines[l].gap > maxGap) {
+                finishedLines.append(activeLines.takeAt(l));
+            }
+        }
+
+        /* Remaining maxima start new lines */
+        for(int m = 0; m < maxima.length(); ++m) {
+            if (!used[m]) {
+                RidgeLine line;
+                line.indices.append(maxima[m]);
+                line.scaleIndices.append(s);
+                activeLines.append(line);
+            }
+        }
+    }
+    finishedLines.append(activeLines);
+
+    /* Noise: standard deviation of the coefficients at the smallest scale (which contains mostly noise) in
+     * a window around the peak, robustly estimated by the median absolute value. Due to the normalization
+     * of the wavelet, white noise has the same standard deviation at all scales. */
+    QVector<double> noiseRow(n);
+    for(int i = 0; i < n; ++i) {
+        noiseRow[i] = qAbs(coefficients[0][i]);
+    }
+    int window = qMax(10, n / 40);
+
+    int minRidgeLength = qMax(2, scaleCount / 4);
+    for(auto line = finishedLines.begin(); line != finishedLines.end(); ++line) {
+        if (line->indices.length() < minRidgeLength) {
+            continue;
+        }
+
+        /* Position and scale of the largest coefficient along the ridge line */
+        WaveletPeak peak;
+        peak.ridgeLength = line->indices.length();
+        for(int r = 0; r < line->indices.length(); ++r) {
+            qreal coefficient = coefficients[line->scaleIndices[r]][line->indices[r]];
+            if (coefficient > peak.coefficient) {
+                peak.coefficient = coefficient;
+                peak.index = line->indices[r];
+                peak.scale = scales[line->scaleIndices[r]];
+            }
+        }
+
+        if (peak.index == -1) {
+            continue;
+        }
+
+        /* At large scales, neighbouring peaks shift the ridge line; hence, the position is taken at the
+         * smallest scale where the coefficient still reaches a quarter of the maximum. */
+        for(int r = line->indices.length() - 1; r >= 0; --r) {
+            if (coefficients[line->scaleIndices[r]][line->indices[r]] >= peak.coefficient / 4.0) {
+                peak.index = line->indices[r];
+                break;
+            }
+        }
+
+        int left = qMax(0, peak.index - window);
+        int right = qMin(n, peak.index + window + 1);
+        std::vector<double> values(noiseRow.constBegin() + left, noiseRow.constBegin() + right);
+        std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+        qreal noise = values[values.size() / 2] / 0.6745;
+
+        peak.snr = (noise > 0.0) ? peak.coefficient / noise : std::numeric_limits<qreal>::max();
+        peaks.append(peak);
+    }
+
+    std::sort(peaks.begin(), peaks.end(), [](const WaveletPeak& a, const WaveletPeak& b) {
+        return a.index < b.index;
+    });
+
+    /* Different ridge lines might end up at (almost) the same position, e.g. noise on top of a broad peak;
+     * a peak is only kept if there is no stronger peak within twice its own scale. */
+    QVector<TopinoTools::WaveletPeak> separatedPeaks;
+    for(int i = 0; i < peaks.length(); ++i) {
+        bool separated = true;
+
+        for(int j = 0; separated && (j < peaks.length()); ++j) {
+            if ((j != i) && (peaks[j].coefficient > peaks[i].coefficient) &&
+                    (qAbs(peaks[j].index - peaks[i].index) <= qMax(1.0, 2.0 * peaks[i].scale))) {
+                separated = false;
+            }
+        }
+
+        if (separated) {
+            separatedPeaks.append(peaks[i]);
+        }
+    }
+
+    return separatedPeaks;
+}
+
+QVector<TopinoTools::Extrema> TopinoTools::getExtremaFromWaveletPeaks(const QVector<QPointF>& points,
+        const QVector<TopinoTools::WaveletPeak>& peaks, qreal minSNR) {
+    QVector<TopinoTools::Extrema> extrema;
+    int lastIndex = -1;
+
+    for(auto it = peaks.begin(); it != peaks.end(); ++it) {
+        if ((it->snr < minSNR) || (it->index < 0) || (it->index >= points.length())) {
+            continue;
+        }
+
+        /* Deepest point between the last peak and this one */
+        if (lastIndex != -1) {
+            int minimumIndex = lastIndex + 1;
+            for(int i = lastIndex + 1; i < it->index; ++i) {
+                if (points[i].y() < points[minimumIndex].y()) {
+                    minimumIndex = i;
+                }
+            }
+
+            if (minimumIndex >= it->index) {
+                continue;
+            }
+
+            TopinoTools::Extrema minimum;
+            minimum.index = minimumIndex;
+            minimum.pos = points[minimumIndex];
+            minimum.type = TopinoTools::extremaMinimum;
+            extrema.append(minimum);
+        }
+
+        TopinoTools::Extrema maximum;
+        maximum.index = it->index;
+        maximum.pos = points[it->index];
+        maximum.type = TopinoTools::extremaMaximum;
+        extrema.append(maximum);
+
+        lastIndex = it->index;
+    }
+
+    return extrema;
+}
+
 QVector<TopinoTools::Section> TopinoTools::getSections(const QVector<QPointF>& points,
         const QVector<TopinoTools::Extrema> &extrema, qreal threshold) {
     QVector<TopinoTools::Section> sections;
@@ -663,55 +1311,165 @@ QVector<TopinoTools::Section> TopinoTools::getSections(const QVector<QPointF>& p
 
 
 QVector<TopinoTools::Lorentzian> TopinoTools::calculateLorentzians(const QVector<QPointF>& points,
-        const QVector<TopinoTools::Section>& sections, qreal threshold) {
+        const QVector<TopinoTools::Section>& sections, qreal threshold, TopinoTools::peakModels model,
+        const QVector<TopinoTools::Lorentzian>& initialGuesses, TopinoTools::LorentzianCache *cache) {
     /* Create a vector for returning the fit Lorentzians */
     QVector<TopinoTools::Lorentzian> data;
 
+    /* Initial guesses can only be assigned to the sections if the layout (i.e. number) is the same */
+    bool useGuesses = (initialGuesses.length() == sections.length());
+
     /* Fit each section */
-    for(auto it = sections.begin(); it != sections.end(); ++it) {
-        data.append(calculateSingleLorentzian(points, *it, threshold));
+    for(int i = 0; i < sections.length(); ++i) {
+        const TopinoTools::Lorentzian *guess = nullptr;
+        if (useGuesses && isLorentzianCompatible(points, sections[i], initialGuesses[i])) {
+            guess = &initialGuesses[i];
+        }
+
+        /* Data of this section (and the guess) did not change? Then the fit will not change either. */
+        TopinoTools::SectionKey key;
+        if (cache != nullptr) {
+            key = createSectionKey(points, sections[i], threshold, model, guess);
+
+            auto cached = cache->constFind(key);
+            if (cached != cache->constEnd()) {
+                data.append(cached.value());
+                continue;
+            }
+        }
+
+        data.append(calculateSingleLorentzian(points, sections[i], threshold, model, guess));
+
+        if (cache != nullptr) {
+            cache->insert(key, data.last());
+        }
     }
 
     /* Return all the Lorentzians! */
     return data;
 }
 
-TopinoTools::Lorentzian TopinoTools::calculateSingleLorentzian(const QVector<QPointF>& points,
-        const TopinoTools::Section& section, qreal threshold) {
-    /* Prepare data and fill with a good guess of parameters */
-    TopinoTools::Lorentzian data;
-
-    QPointF max = points[section.indexMax];
-    QPointF left = points[section.indexLeft];
-    QPointF right = points[section.indexRight];
-
-    data.height = max.y() - threshold;
-    data.offset = threshold;
-    data.pos = max.x();
-    data.width = (right.x() - left.x()) / 2.0;
-
-    /* Transfer the parameters into an vector. The order is pos (index=0),
-     * height (index=1), width (index=2), and offset (index=3). */
-    Eigen::VectorXd p(4);
+/* Fits the peak model to the data points starting with the parameters given in data. Returns false
+ * if the solver did not converge. */
+template<typename Model>
+static bool fitPeakModel(const QVector<QPointF>& dataPoints, TopinoTools::Lorentzian& data) {
+    /* Transfer the parameters into an vector. The order is pos (index=0), height (index=1),
+     * width (index=2), offset (index=3), and shape (index=4) if used by the model. */
+    typename TopinoTools::PeakSolver<Model>::ParameterVector p;
     p(0) = data.pos;
     p(1) = data.height;
     p(2) = data.width;
     p(3) = data.offset;
+    if (Model::Parameters > 4) {
+        p(4) = data.shape;
+    }
 
-    /* Create a functor for the solving algorithm */
-    QVector<QPointF> dataPoints = points.mid(section.indexLeft, section.indexRight - section.indexLeft);
-    LorentzianFunctor functor;
-    functor.dataValues = dataPoints;
+#ifndef QT_NO_DEBUG
+    /* The analytic gradients are checked against finite differences at the starting point */
+    for(auto it = dataPoints.constBegin(); it != dataPoints.constEnd(); ++it) {
+        Q_ASSERT_X(TopinoTools::isGradientConsistent<Model>(it->x(), p.data()), "fitPeakModel",
+                   "analytic gradient differs from finite differences");
+    }
+#endif
+
+    TopinoTools::PeakSolver<Model> solver;
+    solver.setDataValues(dataPoints);
+
+    typename TopinoTools::PeakSolver<Model>::ParameterVector start = p;
+    bool converged = solver.minimize(p);
+
+    qDebug("Minimization %s after %d iterations", converged ? "converged" : "did not converge", solver.iterations);
+
+    /* Fall back to the (slower) solver of Eigen from the same starting point */
+    if (!converged) {
+        TopinoTools::PeakFunctor<Model> functor;
+        functor.setDataValues(dataPoints);
 
-    Eigen::LevenbergMarquardt<LorentzianFunctor> lm(functor);
-    int status = lm.minimize(p);
+        Eigen::VectorXd fallback = start;
+        Eigen::LevenbergMarquardt<TopinoTools::PeakFunctor<Model>> lm(functor);
+        int status = lm.minimize(fallback);
+
+        qDebug("Fallback minimization return with %d after %ld iterations", status, (long)lm.iter);
+
+        p = fallback;
+        converged = (status > 0) && (status < Eigen::LevenbergMarquardtSpace::TooManyFunctionEvaluation);
+    }
 
     /* Copy the data */
-    qDebug("Minimization return with %d", status);
     data.pos    = p(0);
     data.height = p(1);
-    data.width  = p(2);
+    data.width  = qAbs(p(2));
     data.offset = p(3);
+    if (Model::Parameters > 4) {
+        data.shape = p(4);
+    }
+
+    if (data.model == TopinoTools::modelPseudoVoigt) {
+        data.shape = qBound(0.0, data.shape, 1.0);
+    }
+
+    return converged;
+}
+
+TopinoTools::Lorentzian TopinoTools::calculateSingleLorentzian(const QVector<QPointF>& points,
+        const TopinoTools::Section& section, qreal threshold, TopinoTools::peakModels model,
+        const TopinoTools::Lorentzian *initialGuess) {
+    /* Prepare data and fill with a good guess of parameters (or the initial guess if given) */
+    TopinoTools::Lorentzian data;
+
+    QPointF max = points[section.indexMax];
+    QPointF left = points[section.indexLeft];
+    QPointF right = points[section.indexRight];
+
+    if (initialGuess != nullptr) {
+        data.pos = initialGuess->pos;
+        data.height = initialGuess->height;
+        data.width = initialGuess->width;
+        data.offset = initialGuess->offset;
+        data.model = initialGuess->model;
+        data.shape = initialGuess->shape;
+    } else {
+        data.height = max.y() - threshold;
+        data.offset = threshold;
+        data.pos = max.x();
+        data.width = (right.x() - left.x()) / 2.0;
+    }
+
+    /* The initial guess might be for a different model; in that case, guess the shape parameter:
+     * an equal mix for pseudo-Voigt and a tail towards the longer side of the section for EMG. */
+    if ((initialGuess == nullptr) || (initialGuess->model != model)) {
+        data.model = model;
+
+        if (model == modelPseudoVoigt) {
+            data.shape = 0.5;
+        } else if (model == modelEMG) {
+            qreal tail = qAbs(right.x() - max.x()) - qAbs(max.x() - left.x());
+            data.shape = (tail * (right.x() - left.x()) >= 0.0) ? qAbs(data.width) / 4.0 : -qAbs(data.width) / 4.0;
+        } else {
+            data.shape = 0.0;
+        }
+    }
+
+    /* Fit the data of the section with the chosen model */
+    QVector<QPointF> dataPoints = points.mid(section.indexLeft, section.indexRight - section.indexLeft);
+
+    qDebug("Fitting %s (%s)", getPeakModelName(model).toStdString().c_str(),
+           (initialGuess != nullptr) ? "warm start" : "cold start");
+
+    switch (model) {
+    case modelGaussian:
+        fitPeakModel<GaussianModel>(dataPoints, data);
+        break;
+    case modelPseudoVoigt:
+        fitPeakModel<PseudoVoigtModel>(dataPoints, data);
+        break;
+    case modelEMG:
+        fitPeakModel<EMGModel>(dataPoints, data);
+        break;
+    default:
+        fitPeakModel<LorentzianModel>(dataPoints, data);
+        break;
+    }
 
     /* Additionally, calculate the R2 value to get a guess of the fitting quality (also used for linearity). */
     data.rsquare = calculateLorentzianR2(dataPoints, data);
@@ -719,6 +1477,52 @@ TopinoTools::Lorentzian TopinoTools::calculateSingleLorentzian(const QVector<QPo
     return data;
 }
 
+bool TopinoTools::isLorentzianCompatible(const QVector<QPointF>& points, const TopinoTools::Section& section,
+        const TopinoTools::Lorentzian& guess) {
+    /* The x-values might be ascending or descending (depending on the orientation) */
+    qreal left = points[section.indexLeft].x();
+    qreal right = points[section.indexRight].x();
+
+    return (guess.pos >= qMin(left, right)) && (guess.pos <= qMax(left, right)) &&
+           (guess.height > 0.0) && (guess.width > 0.0);
+}
+
+bool TopinoTools::SectionKey::operator==(const TopinoTools::SectionKey& other) const {
+    /* Exact comparison (QPointF compares fuzzily) */
+    return (maxOffset == other.maxOffset) && (threshold == other.threshold) && (model == other.model) &&
+           (hasGuess == other.hasGuess) && (memcmp(guess, other.guess, sizeof(guess)) == 0) &&
+           (points.length() == other.points.length()) &&
+           (memcmp(points.constData(), other.points.constData(), size_t(points.length()) * sizeof(QPointF)) == 0);
+}
+
+uint TopinoTools::qHash(const TopinoTools::SectionKey& key, uint seed) {
+    seed ^= ::qHash(key.threshold) ^ ::qHash(int(key.model)) ^ ::qHash(key.maxOffset);
+    seed = qHashBits(key.guess, sizeof(key.guess), seed);
+
+    return qHashBits(key.points.constData(), size_t(key.points.length()) * sizeof(QPointF), seed);
+}
+
+TopinoTools::SectionKey TopinoTools::createSectionKey(const QVector<QPointF>& points, const TopinoTools::Section& section,
+        qreal threshold, TopinoTools::peakModels model, const TopinoTools::Lorentzian *guess) {
+    /* The threshold, the borders, and a given guess only change the starting values, but might lead to
+     * a (slightly) different fit */
+    TopinoTools::SectionKey key;
+    key.points = points.mid(section.indexLeft, section.indexRight - section.indexLeft + 1);
+    key.maxOffset = section.indexMax - section.indexLeft;
+    key.threshold = threshold;
+    key.model = model;
+
+    if (guess != nullptr) {
+        key.hasGuess = true;
+        key.guess[0] = guess->pos;
+        key.guess[1] = guess->height;
+        key.guess[2] = guess->width;
+        key.guess[3] = guess->offset;
+        key.guess[4] = guess->shape;
+    }
+
+    return key;
+}
 
 qreal TopinoTools::calculateLorentzianR2(const QVector<QPointF>& points, const TopinoTools::Lorentzian& parameters) {
     /* No points given? */
@@ -753,3 +1557,389 @@ qreal TopinoTools::calculateResolution(qreal pos1, qreal width1, qreal pos2, qre
      * https://pubs.acs.org/doi/10.1021/acs.analchem.8b02186 (Equation 7) */
     return 2.0 * qAbs(pos2 - pos1) / (width1 + width2);
 }
+
+/* Job for the bootstrap: a number of iterations for one section. Each job has its own workspace,
+ * i.e. the solver (holding the data) is created once and reused for every iteration; only the
+ * y-values of the data are replaced for each iteration. */
+struct BootstrapJob {
+    int section = 0;
+    int iterations = 0;
+    quint32 seed = 0;
+    QVector<QPointF> samples;
+};
+
+template<typename Model>
+static void bootstrapSection(const QVector<QPointF>& dataPoints, const TopinoTools::Lorentzian& fit, BootstrapJob& job) {
+    /* Fitted values and residuals of the original fit */
+    int n = dataPoints.length();
+    QVector<qreal> fitted(n);
+    QVector<qreal> residuals(n);
+    for(int i = 0; i < n; ++i) {
+        fitted[i] = fit.f(dataPoints[i].x());
+        residuals[i] = dataPoints[i].y() - fitted[i];
+    }
+
+    /* Workspace of this job */
+    TopinoTools::PeakSolver<Model> solver;
+    solver.setDataValues(dataPoints);
+    typename TopinoTools::PeakSolver<Model>::ParameterVector p;
+
+    QRandomGenerator generator(job.seed);
+    job.samples.reserve(job.iterations);
+
+    for(int b = 0; b < job.iterations; ++b) {
+        /* New data set: fit plus randomly drawn residuals */
+        for(int i = 0; i < n; ++i) {
+            solver.yValues[i] = fitted[i] + residuals[generator.bounded(n)];
+        }
+
+        /* Start from the original fit; the new fit is typically very close */
+        p(0) = fit.pos;
+        p(1) = fit.height;
+        p(2) = fit.width;
+        p(3) = fit.offset;
+        if (Model::Parameters > 4) {
+            p(4) = fit.shape;
+        }
+
+        solver.minimize(p);
+
+        job.samples.append(QPointF(p(0), qAbs(p(2))));
+    }
+}
+
+void TopinoTools::calculateBootstrap(const QVector<QPointF>& points, const QVector<TopinoTools::Section>& sections,
+                                     QVector<TopinoTools::Lorentzian>& fits, int iterations, qreal level) {
+    if ((sections.length() != fits.length()) || (iterations <= 0)) {
+        return;
+    }
+
+    /* Split the iterations of each section into chunks, so that there is enough to do for all threads
+     * even with only one or two sections. */
+    const int chunkSize = 25;
+    QVector<BootstrapJob> jobs;
+
+    for(int i = 0; i < sections.length(); ++i) {
+        for(int start = 0; start < iterations; start += chunkSize) {
+            BootstrapJob job;
+            job.section = i;
+            job.iterations = qMin(chunkSize, iterations - start);
+            job.seed = quint32(i * iterations + start + 1);
+            jobs.append(job);
+        }
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QtConcurrent::blockingMap(jobs, [&points, &sections, &fits](BootstrapJob &job) {
+        const TopinoTools::Section &section = sections[job.section];
+        QVector<QPointF> dataPoints = points.mid(section.indexLeft, section.indexRight - section.indexLeft);
+
+        switch (fits[job.section].model) {
+        case modelGaussian:
+            bootstrapSection<GaussianModel>(dataPoints, fits[job.section], job);
+            break;
+        case modelPseudoVoigt:
+            bootstrapSection<PseudoVoigtModel>(dataPoints, fits[job.section], job);
+            break;
+        case modelEMG:
+            bootstrapSection<EMGModel>(dataPoints, fits[job.section], job);
+            break;
+        default:
+            bootstrapSection<LorentzianModel>(dataPoints, fits[job.section], job);
+            break;
+        }
+    });
+
+    /* Collect the samples of each section (in the order of the jobs, so that the results are
+     * reproducible and the samples of the sections are paired by their iteration) */
+    QVector<QVector<QPointF>> samples(fits.length());
+
+    for(auto it = jobs.begin(); it != jobs.end(); ++it) {
+        samples[it->section].append(it->samples);
+    }
+
+    for(int i = 0; i < fits.length(); ++i) {
+        QVector<qreal> positions;
+        QVector<qreal> widths;
+
+        for(auto it = samples[i].begin(); it != samples[i].end(); ++it) {
+            positions.append(it->x());
+            widths.append(it->y());
+        }
+
+        fits[i].posCI = calculatePercentileInterval(positions, level);
+        fits[i].widthCI = calculatePercentileInterval(widths, level);
+
+        /* Resolutions to the following fits; only the intervals are kept */
+        fits[i].resolutionCIs.clear();
+
+        for(int j = (i+1); j < fits.length(); ++j) {
+            int n = qMin(samples[i].length(), samples[j].length());
+
+            QVector<qreal> resolutions;
+            resolutions.reserve(n);
+
+            for(int k = 0; k < n; ++k) {
+                const QPointF &a = samples[i][k];
+                const QPointF &b = samples[j][k];
+                resolutions.append(calculateResolution(a.x(), a.y(), b.x(), b.y()));
+            }
+
+            fits[i].resolutionCIs.append(calculatePercentileInterval(resolutions, level));
+        }
+    }
+
+    qDebug("Bootstrap: %d iterations for %d sections in %lld ms.", iterations, sections.length(), timer.elapsed());
+}
+
+TopinoTools::ConfidenceInterval TopinoTools::getResolutionCI(const QVector<TopinoTools::Lorentzian>& streams,
+        int stream1, int stream2) {
+    if (stream1 > stream2) {
+        qSwap(stream1, stream2);
+    }
+
+    if ((stream1 < 0) || (stream2 >= streams.length()) || (stream1 == stream2)) {
+        return TopinoTools::ConfidenceInterval();
+    }
+
+    return streams[stream1].resolutionCIs.value(stream2 - stream1 - 1);
+}
+
+TopinoTools::ConfidenceInterval TopinoTools::calculatePercentileInterval(QVector<qreal> values, qreal level) {
+    TopinoTools::ConfidenceInterval interval;
+
+    if (values.isEmpty()) {
+        return interval;
+    }
+
+    std::sort(values.begin(), values.end());
+
+    /* Indices of the lower and upper percentile, e.g. 2.5% and 97.5% for a level of 95% */
+    qreal alpha = (1.0 - level) / 2.0;
+    int lower = qBound(0, qFloor(alpha * (values.length() - 1)), values.length() - 1);
+    int upper = qBound(0, qCeil((1.0 - alpha) * (values.length() - 1)), values.length() - 1);
+
+    interval.lower = values[lower];
+    interval.upper = values[upper];
+
+    return interval;
+}
+
+QVector<TopinoTools::AutoTuneCandidate> TopinoTools::evaluateSmoothingParameters(const SampledSignal &signal, int smoothSize,
+        qreal smoothSigma, const QVector<qreal> &thresholds, TopinoTools::peakFilterCriteria criterion, TopinoTools::peakModels model,
+        qreal baselineLambda, qreal baselineAsymmetry) {
+    QVector<TopinoTools::AutoTuneCandidate> candidates;
+
+    /* Smoothing and finding the extrema does not depend on the threshold, so do it only once
+     * for all thresholds. */
+    TopinoTools::SampledSignal smoothedSignal = signal;
+    TopinoTools::smoothByGaussianKernel(smoothedSignal, smoothSize, smoothSigma);
+
+    /* The threshold is relative to the maximum of the smoothed data (like the scaling factor of the
+     * manual evaluation), even if the baseline is removed */
+    qreal maxValue = 0.0;
+    for(auto it = smoothedSignal.values.constBegin(); it != smoothedSignal.values.constEnd(); ++it) {
+        maxValue = qMax(maxValue, *it);
+    }
+
+    /* Hierarchy, sections, and fits work on points */
+    QVector<QPointF> smoothedPoints = smoothedSignal.toPoints();
+
+    if (baselineLambda > 0.0) {
+        TopinoTools::Baseline baseline = TopinoTools::calculateBaselineALS(smoothedPoints, baselineLambda, baselineAsymmetry);
+        smoothedPoints = TopinoTools::subtractBaseline(smoothedPoints, baseline);
+    }
+
+    qreal minValue = smoothedPoints.isEmpty() ? 0.0 : smoothedPoints.first().y();
+    for(auto it = smoothedPoints.constBegin(); it != smoothedPoints.constEnd(); ++it) {
+        minValue = qMin(minValue, it->y());
+    }
+
+    TopinoTools::PeakHierarchy hierarchy = TopinoTools::calculatePeakHierarchy(smoothedPoints);
+
+    /* Sections of the last fitted threshold; if the sections do not change for the next threshold,
+     * the fits will not change (much) either and do not have to be repeated. */
+    QVector<TopinoTools::Section> lastSections;
+    QVector<TopinoTools::Lorentzian> lastFits;
+
+    for(auto it = thresholds.begin(); it != thresholds.end(); ++it) {
+        TopinoTools::AutoTuneCandidate candidate;
+        candidate.parameters.smoothSize = smoothSize;
+        candidate.parameters.smoothSigma = smoothSigma;
+        candidate.parameters.threshold = *it;
+
+        qreal threshold = (*it / 100.0) * maxValue;
+        QVector<TopinoTools::Extrema> extrema = TopinoTools::getExtremaFromHierarchy(hierarchy, threshold, criterion);
+
+        /* Same as for the manual evaluation: sections for prominence go down to the lowest point */
+        if (criterion == filterProminence) {
+            threshold = minValue;
+        }
+
+        int minima = TopinoTools::countExtrema(extrema, TopinoTools::extremaMinimum);
+        int maxima = TopinoTools::countExtrema(extrema, TopinoTools::extremaMaximum);
+        candidate.peaks = maxima;
+
+        /* Same conditions as for the manual evaluation of the angulagram; when filtering by height, peaks
+         * that are not separated above the threshold fail */
+        if ((maxima == 0) || (maxima > 7) || (minima != (maxima - 1))) {
+            candidates.append(candidate);
+            continue;
+        }
+
+        QVector<TopinoTools::Section> sections = TopinoTools::getSections(smoothedPoints, extrema, threshold);
+
+        bool sameSections = (sections.length() == lastSections.length());
+        for(int i = 0; sameSections && (i < sections.length()); ++i) {
+            sameSections = (sections[i].indexLeft == lastSections[i].indexLeft) &&
+                           (sections[i].indexRight == lastSections[i].indexRight) &&
+                           (sections[i].indexMax == lastSections[i].indexMax);
+        }
+
+        if (!sameSections) {
+            lastFits = TopinoTools::calculateLorentzians(smoothedPoints, sections, threshold, model);
+            lastSections = sections;
+        }
+
+        /* Fits that do not make any sense (e.g. negative height or width) make the candidate invalid */
+        qreal sumRSquare = 0.0;
+        candidate.valid = !lastFits.isEmpty();
+        for(auto fit = lastFits.begin(); fit != lastFits.end(); ++fit) {
+            if ((fit->height <= 0.0) || (fit->width <= 0.0) || std::isnan(fit->rsquare)) {
+                candidate.valid = false;
+            }
+            sumRSquare += fit->rsquare;
+        }
+
+        if (candidate.valid) {
+            candidate.meanRSquare = sumRSquare / lastFits.length();
+        }
+
+        candidates.append(candidate);
+    }
+
+    return candidates;
+}
+
+QVector<TopinoTools::AutoTuneCandidate> TopinoTools::autoTuneParameters(const SampledSignal &signal, int maxSmoothSize,
+        TopinoTools::peakFilterCriteria criterion, TopinoTools::peakModels model, int count, qreal baselineLambda,
+        qreal baselineAsymmetry) {
+    /* The search grid: odd kernel sizes, sigmas (only used if the kernel covers at least
+     * ±1 sigma), and thresholds in percent of the maximum. */
+    const qreal sigmas[] = { 0.5, 1.0, 1.5, 2.0, 3.0, 4.0, 6.0, 8.0 };
+    const int sigmaCount = sizeof(sigmas) / sizeof(sigmas[0]);
+    const QVector<qreal> thresholds = { 1.0, 2.0, 3.0, 5.0, 7.5, 10.0, 12.5, 15.0, 20.0 };
+
+    QVector<int> sizes;
+    for(int size = 3; (size <= maxSmoothSize) && (size <= 51) && (size < signal.length()); size += 2) {
+        sizes.append(size);
+    }
+
+    if (sizes.isEmpty()) {
+        return QVector<TopinoTools::AutoTuneCandidate>();
+    }
+
+    /* One job for each size/sigma pair; each job evaluates all thresholds. The results are
+     * stored in the job itself, so that the jobs can be processed in parallel. */
+    struct AutoTuneJob {
+        int sizeIndex = 0;
+        int sigmaIndex = 0;
+        QVector<TopinoTools::AutoTuneCandidate> candidates;
+    };
+
+    QVector<AutoTuneJob> jobs;
+    for(int i = 0; i < sizes.length(); ++i) {
+        for(int j = 0; j < sigmaCount; ++j) {
+            if (sigmas[j] > sizes[i] / 2.0) {
+                continue;
+            }
+
+            AutoTuneJob job;
+            job.sizeIndex = i;
+            job.sigmaIndex = j;
+            jobs.append(job);
+        }
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QtConcurrent::blockingMap(jobs, [&signal, &sizes, &sigmas, &thresholds, criterion, model, baselineLambda,
+                              baselineAsymmetry](AutoTuneJob &job) {
+        job.candidates = TopinoTools::evaluateSmoothingParameters(signal, sizes[job.sizeIndex], sigmas[job.sigmaIndex],
+                         thresholds, criterion, model, baselineLambda, baselineAsymmetry);
+    });
+
+    /* Put the results into the grid (size × sigma × threshold) to find the neighbours of each
+     * candidate; grid cells without a job stay invalid with zero peaks. */
+    const int thresholdCount = thresholds.length();
+    QVector<TopinoTools::AutoTuneCandidate> grid(sizes.length() * sigmaCount * thresholdCount);
+    QVector<bool> evaluated(grid.length(), false);
+
+    auto gridIndex = [sigmaCount, thresholdCount](int i, int j, int k) {
+        return (i * sigmaCount + j) * thresholdCount + k;
+    };
+
+    for(auto it = jobs.begin(); it != jobs.end(); ++it) {
+        for(int k = 0; k < it->candidates.length(); ++k) {
+            grid[gridIndex(it->sizeIndex, it->sigmaIndex, k)] = it->candidates[k];
+            evaluated[gridIndex(it->sizeIndex, it->sigmaIndex, k)] = true;
+        }
+    }
+
+    /* Stability: fraction of the evaluated direct neighbours with the same peak count. A robust
+     * parameter set should not change the result if one of the parameters changes slightly. */
+    QVector<TopinoTools::AutoTuneCandidate> results;
+
+    for(int i = 0; i < sizes.length(); ++i) {
+        for(int j = 0; j < sigmaCount; ++j) {
+            for(int k = 0; k < thresholdCount; ++k) {
+                TopinoTools::AutoTuneCandidate candidate = grid[gridIndex(i, j, k)];
+
+                if (!candidate.valid) {
+                    continue;
+                }
+
+                int neighbours = 0;
+                int sameNeighbours = 0;
+                const int offsets[6][3] = { {-1, 0, 0}, {1, 0, 0}, {0, -1, 0}, {0, 1, 0}, {0, 0, -1}, {0, 0, 1} };
+
+                for(int n = 0; n < 6; ++n) {
+                    int ni = i + offsets[n][0];
+                    int nj = j + offsets[n][1];
+                    int nk = k + offsets[n][2];
+
+                    if ((ni < 0) || (ni >= sizes.length()) || (nj < 0) || (nj >= sigmaCount) || (nk < 0) || (nk >= thresholdCount) ||
+                            !evaluated[gridIndex(ni, nj, nk)]) {
+                        continue;
+                    }
+
+                    neighbours++;
+                    if (grid[gridIndex(ni, nj, nk)].peaks == candidate.peaks) {
+                        sameNeighbours++;
+                    }
+                }
+
+                candidate.stability = (neighbours > 0) ? (qreal)sameNeighbours / neighbours : 0.0;
+                candidate.score = qMax(candidate.meanRSquare, 0.0) * (0.5 + 0.5 * candidate.stability);
+
+                results.append(candidate);
+            }
+        }
+    }
+
+    /* Sort by score (best first) and only return the requested number of candidates */
+    std::sort(results.begin(), results.end(), [](const TopinoTools::AutoTuneCandidate &a, const TopinoTools::AutoTuneCandidate &b) {
+        return a.score > b.score;
+    });
+
+    if (results.length() > count) {
+        results.resize(count);
+    }
+
+    qDebug("Auto-tune: evaluated %d parameter sets in %lld ms.", jobs.length() * thresholdCount, timer.elapsed());
+
+    return results;
+}
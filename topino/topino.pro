@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT       += core gui svg
+QT       += core gui svg concurrent
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets charts
 
@@ -27,6 +27,16 @@ VERSION_PE_HEADER = 1.1
 QMAKE_TARGET_DESCRIPTION = "Program to create and evaluate angulagrams"
 QMAKE_TARGET_COPYRIGHT = "Sven Kochmann, 2021"
 
+# The result store (a local database of the saved analyses) needs the SQL
+# module; without it, Topino is built without the result store.
+qtHaveModule(sql) {
+    QT += sql
+    DEFINES += TOPINO_RESULT_STORE
+    SOURCES += src/resultstore.cpp src/resultstoredialog.cpp
+    HEADERS += include/resultstore.h include/resultstoredialog.h
+    FORMS += ui/resultstoredialog.ui
+}
+
 # Adding the include path for eigen3, which is in parallel to the topino
 # source directory. Please see license, etc. in the eigen3 directory.
 INCLUDEPATH += ../eigen3
@@ -85,7 +95,10 @@ SOURCES += \
     src/inletpropdialog.cpp \
     src/evalangulagramdialog.cpp \
     src/polarimagedialog.cpp \
-    src/radialgramdialog.cpp
+    src/radialgramdialog.cpp \
+    src/angulagrampreview.cpp \
+    src/mappedimagereader.cpp \
+    src/rawimagedialog.cpp
 
 HEADERS += \
     include/mainwindow.h \
@@ -109,7 +122,11 @@ HEADERS += \
     include/inletpropdialog.h \
     include/evalangulagramdialog.h \
     include/polarimagedialog.h \
-    include/radialgramdialog.h
+    include/radialgramdialog.h \
+    include/peakmodels.h \
+    include/angulagrampreview.h \
+    include/mappedimagereader.h \
+    include/rawimagedialog.h
 
 FORMS += \
     ui/mainwindow.ui \
@@ -117,7 +134,8 @@ FORMS += \
     ui/inletpropdialog.ui \
     ui/evalangulagramdialog.ui \
     ui/polarimagedialog.ui \
-    ui/radialgramdialog.ui
+    ui/radialgramdialog.ui \
+    ui/rawimagedialog.ui
 
 RESOURCES += \
     topino.qrc